@@ -0,0 +1,300 @@
+/**
+ *  crash.c
+ *
+ *  Watchdog crash record (see crash.h). The reset cause is saved in the
+ *  .init3 section of the startup code, before the static variables are
+ *  initialised, and the watchdog is turned off there: after a watchdog
+ *  reset it stays on with the shortest timeout, and would reset the MCU
+ *  again before main got going.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+#include <stdint.h>
+
+#include "crash.h"
+#include "isrmon.h"
+#include "stack.h"
+#include "uart.h"
+
+/********************************************************************/
+
+#define RECORD_MAGIC                0x4352
+
+// bytes the watchdog ISR pushes before calling watchdog_interrupt: r0,
+// SREG, r1, r18 to r27, r30 and r31. The return address is above them,
+// high byte first.
+#define FRAME_SIZE                  15
+
+// .noinit is not cleared at reset, so the record made by the watchdog ISR
+// is still there after the reset it leads to.
+static struct crash_record record __attribute__ ((section (".noinit")));
+static uint8_t reset_cause __attribute__ ((section (".noinit")));
+
+static struct crash_record EEMEM stored_record;
+
+void crash_save_reset_cause (void) __attribute__ ((naked, used, section (".init3")));
+static void watchdog_interrupt (uint16_t sp) __attribute__ ((used));
+
+// tick.c borrows the watchdog to wake from sleep; if it's linked in, its
+// handler is called when the watchdog isn't set to reset the MCU.
+void tick_watchdog_interrupt (void) __attribute__ ((weak));
+
+/********************************************************************/
+
+/**
+ *  Save and clear the reset flags, and turn the watchdog off.
+ */
+    void
+crash_save_reset_cause (void)
+{
+    reset_cause = MCUSR;
+    MCUSR = 0;
+    wdt_disable ();
+}
+
+/********************************************************************/
+
+/**
+ *  Check why the MCU was reset. Call at the start of main, before enabling
+ *  interrupts. After a watchdog reset, the crash record is saved in EEPROM.
+ *
+ *  Returns 1 if the MCU was reset by the watchdog, otherwise 0.
+ */
+    uint8_t
+crash_init (void)
+{
+    struct crash_record saved;
+
+    if (!(reset_cause & _BV (WDRF)))
+    {
+        record.magic = 0;
+        return 0;
+    }
+
+    // no record means the watchdog ISR couldn't run.
+    if (record.magic != RECORD_MAGIC)
+    {
+        record.pc = 0;
+        record.sp = 0;
+        record.min_free = 0;
+    }
+
+#ifdef ISRMON_HAVE_LAST
+    record.last_isr = isrmon_last;
+#else
+    record.last_isr = CRASH_NO_ISR;
+#endif
+
+    record.reset_cause = reset_cause;
+    record.count = crash_last (&saved)? saved.count + 1 : 1;
+    record.magic = RECORD_MAGIC;
+    eeprom_update_block (&record, &stored_record, sizeof (record));
+
+    // so that a later reset with interrupts disabled isn't taken for this
+    // one.
+    record.magic = 0;
+
+    return 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the reset flags (MCUSR) from the last reset: WDRF, BORF, EXTRF
+ *  or PORF.
+ */
+    uint8_t
+crash_reset_cause (void)
+{
+    return reset_cause;
+}
+
+/********************************************************************/
+
+/**
+ *  Read the last crash record from EEPROM into *record.
+ *
+ *  Returns 1 if there is one, or 0 if there have been no crashes since the
+ *  EEPROM was erased or crash_clear was called.
+ */
+    uint8_t
+crash_last (last)
+    struct crash_record *last;
+{
+    eeprom_read_block (last, &stored_record, sizeof (*last));
+
+    return last->magic == RECORD_MAGIC;
+}
+
+/********************************************************************/
+
+/**
+ *  Erase the crash record in EEPROM, and the count of crashes.
+ */
+    void
+crash_clear (void)
+{
+    eeprom_update_word (&(stored_record.magic), 0xFFFF);
+}
+
+/********************************************************************/
+
+/**
+ *  Send the reset cause, and the last crash record if there is one, over
+ *  the UART. Numbers are in hex. isr is the monitor's vector number (see
+ *  isrmon.h), with 80 added if it had finished, or FF if unknown; pc 0
+ *  means the MCU was stuck with interrupts disabled.
+ */
+    void
+crash_report (void)
+{
+    struct crash_record last;
+
+    uart_printf ("reset: cause %x\r\n", reset_cause);
+
+    if (crash_last (&last))
+    {
+        uart_printf ("last crash (%x): pc %x sp %x ", last.count, last.pc, last.sp);
+        uart_printf ("stack free %x isr %x\r\n", last.min_free, last.last_isr);
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Start the watchdog, to record a crash and reset the MCU if it isn't fed
+ *  within timeout (one of the WDTO_ constants from avr/wdt.h).
+ */
+    void
+crash_watchdog_start (timeout)
+    uint8_t timeout;
+{
+    uint8_t prescaler = (timeout & 0x07) | ((timeout & 0x08)? _BV (WDP3) : 0x00);
+    uint8_t sreg = SREG;
+
+    // the second write must follow the first within 4 cycles.
+    cli ();
+    wdt_reset ();
+    WDTCSR = _BV (WDCE) | _BV (WDE);
+    WDTCSR = _BV (WDIE) | _BV (WDE) | prescaler;
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Restart the watchdog timeout. Call regularly from the main loop (eg from
+ *  a periodic software timer), not from an ISR, which would keep the
+ *  watchdog fed while the main loop is stuck.
+ */
+    void
+crash_watchdog_feed (void)
+{
+    wdt_reset ();
+}
+
+/********************************************************************/
+
+/**
+ *  Stop the watchdog.
+ */
+    void
+crash_watchdog_stop (void)
+{
+    uint8_t sreg = SREG;
+
+    cli ();
+    wdt_reset ();
+    MCUSR &= ~_BV (WDRF);
+    WDTCSR = _BV (WDCE) | _BV (WDE);
+    WDTCSR = 0x00;
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Called by the watchdog ISR with the stack pointer after its pushes. If
+ *  the watchdog is set to reset the MCU, the main loop has stopped feeding
+ *  it: record where it was, and wait for the reset.
+ */
+    static void
+watchdog_interrupt (sp)
+    uint16_t sp;
+{
+    const uint8_t *frame = (const uint8_t *) sp;
+
+    if (!(WDTCSR & _BV (WDE)))
+    {
+        if (tick_watchdog_interrupt)
+            tick_watchdog_interrupt ();
+
+        return;
+    }
+
+    record.pc = ((frame [FRAME_SIZE + 1] << 8) | frame [FRAME_SIZE + 2]) << 1;
+    record.sp = sp + FRAME_SIZE + 2;
+    record.min_free = stack_min_free ();
+    record.magic = RECORD_MAGIC;
+
+    while (1)
+        ;
+}
+
+/********************************************************************/
+
+/**
+ *  Watchdog interrupt handler. Naked, so that the stack pointer can be
+ *  passed on at a known distance from the return address.
+ */
+ISR (WDT_vect, ISR_NAKED)
+{
+    __asm__ __volatile__ (
+        "push r0"                       "\n\t"
+        "in r0, __SREG__"               "\n\t"
+        "push r0"                       "\n\t"
+        "push r1"                       "\n\t"
+        "clr __zero_reg__"              "\n\t"
+        "push r18"                      "\n\t"
+        "push r19"                      "\n\t"
+        "push r20"                      "\n\t"
+        "push r21"                      "\n\t"
+        "push r22"                      "\n\t"
+        "push r23"                      "\n\t"
+        "push r24"                      "\n\t"
+        "push r25"                      "\n\t"
+        "push r26"                      "\n\t"
+        "push r27"                      "\n\t"
+        "push r30"                      "\n\t"
+        "push r31"                      "\n\t"
+        "in r24, __SP_L__"              "\n\t"
+        "in r25, __SP_H__"              "\n\t"
+        "%~call %x[handler]"            "\n\t"
+        "pop r31"                       "\n\t"
+        "pop r30"                       "\n\t"
+        "pop r27"                       "\n\t"
+        "pop r26"                       "\n\t"
+        "pop r25"                       "\n\t"
+        "pop r24"                       "\n\t"
+        "pop r23"                       "\n\t"
+        "pop r22"                       "\n\t"
+        "pop r21"                       "\n\t"
+        "pop r20"                       "\n\t"
+        "pop r19"                       "\n\t"
+        "pop r18"                       "\n\t"
+        "pop r1"                        "\n\t"
+        "pop r0"                        "\n\t"
+        "out __SREG__, r0"              "\n\t"
+        "pop r0"                        "\n\t"
+        "reti"                          "\n\t"
+        :
+        : [handler] "i" (watchdog_interrupt)
+    );
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
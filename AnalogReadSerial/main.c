@@ -1,14 +1,48 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
+#include <stddef.h>
 
 #include "uart.h"
 #include "analog.h"
+#include "crash.h"
+#include "isrmon.h"
+#include "probe.h"
+#include "sched.h"
+#include "thermistor.h"
+#include "tick.h"
+#include "timer.h"
 
 
 /********************************************************************/
 
-static volatile int refresh_results = 0;
+// A0 is scanned in the background, oversampled by 2 bits to give the 12 bit
+// readings that the thermistor table expects. Near 25C a reading changes by
+// about 45 per degree, so only changes of more than 4 (about 0.1C) are
+// reported.
+static struct analog_scan_entry thermistor_input [] =
+{
+    {0, ANALOG_REFERENCE_AREF, 0, 2, ANALOG_EVENT_CHANGE, 0, 0, 0, 4},
+};
+
+// The watchdog is fed four times a second from the main loop, and resets
+// the MCU if it goes a second without.
+#define WATCHDOG_FEED               250
+
+static struct timer watchdog_timer;
+
+// ms between checks for a command from the UART.
+#define COMMAND_POLL                100
+
+static struct timer command_timer;
+
+/********************************************************************/
+
+static void print_hundredths (int value);
+static void reading_changed (uint8_t index, uint8_t event, uint16_t value);
+static void report_reading (uint16_t value);
+static void feed_watchdog (void *arg);
+static void poll_command (void *arg);
 
 /********************************************************************/
 
@@ -18,52 +52,156 @@ static volatile int refresh_results = 0;
  *  The hardware circuit consists of a 10k pull up resistor in series with an
  *  NTC thermistor, which is nominally 10k @ 25C (298 Kelvin). The varying
  *  resistance of the thermistor results in a varying voltage, which is wired
- *  to pin 23 (A0 on Arduino).
+ *  to pin 23 (A0 on Arduino). The pull up must be connected to the same
+ *  supply as AREF, so that the readings don't depend on the supply voltage.
  *
  *  For simplified testing purposes, you may also use a simple 10k / 10k
  *  voltage divider network, which should deliver 2.5V to the analog input,
- *  resulting in analog readings of 512.
+ *  resulting in analog readings of 512 (2048 after oversampling), or 25C.
+ *
+ *  The ADC samples the input on every timer 0 overflow (about 1kHz), and
+ *  averages 16 samples into each 12 bit reading. The ADC ISR only posts an
+ *  event when the reading has changed by more than about 0.1C; the event
+ *  handler then converts it to a temperature with a lookup table, and
+ *  transmits both in a brief message over the UART line.
  *
- *  This implementation uses a hardware timer to take a reading of the analog
- *  input once per second, and then transmits the reading in a brief message
- *  over the UART line.
+ *  At start up, the demo reports why the MCU was reset, and where the main
+ *  loop was stuck the last time the watchdog had to reset it.
+ *
+ *  Built with -DPROBE_ENABLE or -DISRMON_ENABLE, it also takes single
+ *  character commands over the UART: 'p' sends the profiling probes, 'i'
+ *  the interrupt monitor's table, and 'r' clears both.
  */
     int
 main (void)
 {
+    crash_init ();
     analog_init (0x01);
     uart_init (9600);
-    int value;
+    crash_report ();
+
+    tick_init ();
+    timer_setup (&watchdog_timer, feed_watchdog, NULL);
+    timer_start (&watchdog_timer, WATCHDOG_FEED, WATCHDOG_FEED);
+    crash_watchdog_start (WDTO_1S);
+
+    // both take over timer 1, which the ADC isn't using.
+    isrmon_init ();
+    probe_init ();
+    timer_setup (&command_timer, poll_command, NULL);
+    timer_start (&command_timer, COMMAND_POLL, COMMAND_POLL);
+
+    // timer 0 in normal mode with the /64 prescaler overflows at 976Hz.
+    TCCR0A = 0x00;
+    TCCR0B = (TCCR0B & 0xF8) | 0x03;
+    analog_set_event_handler (reading_changed);
+    analog_scan_start (thermistor_input, 1, ANALOG_TRIGGER_TIMER0, 0);
 
-    TCCR1B = (TCCR1B & 0xF8) | 0x04;
-    TIMSK1 |= 0x01;
+    // The scheduler sleeps in idle mode, since the ADC is triggered by
+    // timer 0, which stops in the deeper modes.
+    sched_run ();
 
-    // Enter an infinite sleep loop. Note that we will take the analog reading
-    // in this loop, not the ISR, because the analog_read function will put
-    // the MCU in noise reduction sleep, which probably shouldn't be done in
-    // an ISR (ie, we don't want to wait for an interrupt while we're handling
-    // an interrupt).
-    while (1)
+    return 0;
+}
+
+/********************************************************************/
+
+/**
+ *  Event handler: convert a new reading to a temperature, and send both.
+ */
+    static void
+report_reading (value)
+    uint16_t value;
+{
+    int temperature = thermistor_celsius (value);
+
+    uart_printf ("Got analog reading: %x, temperature ", value);
+    print_hundredths (temperature);
+    transmit_string (" C\r\n");
+}
+
+/********************************************************************/
+
+/**
+ *  Watchdog timer callback: the main loop is still running.
+ */
+    static void
+feed_watchdog (arg)
+    void *arg;
+{
+    crash_watchdog_feed ();
+}
+
+/********************************************************************/
+
+/**
+ *  Command timer callback: act on a command received over the UART, if
+ *  there is one. The dumps wait for the UART as they go, so feed the
+ *  watchdog before each.
+ */
+    static void
+poll_command (arg)
+    void *arg;
+{
+    switch (uart_poll ())
     {
-        if (refresh_results)
-        {
-            value = analog_read (0);
-            uart_printf ("Got analog reading: %x\r\n", value);
-            refresh_results = 0;
-        }
-
-        sei ();
-        sleep_mode ();
+    case 'p':
+        crash_watchdog_feed ();
+        probe_dump ();
+        break;
+
+    case 'i':
+        crash_watchdog_feed ();
+        isrmon_dump ();
+        break;
+
+    case 'r':
+        probe_reset ();
+        isrmon_reset ();
+        break;
+
+    default:
+        break;
     }
+}
 
-    return 0;
+/********************************************************************/
+
+/**
+ *  Transmit a fixed point value in hundredths, eg 2345 as 23.45.
+ */
+    static void
+print_hundredths (value)
+    int value;
+{
+    if (value < 0)
+    {
+        transmit_string ("-");
+        value = -value;
+    }
+
+    uart_printf ("%d.", value / 100);
+
+    if (value % 100 < 10)
+        transmit_string ("0");
+
+    uart_printf ("%d", value % 100);
 }
 
 /********************************************************************/
 
-ISR (TIMER1_OVF_vect)
+/**
+ *  ADC event handler (ISR context): pass the new reading on to the main
+ *  loop. If the UART falls behind and the queue fills up, readings are
+ *  skipped until there is room.
+ */
+    static void
+reading_changed (index, event, value)
+    uint8_t index;
+    uint8_t event;
+    uint16_t value;
 {
-    refresh_results = 1;
+    sched_post (SCHED_PRIORITY_NORMAL, report_reading, value);
 }
 
 /********************************************************************/
@@ -0,0 +1,236 @@
+/**
+ *  sched.c
+ *
+ *  Event scheduler. Each priority level has a ring buffer of events. Only
+ *  the main loop takes events out (it is the only writer of tail), so it
+ *  never has to disable interrupts to do so. Events are put in with
+ *  interrupts disabled, which costs nothing in an ISR, since ISRs don't
+ *  interrupt each other.
+ *
+ *  The check for waiting events and the sleep instruction are done with
+ *  interrupts disabled, so an event posted just after the check can't be
+ *  left waiting until some unrelated interrupt wakes the MCU: the
+ *  instruction after sei is always run before any interrupt, so the ISR
+ *  that posts the event runs after sleep_cpu, and wakes the MCU again.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stdint.h>
+
+#include "sched.h"
+#include "sleepctl.h"
+#include "tick.h"
+#include "timer.h"
+
+/********************************************************************/
+
+#define QUEUE_MASK                  (SCHED_QUEUE_LENGTH - 1)
+
+struct event
+{
+    sched_handler_t handler;
+    uint16_t arg;
+};
+
+struct event_queue
+{
+    struct event events [SCHED_QUEUE_LENGTH];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+};
+
+static struct event_queue queues [SCHED_PRIORITIES];
+
+// events dropped because their queue was full.
+static volatile uint16_t overflows;
+
+static uint8_t run_one (void);
+static void sleep_until_event (void);
+
+/********************************************************************/
+
+/**
+ *  Post an event, to call handler with arg from the main loop. Can be
+ *  called from ISRs, and from the main loop (including from handlers and
+ *  timer callbacks).
+ *
+ *  Returns 1 if the event was queued, or 0 if the queue for its priority
+ *  level was full, in which case the event is dropped and counted.
+ */
+    uint8_t
+sched_post (priority, handler, arg)
+    uint8_t priority;       // SCHED_PRIORITY_*
+    sched_handler_t handler;
+    uint16_t arg;
+{
+    struct event_queue *queue = &(queues [priority]);
+    uint8_t sreg = SREG;
+    uint8_t head, next;
+
+    cli ();
+    head = queue->head;
+    next = (head + 1) & QUEUE_MASK;
+
+    if (next == queue->tail)
+    {
+        overflows ++;
+        SREG = sreg;
+        return 0;
+    }
+
+    queue->events [head].handler = handler;
+    queue->events [head].arg = arg;
+    queue->head = next;
+    SREG = sreg;
+
+    return 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the number of events dropped because their queue was full.
+ */
+    uint16_t
+sched_overflows (void)
+{
+    uint16_t count;
+    uint8_t sreg = SREG;
+
+    cli ();
+    count = overflows;
+    SREG = sreg;
+
+    return count;
+}
+
+/********************************************************************/
+
+/**
+ *  Dispatch the software timers that are due, and run all of the events
+ *  waiting, without sleeping. For programs that keep their own main loop.
+ *
+ *  Returns the number of events run, up to 255.
+ */
+    uint8_t
+sched_run_pending (void)
+{
+    uint8_t count = 0;
+
+    timer_dispatch ();
+
+    while (run_one ())
+    {
+        if (count != 0xFF)
+            count ++;
+    }
+
+    return count;
+}
+
+/********************************************************************/
+
+/**
+ *  Run the scheduler; never returns. Call at the end of main, once the
+ *  drivers are set up, and the first timers started.
+ */
+    void
+sched_run (void)
+{
+    while (1)
+    {
+        // timers are checked between events, so a long queue of events
+        // doesn't hold them up for more than one handler.
+        timer_dispatch ();
+
+        if (!run_one ())
+            sleep_until_event ();
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Run the oldest event of the most urgent priority level that has one.
+ *
+ *  Returns 1 if an event was run, 0 if there were none waiting.
+ */
+    static uint8_t
+run_one (void)
+{
+    struct event_queue *queue;
+    struct event event;
+    uint8_t tail;
+
+    for (uint8_t i = 0; i < SCHED_PRIORITIES; i ++)
+    {
+        queue = &(queues [i]);
+        tail = queue->tail;
+
+        if (tail != queue->head)
+        {
+            // copy the event out before freeing its slot.
+            event = queue->events [tail];
+            queue->tail = (tail + 1) & QUEUE_MASK;
+
+            event.handler (event.arg);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/********************************************************************/
+
+/**
+ *  Sleep in the deepest mode that the drivers allow, unless an event has
+ *  been posted since run_one last looked. The tick is told when the next
+ *  timer is due, so that it can wake the MCU then without interrupting it
+ *  every millisecond in between (see tick.h).
+ */
+    static void
+sleep_until_event (void)
+{
+    uint8_t waiting = 0;
+    uint8_t have_deadline, level;
+    uint32_t deadline = 0;
+
+    cli ();
+
+    for (uint8_t i = 0; i < SCHED_PRIORITIES; i ++)
+        waiting |= (queues [i].head != queues [i].tail);
+
+    if (!waiting)
+    {
+        have_deadline = timer_next (&deadline);
+        level = tick_before_sleep (sleepctl_level (), have_deadline, deadline);
+
+        if (level == TICK_NO_SLEEP)
+        {
+            sei ();
+            return;
+        }
+
+        set_sleep_mode (sleepctl_mode (level));
+        sleep_enable ();
+        sei ();
+        sleep_cpu ();
+        sleep_disable ();
+
+        cli ();
+        tick_after_sleep ();
+
+        // drivers that wait for something with sleep_mode (eg analog_read
+        // or uart_getchar) expect idle mode.
+        set_sleep_mode (SLEEP_MODE_IDLE);
+    }
+
+    sei ();
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
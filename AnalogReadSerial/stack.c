@@ -0,0 +1,99 @@
+/**
+ *  stack.c
+ *
+ *  Stack painting and high water mark (see stack.h). The paint is applied
+ *  in the .init1 section of the startup code, before the stack pointer is
+ *  set up and the static variables are initialised; nothing is on the
+ *  stack yet, and the RAM above _end is not touched by the startup code.
+ */
+
+#include <avr/io.h>
+#include <stdint.h>
+
+#include "stack.h"
+
+/********************************************************************/
+
+// the end of the static variables (.data, .bss and .noinit), from the
+// linker script.
+extern uint8_t _end;
+
+void stack_paint (void) __attribute__ ((naked, used, section (".init1")));
+
+/********************************************************************/
+
+/**
+ *  Fill the RAM from _end to RAMEND with STACK_PAINT. Naked, and in
+ *  assembler, since r1 isn't cleared until .init2; the startup code falls
+ *  through from here to the next section.
+ */
+    void
+stack_paint (void)
+{
+    __asm__ __volatile__ (
+        "    ldi r30, lo8(_end)"        "\n\t"
+        "    ldi r31, hi8(_end)"        "\n\t"
+        "    ldi r24, %[paint]"         "\n\t"
+        "    ldi r25, hi8(%[top])"      "\n\t"
+        "    rjmp 2f"                   "\n\t"
+        "1:  st Z+, r24"                "\n\t"
+        "2:  cpi r30, lo8(%[top])"      "\n\t"
+        "    cpc r31, r25"              "\n\t"
+        "    brlo 1b"                   "\n\t"
+        "    breq 1b"                   "\n\t"
+        :
+        : [paint] "M" (STACK_PAINT), [top] "i" (RAMEND)
+    );
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the bytes of RAM taken by static variables.
+ */
+    uint16_t
+stack_static_size (void)
+{
+    return (uint16_t) &_end - RAMSTART;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the bytes of RAM free below the stack now.
+ */
+    uint16_t
+stack_free (void)
+{
+    return SP - (uint16_t) &_end + 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the least free RAM there has been below the stack since reset:
+ *  the count of painted bytes the stack hasn't reached yet. Takes about
+ *  5 cycles for each free byte.
+ *
+ *  A local array that was never written all the way down leaves painted
+ *  bytes at the bottom of the stack, so the count can come out a little
+ *  high; leave some margin.
+ */
+    uint16_t
+stack_min_free (void)
+{
+    const uint8_t *p = &_end;
+    uint16_t count = 0;
+
+    while (p <= (const uint8_t *) RAMEND && *p == STACK_PAINT)
+    {
+        p ++;
+        count ++;
+    }
+
+    return count;
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
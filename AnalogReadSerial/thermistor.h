@@ -0,0 +1,17 @@
+/**
+ *  thermistor.h
+ *
+ *  Declares functions to convert ADC readings from an NTC thermistor
+ *  voltage divider to temperatures, using a lookup table in flash.
+ */
+
+#ifndef _THERMISTOR_H
+#define _THERMISTOR_H
+
+#include <stdint.h>
+
+int16_t thermistor_celsius (uint16_t reading);
+
+#endif // _THERMISTOR_H
+
+/** vim: set ts=4 sw=4 et : */
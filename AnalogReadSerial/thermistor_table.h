@@ -0,0 +1,38 @@
+/**
+ *  thermistor_table.h
+ *
+ *  Generated by thermistor_table.py, do not edit.
+ *
+ *  Thermistor: Beta 3950, 10000 ohms at 25 C
+ *  Pull-up: 10000 ohms
+ *  Readings: 12 bits, 32 readings between table points
+ *  Worst interpolation error from -40 C to 125 C: 0.30 C
+ */
+
+#define THERMISTOR_INPUT_BITS       12
+#define THERMISTOR_TABLE_SHIFT      5
+#define THERMISTOR_TABLE_LENGTH     129
+
+// temperature in 0.01 C at each table point.
+static const int16_t thermistor_table [THERMISTOR_TABLE_LENGTH] PROGMEM =
+{
+     32767,  19685,  16067,  14182,  12932,  12006,  11274,  10671,
+     10160,   9717,   9326,   8977,   8661,   8372,   8107,   7862,
+      7633,   7419,   7218,   7028,   6849,   6678,   6515,   6360,
+      6211,   6068,   5930,   5797,   5669,   5545,   5425,   5309,
+      5196,   5086,   4979,   4874,   4772,   4673,   4575,   4480,
+      4387,   4295,   4205,   4117,   4030,   3944,   3860,   3777,
+      3696,   3615,   3536,   3457,   3379,   3302,   3226,   3151,
+      3077,   3003,   2929,   2857,   2784,   2713,   2641,   2570,
+      2500,   2430,   2360,   2290,   2221,   2152,   2083,   2014,
+      1945,   1876,   1807,   1739,   1670,   1601,   1532,   1463,
+      1393,   1323,   1253,   1183,   1113,   1041,    970,    898,
+       825,    752,    678,    604,    528,    452,    375,    296,
+       217,    136,     54,    -29,   -114,   -200,   -288,   -379,
+      -471,   -566,   -663,   -763,   -867,   -973,  -1084,  -1199,
+     -1318,  -1443,  -1575,  -1713,  -1859,  -2015,  -2182,  -2363,
+     -2560,  -2778,  -3023,  -3304,  -3637,  -4050,  -4603,  -5483,
+    -32768,
+};
+
+/** vim: set ts=4 sw=4 et : */
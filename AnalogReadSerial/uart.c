@@ -4,6 +4,9 @@
 #include <string.h>
 #include <stdarg.h>
 
+#include "isrmon.h"
+#include "probe.h"
+#include "sleepctl.h"
 #include "uart.h"
 
 #define BUFFER_LENGTH 32
@@ -117,6 +120,10 @@ uart_init (baud_rate)
     received_data = 0;
     got_char = 0;
 
+    // the receiver is always on, and needs the I/O clock, so the MCU must
+    // not sleep any deeper than idle.
+    sleepctl_lock (SLEEPCTL_IDLE);
+
     // enable interrupts now that configuration is done.
     sei ();
 }
@@ -336,6 +343,32 @@ uart_getchar (void)
 
 /********************************************************************/
 
+/**
+ *  Return the character received since the last call to uart_poll or
+ *  uart_getchar, or 0 if there isn't one. Doesn't wait, so a main loop or
+ *  timer callback can check for commands with it.
+ */
+    char
+uart_poll (void)
+{
+    char received = 0;
+    uint8_t sreg = SREG;
+
+    cli ();
+
+    if (got_char)
+    {
+        received = received_data;
+        got_char = 0;
+    }
+
+    SREG = sreg;
+
+    return received;
+}
+
+/********************************************************************/
+
 /**
  *  Read data from USART, line oriented.
  *
@@ -371,6 +404,49 @@ uart_getline (buffer, max_length)
 
 /********************************************************************/
 
+/**
+ *  Return the number of available slots in the transmit queue.
+ *  This ensures that if callers need to send multiple messages, we can ensure
+ *  the output doesn't get garbled if the last part of the message bundle would
+ *  be dropped due to the queue filling up.
+ */
+    uint8_t
+tx_slots_free (void)
+{
+    uint8_t count = 0;
+    uint8_t sreg = SREG;
+
+    // the UDRE ISR puts items back on the free list.
+    cli ();
+
+    for (struct queue_item *item = free_list; item != NULL; item = item->next)
+        count ++;
+
+    SREG = sreg;
+
+    return count;
+}
+
+/********************************************************************/
+
+/**
+ *  Sleep until there are at least slots free in the transmit queue, eg
+ *  before a burst of messages that mustn't be cut short. Like uart_getchar,
+ *  this cannot be called from within an ISR.
+ */
+    void
+tx_wait_for_slots (slots)
+    uint8_t slots;
+{
+    while (tx_slots_free () < slots)
+    {
+        sei ();
+        sleep_mode ();
+    }
+}
+
+/********************************************************************/
+
 /**
  *  Fetch the next available slot in the transmit buffer. If the buffer is
  *  full, this function will return null.
@@ -530,6 +606,9 @@ ISR (USART_UDRE_vect)
 {
     struct queue_item *current_item;
 
+    ISRMON_ENTER (ISRMON_USART_UDRE);
+    PROBE_BEGIN (PROBE_UART_UDRE);
+
     // Check if there's data available in the transmit queue.
     if (head != NULL)
     {
@@ -552,6 +631,9 @@ ISR (USART_UDRE_vect)
         // nothing to transmit, so disable the UDRE interrupt.
         UCSR0B &= ~ _BV (UDRIE0);
     }
+
+    PROBE_END (PROBE_UART_UDRE);
+    ISRMON_EXIT (ISRMON_USART_UDRE);
 }
 
 /********************************************************************/
@@ -565,8 +647,10 @@ ISR (USART_UDRE_vect)
  */
 ISR (USART_RX_vect)
 {
+    ISRMON_ENTER (ISRMON_USART_RX);
     received_data = UDR0;
     got_char = 1;
+    ISRMON_EXIT (ISRMON_USART_RX);
 }
 
 /********************************************************************/
@@ -0,0 +1,60 @@
+/**
+ *  debounce.h
+ *
+ *  Declares functions to debounce buttons, by sampling them every
+ *  DEBOUNCE_PERIOD ms from a software timer. A button counts as pressed or
+ *  released once it has read the same for DEBOUNCE_SAMPLES samples in a
+ *  row. The counts for all the buttons on a port are kept in two bytes, a
+ *  bit of each per pin (vertical counters), so a whole port is debounced
+ *  at once in a few instructions.
+ *
+ *  Sampling only runs while a button is pressed or bouncing. The rest of
+ *  the time, the MCU sleeps, and the first pin change starts the sampling
+ *  again; the pin change interrupts are then turned off until the buttons
+ *  have settled, so the bounces don't fire them.
+ *
+ *  Each change is posted to the scheduler as an event (see sched.h), with
+ *  the event and button packed in the argument. A button held down gives
+ *  a long press event, and then repeat events if repeat is on for it. Only
+ *  the last button pressed is timed for those.
+ *
+ *  Buttons are wired from the pin to ground, and pulled up internally. The
+ *  system tick must be running (tick_init).
+ */
+
+#ifndef _DEBOUNCE_H
+#define _DEBOUNCE_H
+
+#include <stdint.h>
+
+#include "sched.h"
+
+// ms between samples, and the samples that must agree (fixed by the two
+// bit counters); a press is seen 20ms after the contacts settle.
+#define DEBOUNCE_PERIOD         5
+#define DEBOUNCE_SAMPLES        4
+
+// ms held for a long press, and between repeats after it.
+#define DEBOUNCE_LONG           600
+#define DEBOUNCE_REPEAT         150
+
+// events.
+#define DEBOUNCE_PRESS          1
+#define DEBOUNCE_RELEASE        2
+#define DEBOUNCE_LONG_PRESS     3
+#define DEBOUNCE_REPEAT_PRESS   4
+
+// the parts of the event argument: the event, and the button, which is
+// PCINT_PORT_ * 8 + the pin number.
+#define DEBOUNCE_EVENT(arg)     ((uint8_t) ((arg) >> 8))
+#define DEBOUNCE_BUTTON(arg)    ((uint8_t) (arg))
+#define DEBOUNCE_PORT(arg)      ((uint8_t) (arg) >> 3)
+#define DEBOUNCE_PIN(arg)       ((uint8_t) (arg) & 0x07)
+
+void debounce_init (sched_handler_t handler, uint8_t priority);
+uint8_t debounce_attach (uint8_t port, uint8_t mask, uint8_t repeat);
+uint8_t debounce_pressed (uint8_t port);
+
+#endif // _DEBOUNCE_H
+
+/** vim: set ts=4 sw=4 et : */
@@ -1,25 +1,39 @@
 #include <avr/io.h>
-#include <avr/interrupt.h>
-#include <avr/sleep.h>
 
+#include "debounce.h"
+#include "pcint.h"
+#include "pins.h"
+#include "sched.h"
+#include "tick.h"
 #include "uart.h"
 
 
+/********************************************************************/
+
+#define BUTTON_PIN      D, 2
+#define LED_PIN         B, 5
+
+/********************************************************************/
+
+static void button_event (uint16_t arg);
+
 /********************************************************************/
 
 /**
  *  ARDUINO DIGITAL READ SERIAL DEMO IN C
  *
- *  The hardware circuit consists of a push button and a 10k pull up
- *  resistor, connected to a digital input pin. When the button is pressed,
- *  it will pull the input pin low, when the switch is open, the input pin is
- *  pulled high through the pull up resistor.
+ *  The hardware circuit consists of a push button, connected from a digital
+ *  input pin to ground. When the button is pressed, it will pull the input
+ *  pin low, when the switch is open, the input pin is pulled high through
+ *  the internal pull up resistor.
  *
- *  On the software side, we will configure an interrupt handler on the
- *  respective pin change interrupt vector. When invoked, it will transmit
- *  a short message through the USART (TX/RX pins) to an FTDI chip, which
- *  in turn passes the message to a computer via USB, where the message can
- *  be viewed on a serial console.
+ *  On the software side, the debouncer samples the button every few ms
+ *  once it starts to move, and posts an event when it has settled, so the
+ *  bounces of the contacts don't show. The event handler transmits a short
+ *  message through the USART (TX/RX pins) to an FTDI chip, which in turn
+ *  passes the message to a computer via USB, where the message can be
+ *  viewed on a serial console. Holding the button down gives a long press
+ *  message, then repeats.
  *
  *  As a debugging tool, we will also echo the button state on an LED
  *  attached to port B pin 5.
@@ -30,31 +44,19 @@ main (void)
     // initialise the USART hardware.
     uart_init (9600);
 
-    // enable the internal pull up resistor for port D pin 2.
-    DDRD |= _BV (DDD2);
-    PORTD |= _BV (PORTD2);
+    // Set port B pin 5 to output, to display the button state.
+    PIN_OUTPUT (LED_PIN);
+    PIN_CLEAR (LED_PIN);
 
     // We have the signal from the push button going to pin 4 on the 328P,
-    // which corresponds to PCINT18 / port D pin 2.
-    // The pin is set to input on reset.
-    // First step is to enable the pin change interrupt in the PC mask
-    // register.
-    PCMSK2 |= _BV (PCINT18);
-
-    // now we need to enable pin change interrupt 2 (which handles PCINT 16 
-    // to 23).
-    PCICR |= _BV (PCIE2);
-
-    // Set port B pin 2 to output, to display the button state.
-    DDRB |= 0x20;
-    PORTB = 0x00;
-
-    // now we go into low power state.
-    for (;;)
-    {
-        sei ();
-        sleep_mode ();
-    }
+    // which corresponds to PCINT18 / port D pin 2. The debouncer samples it
+    // on the system tick.
+    tick_init ();
+    debounce_init (button_event, SCHED_PRIORITY_NORMAL);
+    debounce_attach (PIN_PCINT_PORT (BUTTON_PIN), PIN_MASK (BUTTON_PIN), PIN_MASK (BUTTON_PIN));
+
+    // now we go into low power state between events.
+    sched_run ();
 
     return 0;
 }
@@ -62,24 +64,34 @@ main (void)
 /********************************************************************/
 
 /**
- *  Interrupt handler for the pin change.
+ *  Button event handler.
  *
- *  Action taken is to check what the pin state is, and transmit a message
- *  via the USART hardware.
+ *  Action taken is to echo the button state on the LED, and transmit a
+ *  message via the USART hardware.
  */
-ISR (PCINT2_vect)
+    static void
+button_event (arg)
+    uint16_t arg;
 {
-    if ((PIND & 0x04) != 0)
+    switch (DEBOUNCE_EVENT (arg))
     {
-        // button is pressed
-        PORTB |= 0x20;
+    case DEBOUNCE_PRESS:
+        PIN_SET (LED_PIN);
         transmit_string ("button pressed\r\n");
-    }
-    else
-    {
-        // button has been released.
-        PORTB &= ~0x20;
+        break;
+
+    case DEBOUNCE_RELEASE:
+        PIN_CLEAR (LED_PIN);
         transmit_string ("button released\r\n");
+        break;
+
+    case DEBOUNCE_LONG_PRESS:
+        transmit_string ("button held\r\n");
+        break;
+
+    case DEBOUNCE_REPEAT_PRESS:
+        transmit_string ("button repeat\r\n");
+        break;
     }
 }
 
@@ -0,0 +1,40 @@
+/**
+ *  pcint.h
+ *
+ *  Declares functions to share the pin change interrupts between drivers.
+ *  There is one pin change interrupt per port, for any of the pins enabled
+ *  in its mask register, so drivers with pins on the same port (eg two
+ *  encoders, or an encoder and a keypad) attach handlers here instead of
+ *  defining the ISRs themselves.
+ *
+ *  The ISR reads the port once, and calls each handler whose pins have
+ *  changed, in ISR context, with the pins as read. Pins turned off with
+ *  pcint_disable are read again by pcint_enable, so changes made while
+ *  they were off aren't reported, and the next edge is.
+ */
+
+#ifndef _PCINT_H
+#define _PCINT_H
+
+#include <stdint.h>
+
+// ports, in the order of their pin change interrupts.
+#define PCINT_PORT_B            0   // PCINT0 to 7
+#define PCINT_PORT_C            1   // PCINT8 to 14
+#define PCINT_PORT_D            2   // PCINT16 to 23
+
+#define PCINT_PORTS             3
+
+// handlers that can be attached, on all ports together.
+#define PCINT_HANDLERS          4
+
+typedef void (*pcint_handler_t) (uint8_t port, uint8_t pins);
+
+uint8_t pcint_attach (uint8_t port, uint8_t mask, pcint_handler_t handler);
+void pcint_enable (uint8_t port, uint8_t mask);
+void pcint_disable (uint8_t port, uint8_t mask);
+uint8_t pcint_read (uint8_t port);
+
+#endif // _PCINT_H
+
+/** vim: set ts=4 sw=4 et : */
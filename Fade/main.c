@@ -1,13 +1,23 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
+#include <stddef.h>
 
 #include "pwm.h"
+#include "sched.h"
+#include "tick.h"
+#include "timer.h"
 
 /********************************************************************/
 
-static volatile int led_value;
-static volatile int fade_amount;
+static int led_value;
+static int fade_amount;
+static struct timer fade_timer;
+
+// ms between steps; 255 steps up and 255 down make about a 4 second cycle.
+#define FADE_STEP           8
+
+static void fade_step (void *arg);
 
 /********************************************************************/
 
@@ -28,17 +38,14 @@ main (void)
     led_value = 0x00;
     fade_amount = 1;
 
-    // Set the 8 bit timer 2. The timer overflow interrupts will be used to
-    // update the LED value
-    TCCR2B = (TCCR2B & 0xF8) | 0x07;
-    TIMSK2 |= 0x01;
+    // A software timer on the system tick updates the LED value.
+    tick_init ();
+    timer_setup (&fade_timer, fade_step, NULL);
+    timer_start (&fade_timer, FADE_STEP, FADE_STEP);
 
-    // enter idle sleep.
-    while (1)
-    {
-        sei ();
-        sleep_mode ();
-    }
+    // the scheduler sleeps in idle mode between steps, since timer 0 is
+    // running the PWM.
+    sched_run ();
 
     return 0;
 }
@@ -46,14 +53,16 @@ main (void)
 /********************************************************************/
 
 /**
- *  Timer 2 overflow ISR.
+ *  Fade timer callback.
  *
  *  Action to perform is to increment (or decrement) the led value, then update
  *  the value in the timer's PWM register. If the led value is at either min or
  *  max value, reverse the direction, ie switch from increment to decrement or
  *  vice versa.
  */
-ISR (TIMER2_OVF_vect)
+    static void
+fade_step (arg)
+    void *arg;
 {
     led_value += fade_amount;
     pwm_update_value (CHANNEL_A, led_value);
@@ -0,0 +1,268 @@
+/**
+ *  timer.c
+ *
+ *  Software timers on a hashed timing wheel. Each running timer is on the
+ *  list for slot (expires % TIMER_WHEEL_SLOTS); timers due more than one
+ *  turn of the wheel ahead share a slot with ones due sooner, and are
+ *  skipped until their time comes round. The lists are doubly linked
+ *  (through a pointer to the previous link), so a timer can be removed
+ *  without searching for it.
+ *
+ *  Timers may only be started and cancelled from the main loop, including
+ *  from callbacks; nothing here disables interrupts.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "tick.h"
+#include "timer.h"
+
+/********************************************************************/
+
+#define SLOT_MASK                   (TIMER_WHEEL_SLOTS - 1)
+
+static struct timer *wheel [TIMER_WHEEL_SLOTS];
+
+// the last tick that the wheel has been turned to.
+static uint32_t wheel_time;
+static uint16_t running;
+
+// timers taken off the wheel in this tick, waiting for their callbacks.
+static struct timer *due;
+
+// set while timer_dispatch is turning the wheel.
+static uint8_t dispatching;
+
+static void attach (struct timer **list, struct timer *timer);
+static void detach (struct timer *timer);
+
+/********************************************************************/
+
+/**
+ *  Set up a timer, which is not running until timer_start is called.
+ *  callback is called with arg each time the timer expires.
+ */
+    void
+timer_setup (timer, callback, arg)
+    struct timer *timer;
+    timer_callback_t callback;
+    void *arg;
+{
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->period = 0;
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+/********************************************************************/
+
+/**
+ *  Start (or restart) a timer, to expire in delay ms, and then every period
+ *  ms after that if period isn't 0. A delay of 0 is taken as 1, the next
+ *  tick.
+ */
+    void
+timer_start (timer, delay, period)
+    struct timer *timer;
+    uint16_t delay;
+    uint16_t period;
+{
+    if (timer->pprev)
+        detach (timer);
+
+    if (delay == 0)
+        delay = 1;
+
+    // if nothing was running, the wheel may have stopped turning; bring it
+    // up to date, so that timer_dispatch doesn't have to catch up. Not from
+    // a callback though: the tick may have moved past the time dispatch is
+    // turning the wheel to, and the wheel would then be ahead of it.
+    if (running == 0 && !dispatching)
+        wheel_time = tick_millis ();
+
+    timer->expires = tick_millis () + delay;
+    timer->period = period;
+    attach (&(wheel [timer->expires & SLOT_MASK]), timer);
+}
+
+/********************************************************************/
+
+/**
+ *  Stop a timer. Does nothing if the timer isn't running.
+ */
+    void
+timer_cancel (timer)
+    struct timer *timer;
+{
+    if (timer->pprev)
+        detach (timer);
+}
+
+/********************************************************************/
+
+/**
+ *  Returns non zero if the timer is running (waiting to expire).
+ */
+    uint8_t
+timer_running (timer)
+    struct timer *timer;
+{
+    return timer->pprev != NULL;
+}
+
+/********************************************************************/
+
+/**
+ *  Turn the wheel up to the current tick, and call the callbacks of the
+ *  timers that have expired. Call this from the main loop after each wake
+ *  up; if the main loop has been busy for a while, the ticks it missed are
+ *  caught up, in order.
+ *
+ *  Returns the number of callbacks called, up to 255.
+ */
+    uint8_t
+timer_dispatch (void)
+{
+    uint32_t now = tick_millis ();
+    struct timer *timer, *next;
+    uint8_t fired = 0;
+
+    if (running == 0)
+    {
+        wheel_time = now;
+        return 0;
+    }
+
+    dispatching = 1;
+
+    // the wheel is never ahead of now, but if it were, comparing the
+    // difference stops it going all the way round the clock.
+    while ((int32_t) (now - wheel_time) > 0)
+    {
+        wheel_time ++;
+
+        // move the timers due now off the wheel first, so that callbacks
+        // starting and cancelling timers can't upset the walk along the
+        // slot's list.
+        for (timer = wheel [wheel_time & SLOT_MASK]; timer; timer = next)
+        {
+            next = timer->next;
+
+            if (timer->expires == wheel_time)
+            {
+                detach (timer);
+                attach (&due, timer);
+            }
+        }
+
+        while ((timer = due) != NULL)
+        {
+            detach (timer);
+
+            // periodic timers keep to their schedule, however late this
+            // callback is.
+            if (timer->period)
+            {
+                timer->expires += timer->period;
+                attach (&(wheel [timer->expires & SLOT_MASK]), timer);
+            }
+
+            timer->callback (timer->arg);
+
+            if (fired != 0xFF)
+                fired ++;
+        }
+    }
+
+    dispatching = 0;
+
+    return fired;
+}
+
+/********************************************************************/
+
+/**
+ *  Find when the next timer is due, so that the MCU can sleep until then.
+ *  Looks at the slots in the order they come up, and stops once no later
+ *  slot can hold anything sooner, so this is quick unless all the running
+ *  timers are more than a turn of the wheel away.
+ *
+ *  Returns 1 and stores the tick_millis time in *expires, or returns 0 if
+ *  no timers are running.
+ */
+    uint8_t
+timer_next (expires)
+    uint32_t *expires;
+{
+    struct timer *timer;
+    uint32_t soonest = UINT32_MAX;
+    uint32_t ahead;
+
+    if (running == 0)
+        return 0;
+
+    for (uint16_t i = 1; i <= TIMER_WHEEL_SLOTS && soonest > i; i ++)
+    {
+        for (timer = wheel [(wheel_time + i) & SLOT_MASK]; timer; timer = timer->next)
+        {
+            ahead = timer->expires - wheel_time;
+
+            if (ahead < soonest)
+                soonest = ahead;
+        }
+    }
+
+    // only the timers on the due list are left, which is empty between
+    // calls to timer_dispatch.
+    if (soonest == UINT32_MAX)
+        return 0;
+
+    *expires = wheel_time + soonest;
+
+    return 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Add a timer to the front of a list.
+ */
+    static void
+attach (list, timer)
+    struct timer **list;
+    struct timer *timer;
+{
+    timer->next = *list;
+
+    if (*list)
+        (*list)->pprev = &(timer->next);
+
+    *list = timer;
+    timer->pprev = list;
+    running ++;
+}
+
+/********************************************************************/
+
+/**
+ *  Take a timer off whichever list it is on.
+ */
+    static void
+detach (timer)
+    struct timer *timer;
+{
+    *(timer->pprev) = timer->next;
+
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+
+    timer->next = NULL;
+    timer->pprev = NULL;
+    running --;
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -3,6 +3,9 @@
 #include <avr/sleep.h>
 
 #include "analog.h"
+#include "isrmon.h"
+#include "probe.h"
+#include "sleepctl.h"
 
 // mask for the ADC MUX selection bits in the ADMUX register
 #define ADMUX_MASK 0x0F
@@ -10,11 +13,20 @@
 // masks for the ADCSRA register
 #define ADCSRA_AD_ENABLE            0x80
 #define ADCSRA_START_CONVERSION     0x40
+#define ADCSRA_AUTO_TRIGGER         0x20
+#define ADCSRA_IRQ_FLAG             0x10
 #define ADCSRA_IRQ_ENABLE           0x08
 #define ADCSRA_PRESCALER            0x07
 // note: prescaler selects the /128 prescaler, which will provide an ADC clock
 // source at 125kHz, which is within the reccommended range of 50 to 200kHz.
 
+// /16 prescaler for fast 8 bit conversions (1MHz ADC clock). This is outside
+// the range for full 10 bit accuracy, but fine for 8 bits.
+#define ADCSRA_FAST_PRESCALER       0x04
+
+// left adjust the result in ADMUX, so the top 8 bits can be read from ADCH.
+#define ADMUX_LEFT_ADJUST           0x20
+
 // global variable to store the conversion results, and indicate if the results
 // are ready
 static volatile unsigned int conversion_results;
@@ -24,6 +36,69 @@ static volatile unsigned int conversion_results;
 // bits). This mask isolates our results_ready flag bit.
 #define RESULTS_READY_MASK          0x8000
 
+// mask for the auto trigger source bits in the ADCSRB register
+#define ADCSRB_TRIGGER_MASK         0x07
+
+// timer 1 set up for the ADC trigger: CTC mode with TOP in OCR1A, and the
+// /64 prescaler (4us per tick at 16MHz).
+#define TIMER1_CTC_MODE             0x08
+#define TIMER1_PRESCALER            0x03
+
+// Ring buffer of samples taken in auto trigger mode. The ADC ISR is the only
+// writer of buffer_head, and analog_get the only writer of buffer_tail, and
+// both are single bytes, so neither side needs to disable interrupts. One
+// slot is always left empty, so that a full buffer can be told apart from
+// an empty one.
+#define BUFFER_MASK                 (ANALOG_BUFFER_LENGTH - 1)
+
+static volatile uint16_t sample_buffer [ANALOG_BUFFER_LENGTH];
+static volatile uint8_t buffer_head;
+static volatile uint8_t buffer_tail;
+
+// number of samples dropped because the buffer was full.
+static volatile uint16_t overruns;
+
+// what the ADC is doing, so the ISR knows where the results go.
+#define MODE_SINGLE                 0x00
+#define MODE_STREAM                 0x01
+#define MODE_SCAN                   0x02
+
+static volatile uint8_t mode;
+
+// ADMUX as it was before auto triggering started, so that analog_read
+// carries on with the same reference afterwards.
+static uint8_t saved_admux;
+
+// ANALOG_TRIGGER_ source of the auto triggered conversions.
+static uint8_t active_trigger;
+
+// Scan sequencer state. The ISR fills in results [fill_buffer] of each entry
+// in turn; when the last entry is done, that buffer is published and the
+// other one is filled next. scan_sequence counts completed scans, so the
+// reader can tell if a scan completed while it was copying.
+static struct analog_scan_entry *scan_entries;
+static uint8_t scan_count;
+static uint8_t scan_index;
+static uint8_t fill_buffer;
+static uint8_t discard_next;
+static uint8_t fast_current;
+
+// oversampling: sum of the conversions of the current entry so far, and the
+// number still to take.
+static uint32_t accumulator;
+static uint16_t samples_left;
+static volatile uint8_t published_buffer;
+static volatile uint16_t scan_sequence;
+
+// called from the ISR when a scan entry raises an event.
+static analog_event_handler_t event_handler;
+
+static void start_trigger (uint8_t trigger, uint16_t period);
+static void scan_complete (uint16_t sample);
+static void check_events (uint8_t index, struct analog_scan_entry *entry, uint16_t value);
+static void select_entry (struct analog_scan_entry *entry);
+static void conversion_complete (void);
+
 
 /********************************************************************/
 
@@ -58,6 +133,8 @@ analog_init (channels_mask)
  *
  *  Return value is a number between 0 and 1023, where 0 represents 0V read
  *  on the analog channel, and 1023 corresponds to AREF (typically VCC) read.
+ *  When the reference is AVCC and the supply isn't regulated (eg a battery),
+ *  vcc_millivolts converts the reading using the measured supply voltage.
  */
     unsigned int
 analog_read (channel)
@@ -86,18 +163,517 @@ analog_read (channel)
 
 /********************************************************************/
 
+/**
+ *  Start sampling the specified channel at a fixed rate, set by a timer
+ *  rather than by software, so the samples are evenly spaced however long
+ *  the main loop takes to get to them. Samples are kept in a ring buffer
+ *  until they are fetched with analog_get.
+ *
+ *  With ANALOG_TRIGGER_TIMER1, timer 1 is set up to trigger a conversion
+ *  every period ticks of 4us. A conversion takes 13 ADC clocks (104us), so
+ *  the period should be at least 26. With ANALOG_TRIGGER_TIMER0, period is
+ *  ignored, and a conversion starts on each timer 0 overflow.
+ *
+ *  analog_read must not be used while sampling. Note that ADC noise
+ *  reduction sleep stops the timers, so the main loop should sleep in idle
+ *  mode instead.
+ */
+    void
+analog_start (channel, trigger, period)
+    uint8_t channel;        // analog channel num; 0 to 7 for the 328P
+    uint8_t trigger;        // ANALOG_TRIGGER_TIMER0 or ANALOG_TRIGGER_TIMER1
+    uint16_t period;        // timer 1 ticks (4us) between samples
+{
+    analog_stop ();
+
+    buffer_head = 0;
+    buffer_tail = 0;
+    overruns = 0;
+
+    saved_admux = ADMUX;
+    ADMUX = (saved_admux & ~ADMUX_MASK) | (channel & ADMUX_MASK);
+
+    mode = MODE_STREAM;
+    start_trigger (trigger, period);
+}
+
+/********************************************************************/
+
+/**
+ *  Stop auto triggered sampling or scanning, and go back to single
+ *  conversions with analog_read. Samples still in the buffer, and the last
+ *  complete scan, can be fetched afterwards. Timer 1 is left running.
+ */
+    void
+analog_stop (void)
+{
+    uint8_t sreg;
+
+    if (mode == MODE_SINGLE)
+        return;
+
+    ADCSRA &= ~ADCSRA_AUTO_TRIGGER;
+
+    // let a conversion that has already started finish, so the ISR doesn't
+    // mistake it for a single conversion result.
+    while (ADCSRA & ADCSRA_START_CONVERSION)
+        ;
+
+    // if its interrupt hasn't run yet (interrupts are disabled), drop the
+    // result: writing a one to the flag clears it.
+    sreg = SREG;
+    cli ();
+    ADCSRA = (ADCSRA & ~ADCSRA_PRESCALER) | ADCSRA_PRESCALER | ADCSRA_IRQ_FLAG;
+    mode = MODE_SINGLE;
+    ADMUX = saved_admux;
+    SREG = sreg;
+
+    sleepctl_unlock (SLEEPCTL_IDLE);
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the number of samples waiting in the buffer.
+ */
+    uint8_t
+analog_available (void)
+{
+    return (buffer_head - buffer_tail) & BUFFER_MASK;
+}
+
+/********************************************************************/
+
+/**
+ *  Fetch the oldest sample from the buffer.
+ *
+ *  Returns 1 if a sample was stored in *sample, or 0 if the buffer is empty.
+ */
+    uint8_t
+analog_get (sample)
+    uint16_t *sample;
+{
+    uint8_t tail = buffer_tail;
+
+    if (tail == buffer_head)
+        return 0;
+
+    *sample = sample_buffer [tail];
+    buffer_tail = (tail + 1) & BUFFER_MASK;
+
+    return 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the number of samples dropped since sampling started, because
+ *  the buffer was full.
+ */
+    uint16_t
+analog_overruns (void)
+{
+    uint16_t count;
+    uint8_t sreg = SREG;
+
+    cli ();
+    count = overruns;
+    SREG = sreg;
+
+    return count;
+}
+
+/********************************************************************/
+
+/**
+ *  Start scanning a list of channels, which may include the internal
+ *  temperature sensor and bandgap. Each trigger (see analog_start) converts
+ *  the next channel in the list, so a full scan takes count periods, plus
+ *  one more for each entry with ANALOG_SCAN_DISCARD, and 4^n - 1 more for
+ *  each entry oversampled by n bits.
+ *
+ *  The ISR selects the next channel as soon as a conversion completes, so
+ *  the input has the whole period to settle before it is sampled. Entries
+ *  with different references should have ANALOG_SCAN_DISCARD set, and even
+ *  then, the reference may need longer than one period to settle.
+ *
+ *  The list is owned by the driver until analog_stop is called. Results are
+ *  fetched with analog_scan_read or analog_scan_value, or passed to the
+ *  event handler for entries with events set.
+ */
+    void
+analog_scan_start (entries, count, trigger, period)
+    struct analog_scan_entry *entries;
+    uint8_t count;
+    uint8_t trigger;        // ANALOG_TRIGGER_TIMER0 or ANALOG_TRIGGER_TIMER1
+    uint16_t period;        // timer 1 ticks (4us) between conversions
+{
+    analog_stop ();
+
+    // work out the ADMUX value for each entry up front, to keep the ISR
+    // short.
+    for (uint8_t i = 0; i < count; i ++)
+    {
+        if (entries [i].oversample > ANALOG_OVERSAMPLE_MAX)
+            entries [i].oversample = ANALOG_OVERSAMPLE_MAX;
+
+        entries [i].admux = (entries [i].reference & 0xC0) | (entries [i].channel & ADMUX_MASK) |
+            ((entries [i].flags & ANALOG_SCAN_FAST)? ADMUX_LEFT_ADJUST : 0x00);
+        entries [i].results [0] = 0;
+        entries [i].results [1] = 0;
+        entries [i].zone = 0;
+    }
+
+    scan_entries = entries;
+    scan_count = count;
+    scan_index = 0;
+    fill_buffer = 0;
+    published_buffer = 1;
+    scan_sequence = 0;
+    accumulator = 0;
+
+    saved_admux = ADMUX;
+    select_entry (&(entries [0]));
+
+    mode = MODE_SCAN;
+    start_trigger (trigger, period);
+}
+
+/********************************************************************/
+
+/**
+ *  Copy the results of the last complete scan into values, one per entry in
+ *  the scan list. The copy is consistent (all values come from the same
+ *  scan), without holding off the ADC interrupt.
+ *
+ *  Returns the number of scans completed so far, which wraps around, but
+ *  skips zero. Zero means no scan has completed yet, and values is left
+ *  alone.
+ */
+    uint16_t
+analog_scan_read (values)
+    uint16_t *values;
+{
+    uint16_t before, after;
+    uint8_t buffer;
+    uint8_t sreg;
+
+    do
+    {
+        sreg = SREG;
+        cli ();
+        before = scan_sequence;
+        buffer = published_buffer;
+        SREG = sreg;
+
+        if (before == 0)
+            return 0;
+
+        for (uint8_t i = 0; i < scan_count; i ++)
+            values [i] = scan_entries [i].results [buffer];
+
+        sreg = SREG;
+        cli ();
+        after = scan_sequence;
+        SREG = sreg;
+
+        // once a scan completes, the ISR starts filling the buffer we were
+        // copying, and a value may even have been torn between its two
+        // bytes, so any completed scan means copying again.
+    }
+    while (after != before);
+
+    return before;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the result for one entry in the scan list, from the last
+ *  complete scan.
+ */
+    uint16_t
+analog_scan_value (index)
+    uint8_t index;
+{
+    uint16_t value;
+    uint8_t sreg = SREG;
+
+    cli ();
+    value = scan_entries [index].results [published_buffer];
+    SREG = sreg;
+
+    return value;
+}
+
+/********************************************************************/
+
+/**
+ *  Set the function called when a scan entry raises an event (see
+ *  ANALOG_EVENT_BELOW etc), or 0 for none. The handler runs in the ADC ISR,
+ *  so the main loop can sleep until something has actually changed, rather
+ *  than waking to poll every result.
+ */
+    void
+analog_set_event_handler (handler)
+    analog_event_handler_t handler;
+{
+    uint8_t sreg = SREG;
+
+    cli ();
+    event_handler = handler;
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Set up the auto trigger source, and enable auto triggering.
+ */
+    static void
+start_trigger (trigger, period)
+    uint8_t trigger;
+    uint16_t period;
+{
+    active_trigger = trigger;
+
+    if (trigger == ANALOG_TRIGGER_TIMER1)
+    {
+        // Compare match B is the trigger; with OCR1B equal to TOP, it
+        // happens once per period.
+        TCCR1A = 0x00;
+        TCCR1B = 0x00;
+        TCNT1 = 0;
+        OCR1A = period - 1;
+        OCR1B = period - 1;
+        TIFR1 = _BV (OCF1B);
+        TCCR1B = TIMER1_CTC_MODE | TIMER1_PRESCALER;
+    }
+    else
+    {
+        TIFR0 = _BV (TOV0);
+    }
+
+    ADCSRB = (ADCSRB & ~ADCSRB_TRIGGER_MASK) | (trigger & ADCSRB_TRIGGER_MASK);
+    ADCSRA |= ADCSRA_AUTO_TRIGGER | ADCSRA_IRQ_FLAG;
+
+    // the trigger timers stop in all sleep modes deeper than idle.
+    sleepctl_lock (SLEEPCTL_IDLE);
+}
+
+/********************************************************************/
+
+/**
+ *  Add a conversion to the current scan entry (ISR context). Once the entry
+ *  has all its conversions, store the result and select the next channel,
+ *  so the mux has until the next trigger to settle.
+ */
+    static void
+scan_complete (sample)
+    uint16_t sample;
+{
+    struct analog_scan_entry *entry;
+
+    if (discard_next)
+    {
+        // convert the same channel again.
+        discard_next = 0;
+        return;
+    }
+
+    entry = &(scan_entries [scan_index]);
+
+    // keep converting the same channel until we have all the samples to
+    // decimate. Only one shift per result, no division.
+    accumulator += sample;
+
+    if (-- samples_left != 0)
+        return;
+
+    entry->results [fill_buffer] = accumulator >> entry->oversample;
+    accumulator = 0;
+
+    if (entry->events && event_handler)
+        check_events (scan_index, entry, entry->results [fill_buffer]);
+
+    if (++ scan_index == scan_count)
+    {
+        scan_index = 0;
+        published_buffer = fill_buffer;
+        fill_buffer ^= 1;
+
+        if (++ scan_sequence == 0)
+            scan_sequence = 1;
+    }
+
+    select_entry (&(scan_entries [scan_index]));
+}
+
+/********************************************************************/
+
+/**
+ *  Work out which zone of its window a new result puts an entry in, and
+ *  whether it has moved far enough for a change event (ISR context). The
+ *  zone is kept as the event for it; zero means no result yet.
+ */
+    static void
+check_events (index, entry, value)
+    uint8_t index;
+    struct analog_scan_entry *entry;
+    uint16_t value;
+{
+    uint8_t zone = entry->zone;
+    uint8_t first = (zone == 0);
+    uint16_t moved;
+
+    // leaving one of the outer zones needs the extra hysteresis; a result
+    // could go straight through the window, from below to above, so check
+    // the other boundary too.
+    if (zone == ANALOG_EVENT_BELOW)
+    {
+        if (value >= entry->low && value - entry->low >= entry->hysteresis)
+            zone = ANALOG_EVENT_INSIDE;
+    }
+    else if (zone == ANALOG_EVENT_ABOVE)
+    {
+        if (value <= entry->high && entry->high - value >= entry->hysteresis)
+            zone = ANALOG_EVENT_INSIDE;
+    }
+
+    if (zone != ANALOG_EVENT_BELOW && zone != ANALOG_EVENT_ABOVE)
+    {
+        if (value < entry->low)
+            zone = ANALOG_EVENT_BELOW;
+        else if (value > entry->high)
+            zone = ANALOG_EVENT_ABOVE;
+        else
+            zone = ANALOG_EVENT_INSIDE;
+    }
+
+    if (zone != entry->zone)
+    {
+        entry->zone = zone;
+
+        if (entry->events & zone)
+            event_handler (index, zone, value);
+    }
+
+    if (entry->events & ANALOG_EVENT_CHANGE)
+    {
+        moved = (value > entry->reported)? value - entry->reported : entry->reported - value;
+
+        if (first || moved > entry->delta)
+        {
+            entry->reported = value;
+            event_handler (index, ANALOG_EVENT_CHANGE, value);
+        }
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Set the ADC up for the next conversion of a scan entry: channel,
+ *  reference, result adjustment and ADC clock.
+ */
+    static void
+select_entry (entry)
+    struct analog_scan_entry *entry;
+{
+    uint8_t prescaler = ADCSRA_PRESCALER;
+
+    fast_current = entry->flags & ANALOG_SCAN_FAST;
+
+    if (fast_current)
+        prescaler = ADCSRA_FAST_PRESCALER;
+
+    ADMUX = entry->admux;
+
+    // leave the interrupt flag alone; writing a one to it would clear it.
+    ADCSRA = (ADCSRA & ~(ADCSRA_PRESCALER | ADCSRA_IRQ_FLAG)) | prescaler;
+
+    discard_next = entry->flags & ANALOG_SCAN_DISCARD;
+    samples_left = (uint16_t) 1 << (entry->oversample << 1);
+}
+
+/********************************************************************/
+
 /**
  *  ADC complete interrupt handler.
  *
  *  Action to perform (in single shot mode) is to fetch the conversion results
  *  and place them in a variable. The analog_read function will then return
  *  that value back to it's caller.
+ *
+ *  In auto trigger mode, the result goes into the ring buffer instead, or is
+ *  counted as an overrun if the buffer is full. When scanning, it goes into
+ *  the scan list.
  */
 ISR (ADC_vect)
 {
-    conversion_results |= ADCL;
-    conversion_results |= ADCH << 8;
-    conversion_results |= RESULTS_READY_MASK;
+    ISRMON_ENTER (ISRMON_ADC);
+    PROBE_BEGIN (PROBE_ADC);
+    conversion_complete ();
+    PROBE_END (PROBE_ADC);
+    ISRMON_EXIT (ISRMON_ADC);
+}
+
+/********************************************************************/
+
+/**
+ *  Handle a completed conversion (ISR context).
+ */
+    static void
+conversion_complete (void)
+{
+    uint16_t sample;
+    uint8_t next;
+
+    if (mode == MODE_SINGLE)
+    {
+        conversion_results |= ADCL;
+        conversion_results |= ADCH << 8;
+        conversion_results |= RESULTS_READY_MASK;
+        return;
+    }
+
+    // ADCL must be read first; reading it locks the result until ADCH is
+    // read. Fast conversions are left adjusted, and only ADCH is needed.
+    if (mode == MODE_SCAN && fast_current)
+    {
+        sample = ADCH;
+    }
+    else
+    {
+        sample = ADCL;
+        sample |= ADCH << 8;
+    }
+
+    // the trigger is the rising edge of the timer's interrupt flag, so the
+    // flag must be cleared for the next one to count. Only the flag of the
+    // trigger in use is touched; the other timer's may belong to someone
+    // else.
+    if (active_trigger == ANALOG_TRIGGER_TIMER1)
+        TIFR1 = _BV (OCF1B);
+    else
+        TIFR0 = _BV (TOV0);
+
+    if (mode == MODE_SCAN)
+    {
+        scan_complete (sample);
+        return;
+    }
+
+    next = (buffer_head + 1) & BUFFER_MASK;
+
+    if (next == buffer_tail)
+    {
+        overruns ++;
+        return;
+    }
+
+    sample_buffer [buffer_head] = sample;
+    buffer_head = next;
 }
 
 /********************************************************************/
@@ -3,12 +3,30 @@
 #include <avr/interrupt.h>
 
 #include "analog.h"
+#include "sched.h"
+#include "tick.h"
+#include "timer.h"
 #include "tone.h"
 #include "uart.h"
 
 /********************************************************************/
 
-static volatile uint8_t refresh_reading;
+static struct timer refresh_timer;
+
+// A0 is sampled continuously in the fast 8 bit mode, which is all the
+// resolution the tone needs.
+static struct analog_scan_entry pitch_input [] =
+{
+    {0, ANALOG_REFERENCE_AREF, ANALOG_SCAN_FAST, 0},
+};
+
+// sample period in timer 1 ticks (4us), 10,000 samples per second.
+#define SAMPLE_PERIOD       25
+
+// ms between updates of the tone.
+#define REFRESH_PERIOD      16
+
+static void refresh_tone (void *arg);
 
 /********************************************************************/
 
@@ -18,7 +36,8 @@ static volatile uint8_t refresh_reading;
  *  This code reads an analog signal from A0, and produces a square wave with
  *  a frequency proportional to the analog reading on OCOA.
  *
- *  We will use a timer to take regular readings.
+ *  The ADC samples the input in the background, triggered by a timer, and
+ *  we pick up the latest reading at regular intervals.
  *
  *  The following resources are used:
  *  Pins:
@@ -27,46 +46,23 @@ static volatile uint8_t refresh_reading;
  *
  *  Timers:
  *      Timer 0:    used for generating the tone
- *      Timer 2:    used to trigger an ADC read
+ *      Timer 1:    triggers the ADC conversions
+ *      Timer 2:    system tick, for the timer that updates the tone
  */
     int
 main (void)
 {
-    int value;
     analog_init (0x01);
     tone_init (CHANNEL_A);
     uart_init (9600);
-    refresh_reading = 0;
+    tick_init ();
 
-    // Set the prescaler bits for timer 2. 0x07 selects the /1024 prescaler,
-    // which results in 16,000,000 / (1024 * 256) = 61 interrupts per second.
-    TCCR2B |= 0x07;
-    TIMSK2 |= 0x01;
+    analog_scan_start (pitch_input, 1, ANALOG_TRIGGER_TIMER1, SAMPLE_PERIOD);
 
-    while (1)
-    {
-        sei ();
-        sleep_mode ();
-
-        if (refresh_reading)
-        {
-            value = analog_read (0);
-
-            // map the analog reading range from 0:1023 to 0:255, by shifting
-            // the bits right.
-            value >>= 2;
-            set_frequency (CHANNEL_A, value);
-            refresh_reading = 0;
-
-            // send the analog reading on the UART
-            if (tx_slots_free () >= 3)
-            {
-                transmit_string ("Reading on A0 pin is: ");
-                transmit_int (value);
-                transmit_string ("\r\n");
-            }
-        }
-    }
+    timer_setup (&refresh_timer, refresh_tone, NULL);
+    timer_start (&refresh_timer, REFRESH_PERIOD, REFRESH_PERIOD);
+
+    sched_run ();
 
     return 0;
 }
@@ -74,15 +70,28 @@ main (void)
 /********************************************************************/
 
 /**
- *  Timer 2 overflow ISR.
+ *  Refresh timer callback, about 60 times per second.
  *
- *  Action to be performed is to set a flag so that the main loop will take an
- *  analog reading and update the tone frequency. We cannot take the analog
- *  reading from the ISR because analog_read has to enter ADC sleep mode.
+ *  Action to be performed is to pick up the latest analog reading and update
+ *  the tone frequency.
  */
-ISR (TIMER2_OVF_vect)
+    static void
+refresh_tone (arg)
+    void *arg;
 {
-    refresh_reading = 1;
+    int value;
+
+    // the fast mode reading is already in the range 0:255.
+    value = analog_scan_value (0);
+    set_frequency (CHANNEL_A, value);
+
+    // send the analog reading on the UART
+    if (tx_slots_free () >= 3)
+    {
+        transmit_string ("Reading on A0 pin is: ");
+        transmit_int (value);
+        transmit_string ("\r\n");
+    }
 }
 
 /********************************************************************/
@@ -0,0 +1,464 @@
+/**
+ *  tick.c
+ *
+ *  System tick on timer 2. The ISR only counts milliseconds; software
+ *  timers (timer.c) compare against the count from the main loop.
+ *
+ *  For tickless sleep, the scheduler calls tick_before_sleep with the next
+ *  software timer deadline, and tick_after_sleep when it wakes, so that the
+ *  tick can arrange to wake the MCU in time, and catch up with the time it
+ *  spent asleep.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <stdint.h>
+
+#include "isrmon.h"
+#include "sleepctl.h"
+#include "tick.h"
+
+/********************************************************************/
+
+// CTC mode, TOP in OCR2A, and the /64 prescaler: one interrupt per ms.
+#define TIMER2_CTC_MODE             0x02
+#define TIMER2_PRESCALER            0x04
+#define TICK_TOP                    ((F_CPU / 64 / TICK_HZ) - 1)
+#define MICROS_PER_COUNT            (64000000UL / F_CPU)
+
+// asynchronous mode: the /32 prescaler counts the 32.768kHz crystal at
+// 1024Hz, and the counter overflows every 250ms.
+#define TIMER2_CRYSTAL_PRESCALER    0x03
+#define CRYSTAL_OVERFLOW_MS         250
+#define ASSR_BUSY                   (_BV (TCN2UB) | _BV (OCR2AUB) | _BV (OCR2BUB) | \
+                                        _BV (TCR2AUB) | _BV (TCR2BUB))
+
+#define SOURCE_CLOCK                0x00
+#define SOURCE_WATCHDOG             0x01
+#define SOURCE_CRYSTAL              0x02
+
+#define NO_WATCHDOG                 0xFF
+
+static volatile uint32_t ticks;
+static uint8_t source;
+
+// the level that tick_before_sleep let the MCU sleep at.
+static uint8_t sleep_level;
+
+// watchdog fallback: the measured length of the shortest watchdog period,
+// the shift of the period armed for this sleep, and the microseconds left
+// over when adding periods to the tick.
+static uint16_t watchdog_micros;
+static uint8_t watchdog_shift = NO_WATCHDOG;
+static uint16_t watchdog_residue;
+static volatile uint8_t watchdog_fired;
+
+static void start_clock (void);
+static void watchdog_start (uint8_t shift);
+static void watchdog_stop (void);
+static uint8_t crystal_count (uint32_t *millis);
+
+/********************************************************************/
+
+/**
+ *  Start the system tick. Takes over timer 2, which should not be used for
+ *  anything else (eg tone) afterwards.
+ */
+    void
+tick_init (void)
+{
+    start_clock ();
+    sleepctl_lock (SLEEPCTL_IDLE);
+}
+
+/********************************************************************/
+
+/**
+ *  Start the system tick, with the watchdog to wake the MCU from deep
+ *  sleep. Takes about 40ms, to measure the watchdog period; interrupts are
+ *  enabled while it does.
+ */
+    void
+tick_init_watchdog (void)
+{
+    uint32_t start;
+    uint8_t sreg = SREG;
+
+    start_clock ();
+    source = SOURCE_WATCHDOG;
+
+    // time one period of the watchdog; its oscillator is only accurate to
+    // about 10%, and varies with the supply voltage and temperature.
+    sei ();
+    watchdog_fired = 0;
+    watchdog_start (0);
+
+    while (!watchdog_fired)
+        ;
+
+    start = tick_micros ();
+    watchdog_fired = 0;
+
+    while (!watchdog_fired)
+        ;
+
+    watchdog_micros = tick_micros () - start;
+    watchdog_stop ();
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Start the system tick from a 32.768kHz crystal on timer 2.
+ */
+    void
+tick_init_crystal (void)
+{
+    TIMSK2 = 0x00;
+    ASSR = _BV (AS2);
+    TCNT2 = 0;
+    OCR2A = 0;
+    TCCR2A = 0x00;
+    TCCR2B = TIMER2_CRYSTAL_PRESCALER;
+
+    // register writes take a couple of crystal cycles to reach the timer.
+    while (ASSR & ASSR_BUSY)
+        ;
+
+    TIFR2 = _BV (TOV2) | _BV (OCF2A) | _BV (OCF2B);
+    TIMSK2 = _BV (TOIE2);
+
+    source = SOURCE_CRYSTAL;
+    sleepctl_lock (SLEEPCTL_POWER_SAVE);
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the number of milliseconds since the tick started, which wraps
+ *  around after about 49 days. Compare times by subtraction, eg
+ *  (tick_millis () - start >= 500), so that the wrap doesn't matter.
+ */
+    uint32_t
+tick_millis (void)
+{
+    uint32_t now;
+    uint8_t count;
+    uint8_t sreg = SREG;
+
+    cli ();
+
+    if (source == SOURCE_CRYSTAL)
+    {
+        // 1024 counts per second: ms = count * 1000 / 1024.
+        count = crystal_count (&now);
+        now += ((uint16_t) count * 125) >> 7;
+    }
+    else
+    {
+        now = ticks;
+    }
+
+    SREG = sreg;
+
+    return now;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the number of microseconds since the tick started, to the
+ *  nearest 4us (or 977us, from the crystal). Wraps around after about 71
+ *  minutes.
+ */
+    uint32_t
+tick_micros (void)
+{
+    uint32_t now;
+    uint8_t count;
+    uint8_t sreg = SREG;
+
+    cli ();
+
+    if (source == SOURCE_CRYSTAL)
+    {
+        count = crystal_count (&now);
+        SREG = sreg;
+
+        return now * 1000 + (((uint32_t) count * 15625) >> 4);
+    }
+
+    now = ticks;
+    count = TCNT2;
+
+    // the counter may have passed TOP since interrupts were disabled, in
+    // which case the tick it completed hasn't been counted yet.
+    if ((TIFR2 & _BV (OCF2A)) && count != TICK_TOP)
+        now ++;
+
+    SREG = sreg;
+
+    return now * (1000000 / TICK_HZ) + count * MICROS_PER_COUNT;
+}
+
+/********************************************************************/
+
+/**
+ *  Get ready to sleep (called by the scheduler, with interrupts disabled).
+ *  level is the deepest sleep level the drivers allow, and deadline the
+ *  tick_millis time of the next software timer, if have_deadline is set.
+ *
+ *  Returns the level to sleep at, or TICK_NO_SLEEP if the deadline is too
+ *  close to sleep at all.
+ */
+    uint8_t
+tick_before_sleep (level, have_deadline, deadline)
+    uint8_t level;
+    uint8_t have_deadline;
+    uint32_t deadline;
+{
+    int32_t remaining = (int32_t) (deadline - tick_millis ());
+    uint16_t counts;
+    uint8_t count, shift;
+
+    sleep_level = level;
+
+    if (source == SOURCE_CLOCK)
+        return level;
+
+    if (source == SOURCE_CRYSTAL)
+    {
+        TIMSK2 &= ~_BV (OCIE2A);
+
+        // without a deadline, or with one after the next overflow, the
+        // overflow interrupt will wake us in time.
+        if (!have_deadline || remaining >= CRYSTAL_OVERFLOW_MS)
+            return level;
+
+        if (remaining <= 0)
+            return TICK_NO_SLEEP;
+
+        // round up to whole counts of 1/1024s. A compare match less than
+        // two counts ahead could be missed while OCR2A is updated.
+        counts = remaining + ((remaining * 3 + 124) / 125);
+        count = TCNT2;
+
+        if (counts < 2)
+            return TICK_NO_SLEEP;
+
+        if (counts >= 256 - count)
+            return level;
+
+        OCR2A = count + counts;
+
+        while (ASSR & _BV (OCR2AUB))
+            ;
+
+        TIFR2 = _BV (OCF2A);
+        TIMSK2 |= _BV (OCIE2A);
+
+        return level;
+    }
+
+    // watchdog: in idle sleep, the tick carries on as usual.
+    if (level == SLEEPCTL_IDLE)
+        return level;
+
+    // too close for the shortest watchdog period, so keep the tick running.
+    if (have_deadline && remaining < (int32_t) (watchdog_micros / 1000))
+    {
+        sleep_level = SLEEPCTL_IDLE;
+        return SLEEPCTL_IDLE;
+    }
+
+    // the longest period that ends before the deadline.
+    shift = TICK_WATCHDOG_MAX_SHIFT;
+
+    if (have_deadline)
+    {
+        while (shift > 0 && ((uint32_t) watchdog_micros << shift) / 1000 > (uint32_t) remaining)
+            shift --;
+    }
+
+    watchdog_fired = 0;
+    watchdog_shift = shift;
+    watchdog_start (shift);
+
+    return level;
+}
+
+/********************************************************************/
+
+/**
+ *  Catch up after sleeping (called by the scheduler, with interrupts
+ *  disabled, after the ISR that woke the MCU has run).
+ */
+    void
+tick_after_sleep (void)
+{
+    uint32_t slept;
+
+    if (source == SOURCE_CRYSTAL && sleep_level != SLEEPCTL_IDLE)
+    {
+        // after waking from power save, the timer registers read the old
+        // values until a crystal cycle has gone by, and the MCU mustn't go
+        // back to sleep until then either. Waiting for a register write to
+        // go through covers both.
+        OCR2B = 0;
+
+        while (ASSR & _BV (OCR2BUB))
+            ;
+    }
+
+    if (watchdog_shift == NO_WATCHDOG)
+        return;
+
+    watchdog_stop ();
+
+    if (watchdog_fired)
+    {
+        slept = ((uint32_t) watchdog_micros << watchdog_shift) + watchdog_residue;
+        ticks += slept / 1000;
+        watchdog_residue = slept % 1000;
+    }
+
+    watchdog_shift = NO_WATCHDOG;
+}
+
+/********************************************************************/
+
+/**
+ *  Set timer 2 up to interrupt once per millisecond from the I/O clock.
+ */
+    static void
+start_clock (void)
+{
+    TCCR2B = 0x00;
+    TCCR2A = TIMER2_CTC_MODE;
+    TCNT2 = 0;
+    OCR2A = TICK_TOP;
+    TIFR2 = _BV (OCF2A);
+    TIMSK2 = _BV (OCIE2A);
+    TCCR2B = TIMER2_PRESCALER;
+
+    source = SOURCE_CLOCK;
+}
+
+/********************************************************************/
+
+/**
+ *  Start the watchdog in interrupt mode (no reset), with a period of 16ms
+ *  shifted left by shift.
+ */
+    static void
+watchdog_start (shift)
+    uint8_t shift;
+{
+    uint8_t prescaler = (shift & 0x07) | ((shift & 0x08)? _BV (WDP3) : 0x00);
+    uint8_t sreg = SREG;
+
+    // the second write must follow the first within 4 cycles.
+    cli ();
+    wdt_reset ();
+    WDTCSR = _BV (WDCE) | _BV (WDE);
+    WDTCSR = _BV (WDIE) | prescaler;
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Stop the watchdog.
+ */
+    static void
+watchdog_stop (void)
+{
+    uint8_t sreg = SREG;
+
+    cli ();
+    wdt_reset ();
+    MCUSR &= ~_BV (WDRF);
+    WDTCSR = _BV (WDCE) | _BV (WDE);
+    WDTCSR = 0x00;
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Read the crystal count (with interrupts disabled). Stores the time of
+ *  the last overflow in *millis, and returns the counts since.
+ */
+    static uint8_t
+crystal_count (millis)
+    uint32_t *millis;
+{
+    uint8_t count = TCNT2;
+
+    *millis = ticks;
+
+    // an overflow since interrupts were disabled hasn't been counted yet.
+    if ((TIFR2 & _BV (TOV2)) && count != 0xFF)
+        *millis += CRYSTAL_OVERFLOW_MS;
+
+    return count;
+}
+
+/********************************************************************/
+
+/**
+ *  Timer 2 compare match A interrupt handler: once per millisecond from
+ *  the I/O clock, or the wake up at a deadline from the crystal.
+ */
+ISR (TIMER2_COMPA_vect)
+{
+    ISRMON_ENTER (ISRMON_TIMER2_COMPA);
+
+    if (source == SOURCE_CRYSTAL)
+        TIMSK2 &= ~_BV (OCIE2A);
+    else
+        ticks ++;
+
+    ISRMON_EXIT (ISRMON_TIMER2_COMPA);
+}
+
+/********************************************************************/
+
+/**
+ *  Timer 2 overflow interrupt handler, every 250ms from the crystal.
+ */
+ISR (TIMER2_OVF_vect)
+{
+    ISRMON_ENTER (ISRMON_TIMER2_OVF);
+    ticks += CRYSTAL_OVERFLOW_MS;
+    ISRMON_EXIT (ISRMON_TIMER2_OVF);
+}
+
+/********************************************************************/
+
+/**
+ *  The end of a watchdog sleep. Called by the watchdog ISR; crash.c has its
+ *  own ISR, which replaces the weak one here, and calls this when the
+ *  watchdog isn't set to reset the MCU.
+ */
+    void
+tick_watchdog_interrupt (void)
+{
+    watchdog_fired = 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Watchdog interrupt handler.
+ */
+ISR (WDT_vect, __attribute__ ((weak)))
+{
+    tick_watchdog_interrupt ();
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
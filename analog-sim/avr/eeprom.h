@@ -0,0 +1,20 @@
+/**
+ *  avr/eeprom.h (simulator)
+ *
+ *  EEPROM variables are plain variables on the host, so reading and
+ *  updating a block is a copy.
+ */
+
+#ifndef _SIM_AVR_EEPROM_H
+#define _SIM_AVR_EEPROM_H
+
+#include <string.h>
+
+#define EEMEM
+
+#define eeprom_read_block(dst, src, n)      memcpy ((dst), (src), (n))
+#define eeprom_update_block(src, dst, n)    memcpy ((dst), (src), (n))
+
+#endif // _SIM_AVR_EEPROM_H
+
+/** vim: set ts=4 sw=4 et : */
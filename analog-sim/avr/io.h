@@ -0,0 +1,34 @@
+/**
+ *  avr/io.h (simulator)
+ *
+ *  Stand-in for the avr-libc header, for building the analog driver on the
+ *  host. The ADC and timer registers are plain variables, which the
+ *  simulator in main.c sets before calling the ADC ISR.
+ */
+
+#ifndef _SIM_AVR_IO_H
+#define _SIM_AVR_IO_H
+
+#include <stdint.h>
+
+#define _BV(bit)        (1 << (bit))
+
+extern volatile uint8_t SREG;
+extern volatile uint8_t ADCL, ADCH, ADCSRA, ADCSRB, ADMUX, DIDR0;
+extern volatile uint8_t TCCR1A, TCCR1B, TIFR0, TIFR1;
+extern volatile uint16_t TCNT1, OCR1A, OCR1B;
+
+// ADCSRA bits
+#define ADEN            7
+#define ADSC            6
+#define ADATE           5
+#define ADIF            4
+#define ADIE            3
+
+// timer interrupt flags
+#define TOV0            0
+#define OCF1B           2
+
+#endif // _SIM_AVR_IO_H
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,25 @@
+/**
+ *  avr/sleep.h (simulator)
+ *
+ *  Sleeping is where a single conversion started by analog_read completes,
+ *  so sleep_mode has the simulator run it, in main.c.
+ */
+
+#ifndef _SIM_AVR_SLEEP_H
+#define _SIM_AVR_SLEEP_H
+
+// the modes only matter to the sleep control locks, which the simulator
+// doesn't act on.
+#define SLEEP_MODE_IDLE     0
+#define SLEEP_MODE_ADC      1
+#define SLEEP_MODE_PWR_SAVE 2
+#define SLEEP_MODE_PWR_DOWN 3
+
+void sim_sleep (void);
+
+#define set_sleep_mode(mode)
+#define sleep_mode()        sim_sleep ()
+
+#endif // _SIM_AVR_SLEEP_H
+
+/** vim: set ts=4 sw=4 et : */
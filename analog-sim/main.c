@@ -0,0 +1,343 @@
+/**
+ *  ADC SIMULATOR
+ *
+ *  Runs the analog driver in library/analog.c on the host, against
+ *  simulated ADC registers, so that the background scans can be tested
+ *  without hardware. Each conversion is simulated by setting ADCL and ADCH
+ *  and calling the ADC ISR, which runs the real driver code.
+ *
+ *  A conversion of channel c in the n'th scan reads (n << 4) | c, so a
+ *  copy of the results can be checked to come from a single scan. When a
+ *  supply voltage is set, the bandgap against AVCC reads what it would at
+ *  that voltage instead, for the supply measurement in library/vcc.c.
+ *
+ *  To complete a scan in the middle of a copy, the values array is put in a
+ *  page that can't be written; the first write to it faults, and the fault
+ *  handler plays the part of the ADC interrupt before letting the write go
+ *  ahead.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "analog.h"
+#include "vcc.h"
+
+/********************************************************************/
+
+#define ENTRIES                 4
+
+/********************************************************************/
+
+// the simulated registers.
+volatile uint8_t SREG;
+volatile uint8_t ADCL, ADCH, ADCSRA, ADCSRB, ADMUX, DIDR0;
+volatile uint8_t TCCR1A, TCCR1B, TIFR0, TIFR1;
+volatile uint16_t TCNT1, OCR1A, OCR1B;
+
+static struct analog_scan_entry entries [ENTRIES];
+static unsigned long conversions;
+static int problems;
+
+// simulated VCC in mV, or 0 for the scan numbering above.
+static uint32_t supply;
+
+// the page the values are copied into, and what to do when it is written.
+static uint16_t *protected_values;
+static long page_length;
+static int fault_conversions;
+static int faults;
+
+/********************************************************************/
+
+void ADC_vect (void);
+
+static void scenario_begin (const char *title);
+static void check (int condition, const char *message);
+static void convert (int count);
+static int consistent (const uint16_t *values, uint16_t sequence);
+static int near (uint16_t millivolts, uint16_t expected);
+static void write_fault (int signal);
+
+static void scan_read (void);
+static void scan_completes_during_copy (void);
+static void supply_voltage (void);
+
+/********************************************************************/
+
+    int
+main (void)
+{
+    struct sigaction action;
+
+    page_length = sysconf (_SC_PAGESIZE);
+    protected_values = mmap (NULL, page_length, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    memset (&action, 0, sizeof (action));
+    action.sa_handler = &write_fault;
+    sigaction (SIGSEGV, &action, NULL);
+
+    scan_read ();
+    scan_completes_during_copy ();
+    supply_voltage ();
+
+    printf ("\n%d problem(s)\n", problems);
+
+    return (problems == 0)? 0 : 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Start a scan of channels 0 to ENTRIES - 1, all on the same reference,
+ *  with no conversions done yet.
+ */
+    static void
+scenario_begin (title)
+    const char *title;
+{
+    printf ("\n%s\n", title);
+
+    memset (entries, 0, sizeof (entries));
+
+    for (uint8_t i = 0; i < ENTRIES; i ++)
+    {
+        entries [i].channel = i;
+        entries [i].reference = ANALOG_REFERENCE_AREF;
+    }
+
+    SREG = 0x80;
+    ADCSRA = 0;
+    conversions = 0;
+    supply = 0;
+
+    analog_init ((1 << ENTRIES) - 1);
+    analog_scan_start (entries, ENTRIES, ANALOG_TRIGGER_TIMER0, 0);
+}
+
+/********************************************************************/
+
+    static void
+check (condition, message)
+    int condition;
+    const char *message;
+{
+    if (!condition)
+    {
+        printf ("  FAILED: %s\n", message);
+        problems ++;
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Complete a number of conversions, of whichever channel the driver has
+ *  selected.
+ */
+    static void
+convert (count)
+    int count;
+{
+    uint16_t value;
+    uint8_t sreg;
+
+    for (int i = 0; i < count; i ++)
+    {
+        if (supply != 0 && ADMUX == (ANALOG_REFERENCE_AVCC | ANALOG_CHANNEL_BANDGAP))
+            value = (1024 * VCC_BANDGAP_NOMINAL + supply / 2) / supply;
+        else
+            value = ((conversions / ENTRIES + 1) << 4) | (ADMUX & 0x0F);
+
+        conversions ++;
+
+        ADCL = value & 0xFF;
+        ADCH = value >> 8;
+
+        // the ISR runs with interrupts disabled.
+        sreg = SREG;
+        SREG = 0;
+        ADC_vect ();
+        SREG = sreg;
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Sleep until an interrupt: complete the single conversion analog_read is
+ *  waiting for, if there is one.
+ */
+    void
+sim_sleep (void)
+{
+    if (ADCSRA & _BV (ADSC))
+    {
+        ADCSRA &= ~_BV (ADSC);
+        convert (1);
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Returns 1 if values are all from the scan numbered sequence.
+ */
+    static int
+consistent (values, sequence)
+    const uint16_t *values;
+    uint16_t sequence;
+{
+    for (uint8_t i = 0; i < ENTRIES; i ++)
+    {
+        if (values [i] != ((sequence << 4) | i))
+            return 0;
+    }
+
+    return 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns 1 if millivolts is within 10mV of expected.
+ */
+    static int
+near (millivolts, expected)
+    uint16_t millivolts;
+    uint16_t expected;
+{
+    return millivolts + 10 >= expected && millivolts <= expected + 10;
+}
+
+/********************************************************************/
+
+/**
+ *  SIGSEGV handler: the copy has written to the protected values. Run the
+ *  ADC interrupt for as many conversions as the scenario asked for, and
+ *  let the write go ahead.
+ */
+    static void
+write_fault (signal)
+    int signal;
+{
+    faults ++;
+    convert (fault_conversions);
+    mprotect (protected_values, page_length, PROT_READ | PROT_WRITE);
+}
+
+/********************************************************************/
+
+/**
+ *  Nothing is read before the first scan completes, and after that, each
+ *  read gets the last complete scan.
+ */
+    static void
+scan_read (void)
+{
+    uint16_t values [ENTRIES];
+    uint16_t sequence;
+
+    scenario_begin ("scan results read between conversions");
+
+    memset (values, 0, sizeof (values));
+    convert (ENTRIES - 1);
+    check (analog_scan_read (values) == 0, "read a scan that hadn't completed");
+
+    for (int i = 0; i < 3 * ENTRIES; i ++)
+    {
+        convert (1);
+        sequence = analog_scan_read (values);
+
+        if (sequence != 0 && !consistent (values, sequence))
+        {
+            check (0, "values from more than one scan");
+            break;
+        }
+    }
+
+    check (sequence == 3, "expected 3 complete scans");
+}
+
+/********************************************************************/
+
+/**
+ *  A scan completes after the first value has been copied, and the ISR
+ *  goes on to fill the first two entries of the buffer being copied. The
+ *  read must start again, and return the scan that just completed.
+ */
+    static void
+scan_completes_during_copy (void)
+{
+    uint16_t sequence;
+
+    scenario_begin ("scan completed in the middle of a copy");
+
+    convert (ENTRIES);
+    faults = 0;
+    fault_conversions = ENTRIES + 2;
+    mprotect (protected_values, page_length, PROT_READ);
+
+    sequence = analog_scan_read (protected_values);
+
+    check (faults == 1, "the copy didn't fault");
+    check (sequence == 2, "didn't return the scan that completed during the copy");
+    check (consistent (protected_values, sequence), "values from more than one scan");
+}
+
+/********************************************************************/
+
+/**
+ *  VCC is kept up to date from a bandgap entry in a background scan, and
+ *  follows the supply as it drops. A single measurement refuses to switch
+ *  the ADC to AVCC while it is on the AREF pin, and otherwise leaves ADMUX
+ *  as it found it.
+ */
+    static void
+supply_voltage (void)
+{
+    uint8_t admux;
+
+    scenario_begin ("supply voltage from the bandgap");
+
+    vcc_init ();
+    vcc_scan_entry (&(entries [0]));
+    entries [1].reference = ANALOG_REFERENCE_AVCC;
+    supply = 5000;
+    analog_scan_start (entries, 2, ANALOG_TRIGGER_TIMER0, 0);
+
+    // a discarded conversion, and 16 for 2 bits of oversampling, then the
+    // other entry.
+    check (vcc_refresh (0) == 5000, "VCC changed before the first scan");
+    convert (1 + 16 + 1);
+    check (near (vcc_refresh (0), 5000), "VCC not 5000mV from the scan");
+
+    supply = 3300;
+    convert (1 + 16 + 1);
+    check (near (vcc_refresh (0), 3300), "VCC didn't follow the supply down to 3300mV");
+    check (near (vcc_millivolts (512, 10), 1650), "half scale isn't half of VCC");
+
+    analog_stop ();
+    supply = 4000;
+
+    ADMUX = ANALOG_REFERENCE_AREF | 1;
+    conversions = 0;
+    check (vcc_measure () == 0, "measured VCC with the ADC on AREF");
+    check (conversions == 0 && ADMUX == (ANALOG_REFERENCE_AREF | 1),
+        "switched the reference away from AREF");
+
+    admux = ANALOG_REFERENCE_AVCC | 1;
+    ADMUX = admux;
+    check (near (vcc_measure (), 4000), "VCC not 4000mV from single conversions");
+    check (ADMUX == admux, "ADMUX not restored after measuring");
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,15 @@
+/**
+ *  util/delay.h (simulator)
+ *
+ *  Simulated time only moves with conversions, so delays return at once.
+ */
+
+#ifndef _SIM_UTIL_DELAY_H
+#define _SIM_UTIL_DELAY_H
+
+#define _delay_ms(ms)
+#define _delay_us(us)
+
+#endif // _SIM_UTIL_DELAY_H
+
+/** vim: set ts=4 sw=4 et : */
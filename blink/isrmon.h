@@ -0,0 +1,98 @@
+/**
+ *  isrmon.h
+ *
+ *  Interrupt monitor: macros at the start and end of each ISR record how
+ *  long it ran (not counting ISRs nested inside it), how deeply ISRs were
+ *  nested, and which other ISR held it off for the longest. isrmon_dump
+ *  sends the table over the UART.
+ *
+ *  Latency: for the timer 2 compare match (the system tick), the ISR
+ *  reads how far timer 2 has counted past OCR2A, which gives the time from
+ *  the interrupt being raised to its ISR starting, to within a count of
+ *  the timer (64 cycles with the 1ms tick). That sees everything that held
+ *  it off. It isn't measured while timer 2 counts the crystal.
+ *
+ *  Blocked time: the other interrupts don't say when they were raised.
+ *  When an ISR finishes, the monitor looks at the flags of the other
+ *  monitored interrupts. Any that are pending were raised while it ran, so
+ *  when their ISR starts, the time since the blocking ISR started is
+ *  recorded as their blocked time, against the blocking ISR. That is an
+ *  upper bound on the delay it caused, not a latency, and the dump labels
+ *  it as blocked time. It doesn't see code running with interrupts
+ *  disabled outside an ISR (cli sections), or ISRs that aren't monitored
+ *  (INT0, WDT, timer 1 and any others without ISRMON_ENTER), which hold
+ *  interrupts off just the same.
+ *
+ *  Everything is compiled out unless ISRMON_ENABLE is defined (eg add
+ *  -DISRMON_ENABLE to CFLAGS). Enabled, it takes over timer 1 in the same
+ *  way as the profiling probes (see probe.h), and times are in CPU cycles.
+ *  Each ISR then also saves all the call clobbered registers, so runs
+ *  slower than without the monitor.
+ *
+ *  Defining ISRMON_TRACE instead only keeps isrmon_last up to date: the
+ *  last monitored ISR to start, with ISRMON_EXITED set once it finishes.
+ *  It costs two instructions at each end of an ISR, and is kept in
+ *  .noinit, so after a watchdog reset it shows which ISR the MCU was stuck
+ *  in, if any (see crash.h). With ISRMON_ENABLE it is kept as well.
+ */
+
+#ifndef _ISRMON_H
+#define _ISRMON_H
+
+#include <stdint.h>
+
+// monitored interrupts.
+#define ISRMON_ADC              0
+#define ISRMON_TWI              1
+#define ISRMON_USART_RX         2
+#define ISRMON_USART_UDRE       3
+#define ISRMON_TIMER2_COMPA     4
+#define ISRMON_TIMER2_OVF       5
+#define ISRMON_PCINT0           6
+#define ISRMON_PCINT1           7
+#define ISRMON_PCINT2           8
+
+#define ISRMON_VECTORS          9
+
+// deepest nesting that is timed; ISRs nested deeper are only counted.
+#define ISRMON_MAX_DEPTH        4
+
+// set in isrmon_last when the ISR has finished.
+#define ISRMON_EXITED           0x80
+
+#if defined (ISRMON_ENABLE) || defined (ISRMON_TRACE)
+#define ISRMON_HAVE_LAST
+
+extern volatile uint8_t isrmon_last;
+#endif
+
+#ifdef ISRMON_ENABLE
+
+#define ISRMON_ENTER(id)        isrmon_enter (id)
+#define ISRMON_EXIT(id)         isrmon_exit (id)
+
+void isrmon_init (void);
+void isrmon_enter (uint8_t id);
+void isrmon_exit (uint8_t id);
+void isrmon_reset (void);
+void isrmon_dump (void);
+
+#else
+
+#ifdef ISRMON_TRACE
+#define ISRMON_ENTER(id)        (isrmon_last = (id))
+#define ISRMON_EXIT(id)         (isrmon_last = (id) | ISRMON_EXITED)
+#else
+#define ISRMON_ENTER(id)
+#define ISRMON_EXIT(id)
+#endif
+
+#define isrmon_init()
+#define isrmon_reset()
+#define isrmon_dump()
+
+#endif // ISRMON_ENABLE
+
+#endif // _ISRMON_H
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,47 @@
+/**
+ *  timer.h
+ *
+ *  Declares functions for software timers, driven by the system tick (see
+ *  tick.h). Timers are one shot or periodic, with millisecond resolution,
+ *  and their callbacks run from the main loop (in timer_dispatch), not from
+ *  an ISR, so they can take as long as they like and call anything.
+ *
+ *  The caller owns the memory for each timer, so there is no limit on the
+ *  number of them. Starting and cancelling a timer take constant time, and
+ *  each tick only looks at the timers in one slot of the wheel.
+ */
+
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include <stdint.h>
+
+// number of slots in the timer wheel; a power of two. Timers due in the
+// same slot are kept on one list, so with n timers running, each tick
+// looks at about n / TIMER_WHEEL_SLOTS of them.
+#define TIMER_WHEEL_SLOTS   32
+
+typedef void (*timer_callback_t) (void *arg);
+
+// A software timer. Set up with timer_setup; the fields belong to the
+// driver.
+struct timer
+{
+    struct timer *next;
+    struct timer **pprev;       // link to this timer, or 0 if not running
+    uint32_t expires;           // tick_millis when due
+    uint16_t period;            // ms, 0 for one shot
+    timer_callback_t callback;
+    void *arg;
+};
+
+void timer_setup (struct timer *timer, timer_callback_t callback, void *arg);
+void timer_start (struct timer *timer, uint16_t delay, uint16_t period);
+void timer_cancel (struct timer *timer);
+uint8_t timer_running (struct timer *timer);
+uint8_t timer_dispatch (void);
+uint8_t timer_next (uint32_t *expires);
+
+#endif // _TIMER_H
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,418 @@
+/**
+ *  FILTER EVALUATION
+ *
+ *  Host program to compare the filters in library/filter.c on captured ADC
+ *  readings, so a filter can be picked by data rather than by guesswork.
+ *  Each capture file is a list of readings, one per line (see the .csv
+ *  files in AnalogReadSerial). For each filter and capture, it reports:
+ *
+ *  - noise: the standard deviation and peak to peak range of the output,
+ *    with the input's for comparison, and the reduction in dB.
+ *
+ *  - step response: the capture is replayed with a step of STEP_SIZE
+ *    counts added half way through, and the number of samples the output
+ *    takes to get 50% and 90% of the way there is reported.
+ *
+ *  Readings are scaled up by 2^SCALE_SHIFT before filtering, as they would
+ *  be coming from the oversampling scan sequencer, so that the filters keep
+ *  some fractional bits; results are given in the original counts.
+ *
+ *  - speed: host time per sample. The filters use the same integer code on
+ *    the host as on the AVR, so this ranks them, but isn't a cycle count.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "filter.h"
+
+/********************************************************************/
+
+#define MAX_SAMPLES         4096
+#define STEP_SIZE           100
+#define SCALE_SHIFT         3
+#define TIMING_PASSES       2000
+
+// samples the output is given to settle before noise is measured.
+#define SETTLE_SAMPLES      64
+
+/********************************************************************/
+
+// one filter under test, behind a common interface.
+struct candidate
+{
+    const char *name;
+    void (*reset) (struct candidate *candidate);
+    uint16_t (*update) (struct candidate *candidate, uint16_t sample);
+    int parameter;
+
+    union
+    {
+        struct filter_average average;
+        struct filter_ema ema;
+        struct filter_median median;
+        struct filter_biquad biquad;
+    } state;
+
+    uint16_t window [64];
+    uint16_t sorted [FILTER_MEDIAN_MAX];
+};
+
+struct capture
+{
+    const char *name;
+    uint16_t samples [MAX_SAMPLES];
+    int count;
+};
+
+/********************************************************************/
+
+int main (int argc, char **argv);
+
+static int load_capture (struct capture *capture, const char *filename);
+static void evaluate (struct candidate *candidate, const struct capture *capture);
+static void statistics (const uint16_t *values, int count, double *mean,
+    double *deviation, int *range);
+
+static void identity_reset (struct candidate *candidate);
+static uint16_t identity_update (struct candidate *candidate, uint16_t sample);
+static void average_reset (struct candidate *candidate);
+static uint16_t average_update (struct candidate *candidate, uint16_t sample);
+static void ema_reset (struct candidate *candidate);
+static uint16_t ema_update (struct candidate *candidate, uint16_t sample);
+static void median_reset (struct candidate *candidate);
+static uint16_t median_update (struct candidate *candidate, uint16_t sample);
+static void biquad_reset (struct candidate *candidate);
+static uint16_t biquad_update (struct candidate *candidate, uint16_t sample);
+
+/********************************************************************/
+
+// Butterworth low pass biquads, with the cut off as a fraction of the
+// sample rate.
+static const int16_t biquad_coefficients [][5] =
+{
+    // 1/20
+    {FILTER_Q14 (0.020083), FILTER_Q14 (0.040167), FILTER_Q14 (0.020083),
+        FILTER_Q14 (-1.561018), FILTER_Q14 (0.641352)},
+
+    // 1/50
+    {FILTER_Q14 (0.003622), FILTER_Q14 (0.007243), FILTER_Q14 (0.003622),
+        FILTER_Q14 (-1.822695), FILTER_Q14 (0.837182)},
+};
+
+static struct candidate candidates [] =
+{
+    {"none", &identity_reset, &identity_update, 0},
+    {"average 4", &average_reset, &average_update, 2},
+    {"average 16", &average_reset, &average_update, 4},
+    {"average 64", &average_reset, &average_update, 6},
+    {"ema 1/4", &ema_reset, &ema_update, 2},
+    {"ema 1/16", &ema_reset, &ema_update, 4},
+    {"median 5", &median_reset, &median_update, 5},
+    {"median 9", &median_reset, &median_update, 9},
+    {"median 15", &median_reset, &median_update, 15},
+    {"biquad fs/20", &biquad_reset, &biquad_update, 0},
+    {"biquad fs/50", &biquad_reset, &biquad_update, 1},
+};
+
+#define CANDIDATES          (sizeof (candidates) / sizeof (candidates [0]))
+
+/********************************************************************/
+
+    int
+main (argc, argv)
+    int argc;
+    char **argv;
+{
+    static const char *defaults [] =
+    {
+        "../AnalogReadSerial/arduino.csv",
+        "../AnalogReadSerial/avr-noise-reduction.csv",
+    };
+    const char **files = defaults;
+    int file_count = 2;
+    static struct capture capture;
+
+    if (argc > 1)
+    {
+        files = (const char **) argv + 1;
+        file_count = argc - 1;
+    }
+
+    for (int i = 0; i < file_count; i ++)
+    {
+        if (!load_capture (&capture, files [i]))
+            return 1;
+
+        printf ("\n%s: %d samples\n\n", capture.name, capture.count);
+        printf ("%-14s %8s %6s %6s %8s %6s %6s %10s\n", "filter", "mean",
+            "sd", "p-p", "reduce", "50%", "90%", "ns/sample");
+
+        for (unsigned int j = 0; j < CANDIDATES; j ++)
+            evaluate (&(candidates [j]), &capture);
+    }
+
+    return 0;
+}
+
+/********************************************************************/
+
+/**
+ *  Read a capture file, one integer reading per line.
+ */
+    static int
+load_capture (capture, filename)
+    struct capture *capture;
+    const char *filename;
+{
+    FILE *file = fopen (filename, "r");
+    int value;
+
+    if (file == NULL)
+    {
+        perror (filename);
+        return 0;
+    }
+
+    capture->name = filename;
+    capture->count = 0;
+
+    while (capture->count < MAX_SAMPLES && fscanf (file, "%d", &value) == 1)
+        capture->samples [capture->count ++] = value << SCALE_SHIFT;
+
+    fclose (file);
+
+    if (capture->count < 2 * SETTLE_SAMPLES)
+    {
+        fprintf (stderr, "%s: not enough samples\n", filename);
+        return 0;
+    }
+
+    return 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Run one filter over a capture, and print a line of results.
+ */
+    static void
+evaluate (candidate, capture)
+    struct candidate *candidate;
+    const struct capture *capture;
+{
+    static uint16_t output [MAX_SAMPLES];
+    int count = capture->count;
+    int half = count / 2;
+    double in_mean, in_deviation, mean, deviation;
+    double before, before_deviation;
+    int in_range, range, before_range;
+    int rise_50 = -1, rise_90 = -1;
+    struct timespec start, end;
+    volatile uint16_t sink;
+    double elapsed;
+    char reduction [16];
+
+    // noise, after giving the filter time to settle.
+    candidate->reset (candidate);
+
+    for (int i = 0; i < count; i ++)
+        output [i] = candidate->update (candidate, capture->samples [i]);
+
+    statistics (capture->samples + SETTLE_SAMPLES, count - SETTLE_SAMPLES,
+        &in_mean, &in_deviation, &in_range);
+    statistics (output + SETTLE_SAMPLES, count - SETTLE_SAMPLES, &mean,
+        &deviation, &range);
+
+    if (deviation > 0)
+        snprintf (reduction, sizeof (reduction), "%.1f dB", 20 * log10 (in_deviation / deviation));
+    else if (in_deviation > 0)
+        snprintf (reduction, sizeof (reduction), "all");
+    else
+        snprintf (reduction, sizeof (reduction), "-");
+
+    // step response: add the step half way through.
+    candidate->reset (candidate);
+
+    for (int i = 0; i < count; i ++)
+    {
+        uint16_t sample = capture->samples [i] + ((i >= half)? STEP_SIZE << SCALE_SHIFT : 0);
+
+        output [i] = candidate->update (candidate, sample);
+    }
+
+    statistics (output + SETTLE_SAMPLES, half - SETTLE_SAMPLES, &before,
+        &before_deviation, &before_range);
+
+    for (int i = half; i < count; i ++)
+    {
+        if (rise_50 < 0 && output [i] >= before + (STEP_SIZE << SCALE_SHIFT) * 0.5)
+            rise_50 = i - half;
+
+        if (rise_90 < 0 && output [i] >= before + (STEP_SIZE << SCALE_SHIFT) * 0.9)
+        {
+            rise_90 = i - half;
+            break;
+        }
+    }
+
+    // speed.
+    candidate->reset (candidate);
+    clock_gettime (CLOCK_MONOTONIC, &start);
+
+    for (int pass = 0; pass < TIMING_PASSES; pass ++)
+    {
+        for (int i = 0; i < count; i ++)
+            sink = candidate->update (candidate, capture->samples [i]);
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &end);
+    (void) sink;
+
+    elapsed = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+    printf ("%-14s %8.2f %6.2f %6.2f %8s %6d %6d %10.2f\n", candidate->name,
+        mean / (1 << SCALE_SHIFT), deviation / (1 << SCALE_SHIFT),
+        (double) range / (1 << SCALE_SHIFT), reduction, rise_50, rise_90,
+        elapsed / ((double) TIMING_PASSES * count));
+}
+
+/********************************************************************/
+
+/**
+ *  Mean, standard deviation and peak to peak range of a run of values.
+ */
+    static void
+statistics (values, count, mean, deviation, range)
+    const uint16_t *values;
+    int count;
+    double *mean;
+    double *deviation;
+    int *range;
+{
+    double sum = 0, squares = 0;
+    int low = values [0], high = values [0];
+
+    for (int i = 0; i < count; i ++)
+    {
+        sum += values [i];
+
+        if (values [i] < low)
+            low = values [i];
+
+        if (values [i] > high)
+            high = values [i];
+    }
+
+    *mean = sum / count;
+
+    for (int i = 0; i < count; i ++)
+        squares += (values [i] - *mean) * (values [i] - *mean);
+
+    *deviation = sqrt (squares / count);
+    *range = high - low;
+}
+
+/********************************************************************/
+
+    static void
+identity_reset (candidate)
+    struct candidate *candidate;
+{
+}
+
+/********************************************************************/
+
+    static uint16_t
+identity_update (candidate, sample)
+    struct candidate *candidate;
+    uint16_t sample;
+{
+    return sample;
+}
+
+/********************************************************************/
+
+    static void
+average_reset (candidate)
+    struct candidate *candidate;
+{
+    filter_average_init (&(candidate->state.average), candidate->window,
+        candidate->parameter);
+}
+
+/********************************************************************/
+
+    static uint16_t
+average_update (candidate, sample)
+    struct candidate *candidate;
+    uint16_t sample;
+{
+    return filter_average_update (&(candidate->state.average), sample);
+}
+
+/********************************************************************/
+
+    static void
+ema_reset (candidate)
+    struct candidate *candidate;
+{
+    filter_ema_init (&(candidate->state.ema), candidate->parameter);
+}
+
+/********************************************************************/
+
+    static uint16_t
+ema_update (candidate, sample)
+    struct candidate *candidate;
+    uint16_t sample;
+{
+    return filter_ema_update (&(candidate->state.ema), sample);
+}
+
+/********************************************************************/
+
+    static void
+median_reset (candidate)
+    struct candidate *candidate;
+{
+    filter_median_init (&(candidate->state.median), candidate->window,
+        candidate->sorted, candidate->parameter);
+}
+
+/********************************************************************/
+
+    static uint16_t
+median_update (candidate, sample)
+    struct candidate *candidate;
+    uint16_t sample;
+{
+    return filter_median_update (&(candidate->state.median), sample);
+}
+
+/********************************************************************/
+
+    static void
+biquad_reset (candidate)
+    struct candidate *candidate;
+{
+    const int16_t *c = biquad_coefficients [candidate->parameter];
+
+    filter_biquad_init (&(candidate->state.biquad), c [0], c [1], c [2], c [3], c [4]);
+}
+
+/********************************************************************/
+
+    static uint16_t
+biquad_update (candidate, sample)
+    struct candidate *candidate;
+    uint16_t sample;
+{
+    return filter_biquad_update (&(candidate->state.biquad), sample);
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
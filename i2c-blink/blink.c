@@ -16,6 +16,9 @@
 #include <stddef.h>
 
 #include "i2c.h"
+#include "sched.h"
+#include "tick.h"
+#include "timer.h"
 
 //
 // constants for interacting with the MCP-23008 chip
@@ -24,8 +27,10 @@
 #define IODIR_REGISTER      0x00
 #define GPIO_REGISTER       0x09
 
-static volatile uint8_t led_state;
-static uint8_t data_buffer [3];
+static uint8_t led_state;
+static struct timer blink_timer;
+
+static void toggle_led (void *arg);
 
 /********************************************************************/
 
@@ -34,24 +39,18 @@ main (void)
 {
     i2c_init ();
 
-    // set up timer 1 to interrupt roughly once per second.
-    TCCR1B = (TCCR1B & 0xF8) | 0x04;
-    TIMSK1 |= 0x01;
+    // toggle the LED once per second, from the main loop.
+    tick_init ();
+    timer_setup (&blink_timer, toggle_led, NULL);
+    timer_start (&blink_timer, 1000, 1000);
 
     led_state = 0x00;
 
     // we need to set the IODIR register in the MCP-23008 chip to configure
-    // I/O pin 0 as output. Prepare the buffer as {register_num, value}.
-    data_buffer [0] = IODIR_REGISTER;
-    data_buffer [1] = 0xFE; // clear bit 0 sets pin 0 as output.
-
-    i2c_send_to (GPIO_I2C_ADDRESS, data_buffer, 2);
+    // I/O pin 0 as output. Clearing bit 0 sets pin 0 as output.
+    i2c_write_register (GPIO_I2C_ADDRESS, IODIR_REGISTER, 0xFE);
 
-    while (1)
-    {
-        sei ();
-        sleep_mode ();
-    }
+    sched_run ();
 
     return 0;
 }
@@ -59,19 +58,19 @@ main (void)
 /********************************************************************/
 
 /**
- *  Timer ISR is invoked once per second. Action performed is to check the
+ *  Timer callback, called once per second. Action performed is to check the
  *  LED state as kept in memory, invert it, and update the port expander.
  */
-ISR (TIMER1_OVF_vect)
+    static void
+toggle_led (arg)
+    void *arg;
 {
     led_state = ~led_state & 0x01;
 
     // Send the new LED state by writing the value to the GPIO register on
-    // the MCP-23008 chip
-    data_buffer [0] = GPIO_REGISTER;
-    data_buffer [1] = led_state;
-
-    i2c_send_to (GPIO_I2C_ADDRESS, data_buffer, 2);
+    // the MCP-23008 chip. The register write is copied into the I2C queue,
+    // so there is no buffer to keep alive until it is sent.
+    i2c_write_register (GPIO_I2C_ADDRESS, GPIO_REGISTER, led_state);
 }
 
 /********************************************************************/
@@ -0,0 +1,39 @@
+/**
+ *  sched.h
+ *
+ *  Declares functions for the event scheduler: a cooperative, run to
+ *  completion main loop. ISRs (and handlers) post events, each a function
+ *  to call and a 16 bit argument, and the scheduler calls them one at a
+ *  time from the main loop, most urgent first. Software timers (timer.h)
+ *  are dispatched from the same loop. When there is nothing to do, the MCU
+ *  sleeps as deeply as the drivers allow (see sleepctl.h).
+ */
+
+#ifndef _SCHED_H
+#define _SCHED_H
+
+#include <stdint.h>
+
+// Priority levels; lower numbers are more urgent. The scheduler always
+// runs the oldest event of the most urgent level that has one waiting, so
+// a steady stream of urgent events can hold off the rest.
+#define SCHED_PRIORITY_HIGH     0
+#define SCHED_PRIORITY_NORMAL   1
+#define SCHED_PRIORITY_LOW      2
+
+#define SCHED_PRIORITIES        3
+
+// events that can be waiting at each priority level; a power of two, at
+// most 128. One slot of each queue is always left empty.
+#define SCHED_QUEUE_LENGTH      8
+
+typedef void (*sched_handler_t) (uint16_t arg);
+
+uint8_t sched_post (uint8_t priority, sched_handler_t handler, uint16_t arg);
+uint16_t sched_overflows (void);
+uint8_t sched_run_pending (void);
+void sched_run (void);
+
+#endif // _SCHED_H
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,107 @@
+/**
+ *  sleepctl.c
+ *
+ *  Keeps a count of locks on each sleep level. Locks can be taken and
+ *  released from ISRs (eg when a transfer completes) as well as from the
+ *  main loop.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stdint.h>
+
+#include "sleepctl.h"
+
+/********************************************************************/
+
+// locks on each level. A lock on the deepest level doesn't rule anything
+// out, so isn't counted.
+static volatile uint8_t locks [SLEEPCTL_POWER_DOWN];
+
+// set_sleep_mode values for each level.
+static const uint8_t sleep_modes [] =
+{
+    SLEEP_MODE_IDLE,
+    SLEEP_MODE_ADC,
+    SLEEP_MODE_PWR_SAVE,
+    SLEEP_MODE_PWR_DOWN,
+};
+
+/********************************************************************/
+
+/**
+ *  Don't let the MCU sleep any deeper than level, until the matching
+ *  sleepctl_unlock. Locks are counted, so several drivers can lock the
+ *  same level.
+ */
+    void
+sleepctl_lock (level)
+    uint8_t level;
+{
+    uint8_t sreg = SREG;
+
+    if (level >= SLEEPCTL_POWER_DOWN)
+        return;
+
+    cli ();
+    locks [level] ++;
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Release a lock taken with sleepctl_lock.
+ */
+    void
+sleepctl_unlock (level)
+    uint8_t level;
+{
+    uint8_t sreg = SREG;
+
+    if (level >= SLEEPCTL_POWER_DOWN)
+        return;
+
+    cli ();
+
+    if (locks [level] != 0)
+        locks [level] --;
+
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the deepest sleep level (SLEEPCTL_*) that no lock rules out.
+ */
+    uint8_t
+sleepctl_level (void)
+{
+    uint8_t level;
+
+    for (level = 0; level < SLEEPCTL_POWER_DOWN; level ++)
+    {
+        if (locks [level] != 0)
+            break;
+    }
+
+    return level;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the sleep mode for a level, as a value for set_sleep_mode.
+ */
+    uint8_t
+sleepctl_mode (level)
+    uint8_t level;
+{
+    return sleep_modes [level];
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
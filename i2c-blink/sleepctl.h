@@ -0,0 +1,31 @@
+/**
+ *  sleepctl.h
+ *
+ *  Declares functions for drivers to limit how deeply the MCU may sleep.
+ *
+ *  Each sleep mode stops more of the clocks than the one before, so a
+ *  driver that needs a clock (eg the UART, or a timer on the I/O clock)
+ *  locks the deepest mode it can work in while it needs it. When the
+ *  scheduler goes to sleep, it picks the deepest mode that no driver has
+ *  ruled out.
+ */
+
+#ifndef _SLEEPCTL_H
+#define _SLEEPCTL_H
+
+#include <stdint.h>
+
+// sleep levels, from lightest to deepest.
+#define SLEEPCTL_IDLE           0   // CPU stopped; I/O clock runs
+#define SLEEPCTL_ADC            1   // ADC noise reduction; I/O clock stopped
+#define SLEEPCTL_POWER_SAVE     2   // only timer 2 (asynchronous) runs
+#define SLEEPCTL_POWER_DOWN     3   // only external and TWI address wake ups
+
+void sleepctl_lock (uint8_t level);
+void sleepctl_unlock (uint8_t level);
+uint8_t sleepctl_level (void);
+uint8_t sleepctl_mode (uint8_t level);
+
+#endif // _SLEEPCTL_H
+
+/** vim: set ts=4 sw=4 et : */
@@ -6,10 +6,11 @@
  *
  *  The port expander chip will have an LED on one IO pin, and a push button
  *  on another pin. The push button pin will be set up as an input, and will
- *  have a pull-up resistor. When the button is pressed, it will trigger an
- *  interrupt which will be used to prompt the MCU to read the pin states
- *  and write a value to the LED pin, so that the LED is on when the button
- *  is pressed and off when the button is released.
+ *  have a pull-up resistor. When the button is pressed, the port expander
+ *  pulls its INT line low, which triggers a pin change interrupt on the MCU.
+ *  The port expander driver then reads the captured pin states in a single
+ *  burst, and calls our handler, which sets the LED so that it is on when the
+ *  button is pressed and off when the button is released.
  */
 
 #include <avr/io.h>
@@ -17,65 +18,55 @@
 #include <avr/sleep.h>
 
 #include "i2c.h"
+#include "mcp230xx.h"
 
 
 /********************************************************************/
 
-//
-// constants for interacting with the MCP-23008 chip
-//
 #define MCP23008_ADDRESS        0x20
-#define IODIR_REGISTER          0x00
-#define GPIO_REGISTER           0x09
-#define GPINTEN                 0x02
-#define INTCON                  0x04
-#define GPPULLUP                0x06
-#define INTCAPTURE              0x08
+#define LED_PIN                 0
+#define BUTTON_PIN              1
 
 
-static volatile int pin_changed;
+static struct mcp230xx port_expander;
 
 
+/********************************************************************/
+
+static void button_changed (uint8_t pin, uint8_t level);
+
 /********************************************************************/
 
     int
 main (void)
 {
-    // IODIR - pin 0 output, all the rest input
-    // GPINTEN - enable interrupt on pin 1
-    // GPPULLUP - enable internal pull up on pin 1.
-    uint8_t mcp23008_setup [] = {IODIR_REGISTER, 0xFE, GPINTEN, 0x02, 
-        GPPULLUP, 0x02};
-    uint8_t pin_states;
-    uint8_t buffer [2];
-
-    pin_changed = 0;
-
     i2c_init ();
 
-    i2c_send_to (MCP23008_ADDRESS, mcp23008_setup, 2);
-    i2c_send_to (MCP23008_ADDRESS, &(mcp23008_setup [2]), 2);
-    i2c_send_to (MCP23008_ADDRESS, &(mcp23008_setup [4]), 2);
+    // LED pin output, button pin input with pull up, and interrupt on change
+    // for the button. The configuration goes out in one write.
+    mcp230xx_init (&port_expander, MCP23008_ADDRESS, MCP23008);
+    mcp230xx_pin_mode (&port_expander, LED_PIN, MCP230XX_OUTPUT);
+    mcp230xx_pin_mode (&port_expander, BUTTON_PIN, MCP230XX_INPUT_PULLUP);
+    mcp230xx_attach_interrupt (&port_expander, BUTTON_PIN, &button_changed);
+    mcp230xx_apply (&port_expander);
 
     // enable pin change interrupt for port D pin 5.
     PCMSK2 |= 0x20;
     PCICR |= 0x04;
 
+    // the work is done in interrupt handlers; the main loop only retries a
+    // read of the captured pins that failed. The check and the sleep are
+    // made with interrupts off, so a failure that comes in between still
+    // wakes us.
     while (1)
     {
-        if (pin_changed)
-        {
-            pin_states = i2c_read_register (MCP23008_ADDRESS, INTCAPTURE);
-
-            buffer [0] = GPIO_REGISTER;
-            buffer [1] = (pin_states & 0x02)? 0x01 : 0x00;
-            i2c_send_to (MCP23008_ADDRESS, buffer, 2);
-
-            pin_changed = 0;
-        }
+        cli ();
+        mcp230xx_update (&port_expander);
 
+        sleep_enable ();
         sei ();
-        sleep_mode ();
+        sleep_cpu ();
+        sleep_disable ();
     }
 
     return 0;
@@ -83,18 +74,28 @@ main (void)
 
 /********************************************************************/
 
+/**
+ *  Invoked by the port expander driver (from the TWI ISR) when the button
+ *  pin changes. The button pulls the pin low when pressed.
+ */
+    static void
+button_changed (pin, level)
+    uint8_t pin;
+    uint8_t level;
+{
+    mcp230xx_digital_write (&port_expander, LED_PIN, level? 0 : 1, I2C_PRIORITY_URGENT);
+}
+
+/********************************************************************/
+
 ISR (PCINT2_vect)
 {
-    // record that we've got an interrupt from the pin change. The main
-    // loop can also be woken when there's any other interrupt (eg TWI
-    // interrupt).
-    //
-    // Note that this interrupt handler is invoked on rising or falling edge,
-    // but we're only interested in the rising edge (MCP23008 signals an
-    // interrupt by bringing the interrupt line high, and de-asserts it by
-    // bringing the line low).
+    // The MCP23008 signals an interrupt by bringing the interrupt line low,
+    // and de-asserts it by bringing the line high once the captured pin
+    // states have been read. This ISR is invoked on both edges, but we're
+    // only interested in the falling edge.
     if ((PIND & 0x20) == 0)
-        pin_changed = 1;
+        mcp230xx_handle_interrupt (&port_expander);
 }
 
 /********************************************************************/
@@ -0,0 +1,79 @@
+/**
+ *  mcp230xx.h
+ *
+ *  Declares functions for driving MCP23008 (8 pin) and MCP23017 (16 pin) I2C
+ *  port expanders. The MCP23017 must be left in its default register layout
+ *  (IOCON.BANK = 0), where the port A and port B registers are interleaved.
+ *
+ *  Pins are numbered 0 to 7 on the MCP23008, and 0 to 15 on the MCP23017
+ *  (0 to 7 are port A, 8 to 15 are port B).
+ */
+
+#ifndef _MCP230XX_H
+#define _MCP230XX_H
+
+#include <stdint.h>
+
+#include "regcache.h"
+
+// number of ports on each device type.
+#define MCP23008                1
+#define MCP23017                2
+
+// pin modes
+#define MCP230XX_OUTPUT         0x00
+#define MCP230XX_INPUT          0x01
+#define MCP230XX_INPUT_PULLUP   0x02
+
+// register numbers in MCP23008 terms. The MCP23017 equivalent is found by
+// doubling the register number and adding the port number.
+#define MCP230XX_IODIR          0x00
+#define MCP230XX_IPOL           0x01
+#define MCP230XX_GPINTEN        0x02
+#define MCP230XX_DEFVAL         0x03
+#define MCP230XX_INTCON         0x04
+#define MCP230XX_IOCON          0x05
+#define MCP230XX_GPPU           0x06
+#define MCP230XX_INTF           0x07
+#define MCP230XX_INTCAP         0x08
+#define MCP230XX_GPIO           0x09
+#define MCP230XX_OLAT           0x0A
+#define MCP230XX_REGISTERS      0x0B
+
+// pin interrupt handler, invoked from the TWI ISR with the pin number and
+// the level of the pin captured when the interrupt occurred.
+typedef void (*mcp230xx_handler_t) (uint8_t pin, uint8_t level);
+
+// Per device state. The caller allocates one of these for each port
+// expander, and must not touch the fields directly.
+struct mcp230xx
+{
+    uint8_t address;
+    uint8_t ports;
+    uint8_t read_pending;
+    uint8_t read_failed;
+    uint8_t registers [MCP230XX_REGISTERS * 2];
+    uint8_t interrupt_status [4];
+    mcp230xx_handler_t handlers [16];
+    struct regcache_block cache;
+};
+
+void mcp230xx_init (struct mcp230xx *device, uint8_t address, uint8_t ports);
+void mcp230xx_pin_mode (struct mcp230xx *device, uint8_t pin, uint8_t mode);
+void mcp230xx_attach_interrupt (struct mcp230xx *device, uint8_t pin,
+    mcp230xx_handler_t handler);
+void mcp230xx_detach_interrupt (struct mcp230xx *device, uint8_t pin);
+void mcp230xx_apply (struct mcp230xx *device);
+
+void mcp230xx_digital_write (struct mcp230xx *device, uint8_t pin, uint8_t level,
+    uint8_t priority);
+void mcp230xx_write_port (struct mcp230xx *device, uint8_t port, uint8_t value,
+    uint8_t priority);
+uint8_t mcp230xx_read_port (struct mcp230xx *device, uint8_t port);
+
+void mcp230xx_handle_interrupt (struct mcp230xx *device);
+void mcp230xx_update (struct mcp230xx *device);
+
+#endif // _MCP230XX_H
+
+/** vim: set ts=4 sw=4 et : */
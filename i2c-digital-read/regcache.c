@@ -0,0 +1,469 @@
+/**
+ *  regcache.c
+ *
+ *  A shadow copy of the registers of devices on the I2C bus. Registers are
+ *  grouped into blocks of consecutive register numbers on one device; the
+ *  caller supplies the storage for each block and adds it to the cache.
+ *
+ *  Each register in a block is either volatile (its value can be changed by
+ *  the device, eg an input port or interrupt flag register, so it is always
+ *  read from and written to the device), or cached. A cached register is
+ *  valid once its value is known, and dirty if it has been written in the
+ *  cache but the write hasn't been sent to the device yet.
+ *
+ *  Registers that aren't in any block are passed straight through to the
+ *  device.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stddef.h>
+
+#include "i2c.h"
+#include "regcache.h"
+
+/********************************************************************/
+
+static struct regcache_block *blocks;
+
+/********************************************************************/
+
+static struct regcache_block *find_block (uint8_t device_address,
+    uint8_t device_register);
+static uint8_t read_value (uint8_t device_address, uint8_t device_register,
+    uint8_t *value);
+static uint8_t flush_block (struct regcache_block *block);
+
+/********************************************************************/
+
+/**
+ *  Add a block of registers to the cache.
+ *
+ *  If the REGCACHE_DEFAULTS flag is given, the values array must hold the
+ *  values the registers take at power on, and the non-volatile registers are
+ *  marked as valid straight away. Otherwise each register is read from the
+ *  device the first time it is needed.
+ */
+    void
+regcache_add_block (block, device_address, first_register, count, values,
+    volatile_mask, flags)
+    struct regcache_block *block;
+    uint8_t device_address;
+    uint8_t first_register;
+    uint8_t count;              // number of registers, 32 at most
+    uint8_t *values;            // storage for count register values
+    uint32_t volatile_mask;     // bit n set if register first + n is volatile
+    uint8_t flags;
+{
+    uint32_t all_registers = (count >= 32)? 0xFFFFFFFF : ((uint32_t) 1 << count) - 1;
+
+    block->device_address = device_address;
+    block->first_register = first_register;
+    block->count = count;
+    block->flags = flags;
+    block->volatile_mask = volatile_mask & all_registers;
+    block->dirty_mask = 0;
+    block->values = values;
+
+    if (flags & REGCACHE_DEFAULTS)
+        block->valid_mask = all_registers & ~volatile_mask;
+    else
+        block->valid_mask = 0;
+
+    // add the new block at the front of the list.
+    block->next = blocks;
+    blocks = block;
+}
+
+/********************************************************************/
+
+/**
+ *  Get the value of a device register. Cached registers are returned
+ *  without any bus traffic once their value is known; volatile and unknown
+ *  registers are read from the device.
+ *
+ *  Reading from the device blocks until the value arrives, so a register
+ *  that isn't valid in the cache must not be read from an ISR. If the
+ *  device couldn't be read, 0 is returned, and nothing is cached.
+ */
+    uint8_t
+regcache_read (device_address, device_register)
+    uint8_t device_address;
+    uint8_t device_register;
+{
+    uint8_t value = 0;
+
+    read_value (device_address, device_register, &value);
+
+    return value;
+}
+
+/********************************************************************/
+
+/**
+ *  Set the value of a device register.
+ *
+ *  Writing a cached register with the value it already holds does nothing.
+ *  Otherwise the new value is stored in the cache, and sent to the device
+ *  either straight away (write through blocks) or by the next call to
+ *  regcache_flush. Volatile registers are always written to the device
+ *  straight away.
+ *
+ *  If the I2C queue is full, a write through register is left dirty, to be
+ *  sent by the next regcache_flush, and a volatile or uncached register
+ *  isn't written at all.
+ *
+ *  This function may be called from an ISR. Returns 0 if a write to the
+ *  device couldn't be queued, otherwise 1.
+ */
+    uint8_t
+regcache_write (device_address, device_register, value)
+    uint8_t device_address;
+    uint8_t device_register;
+    uint8_t value;
+{
+    struct regcache_block *block = find_block (device_address, device_register);
+    uint8_t offset;
+    uint32_t bit;
+    uint8_t sreg;
+    uint8_t queued = 1;
+
+    if (block == NULL)
+        return i2c_write_register (device_address, device_register, value);
+
+    offset = device_register - block->first_register;
+    bit = (uint32_t) 1 << offset;
+
+    if (block->volatile_mask & bit)
+        return i2c_write_register (device_address, device_register, value);
+
+    sreg = SREG;
+    cli ();
+
+    if ((block->valid_mask & bit) == 0 || block->values [offset] != value)
+    {
+        block->values [offset] = value;
+        block->valid_mask |= bit;
+        block->dirty_mask |= bit;
+
+        if (block->flags & REGCACHE_WRITE_THROUGH)
+        {
+            queued = i2c_write_register (device_address, device_register, value);
+
+            if (queued)
+                block->dirty_mask &= ~bit;
+        }
+    }
+
+    SREG = sreg;
+    return queued;
+}
+
+/********************************************************************/
+
+/**
+ *  Read-modify-write of the bits selected by mask. If the register is valid
+ *  in the cache there is no bus read, and if the bits don't change there is
+ *  no bus write either.
+ *
+ *  This function may be called from an ISR if the register is valid in the
+ *  cache. The update of a cached register is atomic; a volatile register
+ *  can change on the device between the read and the write.
+ *
+ *  Returns 0 if the register couldn't be read from the device (nothing is
+ *  written then), or a write to the device couldn't be queued, otherwise 1.
+ */
+    uint8_t
+regcache_update_bits (device_address, device_register, mask, bits)
+    uint8_t device_address;
+    uint8_t device_register;
+    uint8_t mask;
+    uint8_t bits;
+{
+    struct regcache_block *block;
+    uint8_t offset;
+    uint8_t value, queued;
+    uint8_t sreg = SREG;
+
+    // the read may have to wait for the bus, so it is done before
+    // interrupts are held off. Merging the bits into a value that was
+    // never read would write garbage to the other bits.
+    if (!read_value (device_address, device_register, &value))
+        return 0;
+
+    // hold off interrupts so that an ISR can't change the register between
+    // our read and write. If an ISR wrote a cached register since we read
+    // it, the cache has the new value.
+    cli ();
+    block = find_block (device_address, device_register);
+
+    if (block != NULL)
+    {
+        offset = device_register - block->first_register;
+
+        if (block->valid_mask & ((uint32_t) 1 << offset))
+            value = block->values [offset];
+    }
+
+    queued = regcache_write (device_address, device_register, (value & ~mask) | (bits & mask));
+    SREG = sreg;
+
+    return queued;
+}
+
+/********************************************************************/
+
+/**
+ *  Send all dirty registers on the specified device (or on all devices, for
+ *  REGCACHE_ALL_DEVICES) to the device. Neighbouring dirty registers are
+ *  combined into a single sequential write. Registers whose write couldn't
+ *  be queued stay dirty.
+ *
+ *  This function may be called from an ISR. Returns 1 if all of the dirty
+ *  registers were queued, or 0 if some are still dirty.
+ */
+    uint8_t
+regcache_flush (device_address)
+    uint8_t device_address;
+{
+    uint8_t queued = 1;
+    uint8_t sreg = SREG;
+
+    cli ();
+
+    for (struct regcache_block *block = blocks; block != NULL; block = block->next)
+    {
+        if (block->dirty_mask == 0)
+            continue;
+
+        if (device_address == REGCACHE_ALL_DEVICES ||
+                device_address == block->device_address)
+            queued &= flush_block (block);
+    }
+
+    SREG = sreg;
+    return queued;
+}
+
+/********************************************************************/
+
+/**
+ *  Send one register to the device if it is dirty, in the given I2C
+ *  priority class, leaving any other dirty registers for regcache_flush.
+ *  This is for writes that mustn't wait behind bulk transfers, or carry
+ *  other pending changes with them, eg an output latch.
+ *
+ *  This function may be called from an ISR. Returns 1 if the register was
+ *  queued or wasn't dirty, or 0 if it is still dirty.
+ */
+    uint8_t
+regcache_flush_register (device_address, device_register, priority)
+    uint8_t device_address;
+    uint8_t device_register;
+    uint8_t priority;
+{
+    struct regcache_block *block;
+    uint8_t message [2];
+    uint32_t bit;
+    uint8_t queued = 1;
+    uint8_t sreg = SREG;
+
+    cli ();
+    block = find_block (device_address, device_register);
+
+    if (block != NULL)
+    {
+        message [0] = device_register;
+        message [1] = block->values [device_register - block->first_register];
+        bit = (uint32_t) 1 << (device_register - block->first_register);
+
+        if (block->dirty_mask & bit)
+        {
+            queued = i2c_send_priority (device_address, message, 2, priority);
+
+            if (queued)
+                block->dirty_mask &= ~bit;
+        }
+    }
+
+    SREG = sreg;
+    return queued;
+}
+
+/********************************************************************/
+
+/**
+ *  Forget the cached values of all registers on the specified device (or on
+ *  all devices), eg after the device has been reset. Any writes that haven't
+ *  been flushed are lost.
+ */
+    void
+regcache_invalidate (device_address)
+    uint8_t device_address;
+{
+    uint8_t sreg = SREG;
+
+    cli ();
+
+    for (struct regcache_block *block = blocks; block != NULL; block = block->next)
+    {
+        if (device_address == REGCACHE_ALL_DEVICES ||
+                device_address == block->device_address)
+        {
+            block->valid_mask = 0;
+            block->dirty_mask = 0;
+        }
+    }
+
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Find the block holding the specified register, or NULL if the register
+ *  isn't cached.
+ */
+    static struct regcache_block *
+find_block (device_address, device_register)
+    uint8_t device_address;
+    uint8_t device_register;
+{
+    for (struct regcache_block *block = blocks; block != NULL; block = block->next)
+    {
+        if (block->device_address == device_address &&
+                device_register >= block->first_register &&
+                device_register - block->first_register < block->count)
+            return block;
+    }
+
+    return NULL;
+}
+
+/********************************************************************/
+
+/**
+ *  Get the value of a register, from the cache if it is valid there, or
+ *  else from the device, caching it unless it is volatile.
+ *
+ *  Returns 1 and stores the value, or 0 if the device couldn't be read.
+ */
+    static uint8_t
+read_value (device_address, device_register, value)
+    uint8_t device_address;
+    uint8_t device_register;
+    uint8_t *value;
+{
+    struct regcache_block *block = find_block (device_address, device_register);
+    uint8_t offset;
+    uint32_t bit;
+    uint8_t sreg;
+
+    if (block == NULL)
+        return i2c_read_registers (device_address, device_register, value, 1,
+            I2C_PRIORITY_BULK);
+
+    offset = device_register - block->first_register;
+    bit = (uint32_t) 1 << offset;
+
+    if (block->valid_mask & bit)
+    {
+        *value = block->values [offset];
+        return 1;
+    }
+
+    if (!i2c_read_registers (device_address, device_register, value, 1,
+            I2C_PRIORITY_BULK))
+        return 0;
+
+    // remember the value, unless the device can change it under us.
+    if ((block->volatile_mask & bit) == 0)
+    {
+        sreg = SREG;
+        cli ();
+        block->values [offset] = *value;
+        block->valid_mask |= bit;
+        SREG = sreg;
+    }
+
+    return 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Write the dirty registers in a block to the device.
+ *
+ *  A run of registers written in one transfer starts and ends on a dirty
+ *  register, and may include clean registers in between (they are rewritten
+ *  with the value the device already has). A run can't cross a volatile
+ *  register or one with an unknown value, since we have nothing safe to
+ *  write there.
+ *
+ *  The dirty bits of a run are only cleared once its write is queued, so
+ *  a run that doesn't fit in the I2C queue is sent by a later flush.
+ *
+ *  Must be called with interrupts disabled. Returns 1 if all of the dirty
+ *  registers were queued.
+ */
+    static uint8_t
+flush_block (block)
+    struct regcache_block *block;
+{
+    uint8_t run_start = 0, last_dirty = 0;
+    uint8_t in_run = 0;
+    uint32_t bit, run;
+
+    for (uint8_t offset = 0; offset <= block->count; offset ++)
+    {
+        bit = (offset < 32)? (uint32_t) 1 << offset : 0;
+
+        // a register we can't write (or the end of the block) finishes the
+        // current run.
+        if (offset == block->count || (block->volatile_mask & bit) ||
+                (block->valid_mask & bit) == 0)
+        {
+            if (in_run)
+            {
+                // the bits from run_start to last_dirty.
+                run = (((uint32_t) 2 << last_dirty) - 1) & ~(((uint32_t) 1 << run_start) - 1);
+
+                if (i2c_write_registers (block->device_address,
+                        block->first_register + run_start,
+                        block->values + run_start, last_dirty - run_start + 1))
+                    block->dirty_mask &= ~run;
+
+                in_run = 0;
+            }
+
+            continue;
+        }
+
+        if ((block->dirty_mask & bit) == 0)
+            continue;
+
+        if (!in_run)
+        {
+            run_start = offset;
+            in_run = 1;
+        }
+
+        last_dirty = offset;
+
+        // without auto-increment, every register goes in its own transfer.
+        if (block->flags & REGCACHE_NO_SEQUENTIAL)
+        {
+            if (i2c_write_register (block->device_address,
+                    block->first_register + offset, block->values [offset]))
+                block->dirty_mask &= ~bit;
+
+            in_run = 0;
+        }
+    }
+
+    return (block->dirty_mask == 0);
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,64 @@
+/**
+ *  regcache.h
+ *
+ *  Declares a shadow cache for the registers of devices on the I2C bus.
+ *  Driver code can read configuration registers from the cache without any
+ *  bus traffic, and several updates to the same registers can be combined
+ *  into one sequential write when the cache is flushed.
+ */
+
+#ifndef _REGCACHE_H
+#define _REGCACHE_H
+
+#include <stdint.h>
+
+// block flags.
+//
+// WRITE_THROUGH sends every change to the device as soon as it is made,
+// rather than waiting for regcache_flush.
+//
+// DEFAULTS indicates that the values array was filled in with the power on
+// values of the registers, so the non-volatile registers start off valid
+// without reading them from the device.
+//
+// NO_SEQUENTIAL is for devices that don't auto-increment their register
+// pointer; each dirty register is written with its own transfer.
+#define REGCACHE_WRITE_THROUGH      0x01
+#define REGCACHE_DEFAULTS           0x02
+#define REGCACHE_NO_SEQUENTIAL      0x04
+
+// pass as the device address to flush or invalidate every block.
+#define REGCACHE_ALL_DEVICES        0xFF
+
+// a block covers up to 32 consecutive registers on a single device. The
+// values array (count bytes) is provided by the caller, and is used directly
+// as the source of sequential writes.
+struct regcache_block
+{
+    uint8_t device_address;
+    uint8_t first_register;
+    uint8_t count;
+    uint8_t flags;
+    uint32_t volatile_mask;     // registers that are never cached
+    uint32_t valid_mask;        // registers with a known value
+    uint32_t dirty_mask;        // registers changed but not yet written
+    uint8_t *values;
+    struct regcache_block *next;
+};
+
+void regcache_add_block (struct regcache_block *block, uint8_t device_address,
+    uint8_t first_register, uint8_t count, uint8_t *values,
+    uint32_t volatile_mask, uint8_t flags);
+
+uint8_t regcache_read (uint8_t device_address, uint8_t device_register);
+uint8_t regcache_write (uint8_t device_address, uint8_t device_register, uint8_t value);
+uint8_t regcache_update_bits (uint8_t device_address, uint8_t device_register,
+    uint8_t mask, uint8_t bits);
+uint8_t regcache_flush (uint8_t device_address);
+uint8_t regcache_flush_register (uint8_t device_address, uint8_t device_register,
+    uint8_t priority);
+void regcache_invalidate (uint8_t device_address);
+
+#endif // _REGCACHE_H
+
+/** vim: set ts=4 sw=4 et : */
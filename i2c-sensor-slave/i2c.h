@@ -0,0 +1,96 @@
+/**
+ *  i2c.h
+ *
+ *  Declares functions used to drive the I2C hardware on the ATmega M328P
+ *  microcontroller.
+ */
+
+#ifndef _I2C_H
+#define _I2C_H
+
+#include <stdint.h>
+
+// Writes up to this many bytes long are copied into the I2C queue, so the
+// caller doesn't need to keep the buffer around until the write is sent.
+#ifndef I2C_INLINE_LENGTH
+#define I2C_INLINE_LENGTH   4
+#endif
+
+// Priority classes. At each START the next transfer is taken from the most
+// urgent class that has anything queued. Transfers in the same class are sent
+// in the order they were queued.
+#define I2C_PRIORITY_URGENT     0
+#define I2C_PRIORITY_BULK       1
+#define I2C_PRIORITY_CLASSES    2
+
+// completion callback for asynchronous transfers. Invoked from the TWI ISR.
+typedef void (*i2c_callback_t) (void *context);
+
+// Slave mode register map. Each region covers length registers starting at
+// first_register, and is backed by RAM, or by flash if I2C_REGION_FLASH is
+// set (data is then a PROGMEM pointer). The host can only write to RAM
+// regions with I2C_REGION_WRITABLE set.
+#define I2C_REGION_WRITABLE     0x01
+#define I2C_REGION_FLASH        0x02
+
+struct i2c_region
+{
+    uint8_t first_register;
+    uint8_t length;
+    uint8_t flags;
+    const void *data;
+};
+
+// Largest multi-byte value the host can read or write atomically, and the
+// longest write the host can make in one transfer.
+#ifndef I2C_SLAVE_BUFFER_LENGTH
+#define I2C_SLAVE_BUFFER_LENGTH 8
+#endif
+
+// invoked from the TWI ISR after the host writes to the register map.
+typedef void (*i2c_slave_write_handler_t) (uint8_t first_register, uint8_t length);
+
+// Per class statistics. Latency is the time spent waiting in the queue, in
+// TWI interrupts (about one byte time each). Failures are transfers given up
+// on because the device didn't acknowledge its address.
+struct i2c_stats
+{
+    uint16_t transactions;
+    uint16_t max_latency;
+    uint32_t total_latency;
+    uint16_t failures;
+};
+
+void i2c_init (void);
+uint8_t i2c_send_to (uint8_t device_address, const uint8_t *data, unsigned int length);
+uint8_t i2c_send_priority (uint8_t device_address, const uint8_t *data,
+    unsigned int length, uint8_t priority);
+uint8_t i2c_send_async (uint8_t device_address, const uint8_t *data,
+    unsigned int length, uint8_t priority, i2c_callback_t callback, void *context);
+uint8_t i2c_write_register (uint8_t device_address, uint8_t device_register, uint8_t value);
+uint8_t i2c_write_registers (uint8_t device_address, uint8_t first_register,
+    const uint8_t *values, unsigned int count);
+uint8_t i2c_read_register (uint8_t device_address, uint8_t device_register);
+uint8_t i2c_read_registers (uint8_t device_address, uint8_t first_register,
+    uint8_t *buffer, unsigned int length, uint8_t priority);
+uint8_t i2c_read_registers_async (uint8_t device_address, uint8_t first_register,
+    uint8_t *buffer, unsigned int length, uint8_t priority,
+    i2c_callback_t callback, void *context);
+void i2c_receive_from (uint8_t device_address, uint8_t *buffer, unsigned int length);
+
+uint8_t i2c_transfer_failed (void);
+
+void i2c_begin_chain (void);
+void i2c_end_chain (void);
+
+void i2c_slave_init (uint8_t own_address, const struct i2c_region *regions,
+    uint8_t region_count);
+void i2c_slave_set_write_handler (i2c_slave_write_handler_t handler);
+void i2c_slave_update (uint8_t first_register, const void *values, uint8_t length);
+
+void i2c_get_stats (uint8_t priority, struct i2c_stats *result);
+void i2c_reset_stats (void);
+
+#endif // _I2C_H
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,173 @@
+/**
+ *  I2C SENSOR CO-PROCESSOR DEMO
+ *
+ *  The MCU acts as an I2C slave, and takes regular readings from two analog
+ *  inputs, and counts the detents of a rotary encoder, so that a host
+ *  controller can fetch the latest values over the I2C bus, instead of
+ *  polling the MCU over the UART.
+ *
+ *  Register map (slave address 0x42):
+ *      0x00 - 0x01     device id and version (read only, in flash)
+ *      0x10 - 0x11     A0 reading, low byte first (read only)
+ *      0x12 - 0x13     A1 reading, low byte first (read only)
+ *      0x14            sample count, incremented after each pair of readings
+ *      0x15 - 0x16     encoder position, signed, low byte first (read only)
+ *      0x20            sample interval, in timer 1 overflows (read/write)
+ *
+ *  The host writes the register number, then reads any number of bytes
+ *  from there. The readings and the position are updated together, and a
+ *  read of up to 8 bytes is a consistent snapshot, so the host never sees a
+ *  half updated value.
+ *
+ *  The encoder's channels A and B are on PD7 and PD6, to ground, as in the
+ *  rotary demo.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+
+#include "analog.h"
+#include "encoder.h"
+#include "i2c.h"
+#include "pcint.h"
+#include "pins.h"
+#include "sleepctl.h"
+#include "tick.h"
+
+/********************************************************************/
+
+#define SLAVE_ADDRESS           0x42
+
+#define KNOB_A_PIN              D, 7
+#define KNOB_B_PIN              D, 6
+
+struct readings
+{
+    uint16_t a0;
+    uint16_t a1;
+    uint8_t count;
+    int16_t position;
+};
+
+static const uint8_t device_id [2] PROGMEM = {0xA5, 0x01};
+static struct readings readings;
+static uint8_t sample_interval = 1;
+
+static const struct i2c_region register_map [] =
+{
+    {0x00, sizeof (device_id), I2C_REGION_FLASH, device_id},
+    {0x10, sizeof (readings), 0, &readings},
+    {0x20, sizeof (sample_interval), I2C_REGION_WRITABLE, &sample_interval},
+};
+
+static volatile uint8_t timer_ticks = 0;
+
+static struct encoder knob;
+static volatile uint8_t knob_turned;
+
+/********************************************************************/
+
+static void knob_moved (struct encoder *encoder, int8_t step);
+
+/********************************************************************/
+
+    int
+main (void)
+{
+    struct readings latest;
+    uint8_t changed;
+
+    latest.a0 = 0;
+    latest.a1 = 0;
+    latest.count = 0;
+    latest.position = 0;
+
+    analog_init (0x03);
+    i2c_init ();
+    i2c_slave_init (SLAVE_ADDRESS, register_map,
+        sizeof (register_map) / sizeof (register_map [0]));
+
+    // timer 1 overflow, roughly 4 times per second. Timer 1 runs from the
+    // I/O clock, which only idle sleep keeps running.
+    TCCR1B = (TCCR1B & 0xF8) | 0x03;
+    TIMSK1 |= 0x01;
+    sleepctl_lock (SLEEPCTL_IDLE);
+
+    // the tick times the detents, for the encoder driver.
+    tick_init ();
+    encoder_attach (&knob, PIN_PCINT_PORT (KNOB_A_PIN), PIN_MASK (KNOB_A_PIN),
+        PIN_MASK (KNOB_B_PIN), ENCODER_STEPS_4, knob_moved);
+
+    while (1)
+    {
+        changed = 0;
+
+        if (timer_ticks >= sample_interval)
+        {
+            timer_ticks = 0;
+
+            latest.a0 = analog_read (0);
+            latest.a1 = analog_read (1);
+            latest.count ++;
+            changed = 1;
+        }
+
+        if (knob_turned)
+        {
+            knob_turned = 0;
+            latest.position += encoder_read (&knob);
+            changed = 1;
+        }
+
+        // publish the readings and the position in one atomic update.
+        if (changed)
+            i2c_slave_update (0x10, &latest, sizeof (latest));
+
+        // sleep until the next sample or detent, as deeply as the locks
+        // allow. analog_read leaves ADC noise reduction selected, which
+        // would stop timer 1. Interrupts stay off from the check until
+        // sleep_cpu, which runs before any ISR can, so an ISR that sets a
+        // flag after the check wakes us straight away.
+        cli ();
+
+        if (!knob_turned && timer_ticks < sample_interval)
+        {
+            set_sleep_mode (sleepctl_mode (sleepctl_level ()));
+            sleep_enable ();
+            sei ();
+            sleep_cpu ();
+            sleep_disable ();
+        }
+
+        sei ();
+    }
+
+    return 0;
+}
+
+/********************************************************************/
+
+ISR (TIMER1_OVF_vect)
+{
+    timer_ticks ++;
+}
+
+/********************************************************************/
+
+/**
+ *  Encoder handler (ISR context): have the main loop publish the new
+ *  position.
+ */
+    static void
+knob_moved (encoder, step)
+    struct encoder *encoder;
+    int8_t step;
+{
+    knob_turned = 1;
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,58 @@
+/**
+ *  tick.h
+ *
+ *  Declares functions for the system tick: a millisecond count kept by
+ *  timer 2, which everything that needs to know the time can share, rather
+ *  than each setting up a hardware timer of its own.
+ *
+ *  The tick can run from one of three sources:
+ *
+ *  tick_init: timer 2 on the I/O clock, in CTC mode with the /64 prescaler,
+ *  so it counts in 4us steps and interrupts once per millisecond. Clocked
+ *  from the I/O clock, timer 2 only keeps running in idle sleep, so the
+ *  tick holds a sleep lock on SLEEPCTL_IDLE.
+ *
+ *  tick_init_watchdog: as above while awake, but when the scheduler would
+ *  sleep deeper than idle, the tick is stopped, and the watchdog timer
+ *  wakes the MCU at (or a little before) the next software timer deadline.
+ *  The watchdog period is measured against the system clock at start up,
+ *  and added to the tick on wake up. If something else wakes the MCU
+ *  first, the time it slept for is lost, so timers may run late; the
+ *  longest watchdog sleep is limited to TICK_WATCHDOG_MAX_SHIFT to bound
+ *  the error.
+ *
+ *  tick_init_crystal: timer 2 in asynchronous mode, from a 32.768kHz
+ *  crystal on TOSC1 and TOSC2. It keeps counting in power save sleep, so
+ *  the time stays exact, and it only interrupts every 250ms, plus once at
+ *  the next software timer deadline. TOSC1 and TOSC2 are the XTAL1 and
+ *  XTAL2 pins, so the MCU must run from its internal RC oscillator (fuses
+ *  set for 8MHz, and F_CPU to match). The crystal takes up to a second to
+ *  start; the time isn't reliable until then.
+ */
+
+#ifndef _TICK_H
+#define _TICK_H
+
+#include <stdint.h>
+
+#define TICK_HZ                 1000
+
+// longest watchdog sleep, as a shift of the shortest (16ms): 6 is about 1s.
+#define TICK_WATCHDOG_MAX_SHIFT 6
+
+// returned by tick_before_sleep if the next deadline is too close to sleep.
+#define TICK_NO_SLEEP           0xFF
+
+void tick_init (void);
+void tick_init_watchdog (void);
+void tick_init_crystal (void);
+uint32_t tick_millis (void);
+uint32_t tick_micros (void);
+
+uint8_t tick_before_sleep (uint8_t level, uint8_t have_deadline, uint32_t deadline);
+void tick_after_sleep (void);
+void tick_watchdog_interrupt (void);
+
+#endif // _TICK_H
+
+/** vim: set ts=4 sw=4 et : */
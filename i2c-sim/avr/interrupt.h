@@ -0,0 +1,21 @@
+/**
+ *  avr/interrupt.h (simulator)
+ *
+ *  Interrupt handlers become plain functions, which the simulator calls
+ *  when the matching event happens. The global interrupt enable is bit 7 of
+ *  the simulated SREG.
+ */
+
+#ifndef _SIM_AVR_INTERRUPT_H
+#define _SIM_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define ISR(vector, ...)    void vector (void); void vector (void)
+
+#define sei()               (SREG |= 0x80)
+#define cli()               (SREG &= ~0x80)
+
+#endif // _SIM_AVR_INTERRUPT_H
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,43 @@
+/**
+ *  avr/io.h (simulator)
+ *
+ *  Stand-in for the avr-libc header, for building the I2C library code on
+ *  the host. The TWI registers are plain variables which the simulator in
+ *  sim.c watches and updates, and the other registers touched by the
+ *  drivers are just storage.
+ */
+
+#ifndef _SIM_AVR_IO_H
+#define _SIM_AVR_IO_H
+
+#include <stdint.h>
+
+#define _BV(bit)        (1 << (bit))
+
+extern volatile uint8_t TWCR, TWSR, TWDR, TWBR, TWAR;
+extern volatile uint8_t SREG;
+extern volatile uint8_t PORTC, DDRD, PORTD, PIND;
+extern volatile uint8_t EICRA, EIFR, EIMSK;
+extern volatile uint8_t PCICR, PCMSK2;
+
+// TWCR bits
+#define TWINT           7
+#define TWEA            6
+#define TWSTA           5
+#define TWSTO           4
+#define TWWC            3
+#define TWEN            2
+#define TWIE            0
+
+// external interrupt bits
+#define INT0            0
+#define INT1            1
+#define ISC00           0
+#define ISC01           1
+#define DDD2            2
+#define PORTD2          2
+#define PIND2           2
+
+#endif // _SIM_AVR_IO_H
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,17 @@
+/**
+ *  avr/pgmspace.h (simulator)
+ *
+ *  Flash and RAM share one address space on the host.
+ */
+
+#ifndef _SIM_AVR_PGMSPACE_H
+#define _SIM_AVR_PGMSPACE_H
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(address)  (*(const uint8_t *) (address))
+
+#endif // _SIM_AVR_PGMSPACE_H
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,25 @@
+/**
+ *  avr/sleep.h (simulator)
+ *
+ *  Sleeping hands control to the simulator, which runs the bus until the
+ *  next interrupt has been delivered.
+ */
+
+#ifndef _SIM_AVR_SLEEP_H
+#define _SIM_AVR_SLEEP_H
+
+void sim_sleep (void);
+
+// the modes only matter to the sleep control locks, which the simulator
+// doesn't act on.
+#define SLEEP_MODE_IDLE     0
+#define SLEEP_MODE_ADC      1
+#define SLEEP_MODE_PWR_SAVE 2
+#define SLEEP_MODE_PWR_DOWN 3
+
+#define set_sleep_mode(mode)
+#define sleep_mode()        sim_sleep ()
+
+#endif // _SIM_AVR_SLEEP_H
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,365 @@
+/**
+ *  devices.c
+ *
+ *  Models of the I2C devices used by the code in this repository: a plain
+ *  register file, the MCP23008 port expander, the CAP1188 touch sensor and
+ *  a 24C02 style EEPROM. The models only go as deep as the drivers need;
+ *  eg the MCP23008 only supports interrupt on change from the previous
+ *  value.
+ */
+
+#include <avr/io.h>
+#include <string.h>
+
+#include "devices.h"
+
+/********************************************************************/
+
+// MCP23008 registers
+#define MCP_IODIR       0x00
+#define MCP_GPINTEN     0x02
+#define MCP_INTF        0x07
+#define MCP_INTCAP      0x08
+#define MCP_GPIO        0x09
+#define MCP_OLAT        0x0A
+
+// CAP1188 registers
+#define CAP_MAIN_CONTROL        0x00
+#define CAP_GENERAL_STATUS      0x02
+#define CAP_INPUT_STATUS        0x03
+#define CAP_PRODUCT_ID          0xFD
+#define CAP_HELD                0xF0    // unused on the real part; holds the touched channels
+
+/********************************************************************/
+
+static int regfile_start (struct sim_device *bus, int read);
+static int regfile_write (struct sim_device *bus, uint8_t value);
+static uint8_t regfile_read (struct sim_device *bus);
+
+static void mcp23008_written (struct regfile *device, uint8_t reg);
+static void mcp23008_read (struct regfile *device, uint8_t reg);
+static void cap1188_written (struct regfile *device, uint8_t reg);
+static int eeprom_start (struct sim_device *bus, int read);
+static int eeprom_write (struct sim_device *bus, uint8_t value);
+static void eeprom_stop (struct sim_device *bus);
+
+/********************************************************************/
+
+/**
+ *  Set up a register file device with all registers zero. The caller
+ *  attaches it to the bus with sim_attach (&device->bus).
+ */
+    void
+regfile_init (device, address, name)
+    struct regfile *device;
+    uint8_t address;
+    const char *name;
+{
+    memset (device, 0, sizeof (*device));
+
+    device->bus.address = address;
+    device->bus.name = name;
+    device->bus.start = &regfile_start;
+    device->bus.write = &regfile_write;
+    device->bus.read = &regfile_read;
+}
+
+/********************************************************************/
+
+/**
+ *  MCP23008 port expander, with all pins inputs at reset. The INT pin is
+ *  active low and wired to the given interrupt handler.
+ */
+    void
+mcp23008_init (device, address, interrupt)
+    struct regfile *device;
+    uint8_t address;
+    void (*interrupt) (void);
+{
+    regfile_init (device, address, "MCP23008");
+
+    device->registers [MCP_IODIR] = 0xFF;
+    device->written = &mcp23008_written;
+    device->read = &mcp23008_read;
+    device->interrupt = interrupt;
+}
+
+/********************************************************************/
+
+/**
+ *  Drive the input pins of an MCP23008 to the given levels. Pins that
+ *  change with interrupt on change enabled capture the port and assert INT,
+ *  unless an interrupt is already waiting to be cleared.
+ */
+    void
+mcp23008_set_inputs (device, levels)
+    struct regfile *device;
+    uint8_t levels;
+{
+    uint8_t *registers = device->registers;
+    uint8_t inputs = registers [MCP_IODIR];
+    uint8_t changed = (registers [MCP_GPIO] ^ levels) & inputs;
+
+    registers [MCP_GPIO] = (registers [MCP_GPIO] & ~inputs) | (levels & inputs);
+    changed &= registers [MCP_GPINTEN];
+
+    if (changed != 0 && registers [MCP_INTF] == 0)
+    {
+        registers [MCP_INTF] = changed;
+        registers [MCP_INTCAP] = registers [MCP_GPIO];
+
+        if (device->interrupt != NULL)
+            sim_raise_external (device->interrupt);
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  CAP1188 touch sensor, at its default address with the ALERT pin wired to
+ *  the given interrupt handler.
+ */
+    void
+cap1188_init (device, interrupt)
+    struct regfile *device;
+    void (*interrupt) (void);
+{
+    regfile_init (device, CAP1188_ADDRESS, "CAP1188");
+
+    device->registers [CAP_PRODUCT_ID] = 0x50;
+    device->registers [0xFE] = 0x5D;
+    device->registers [0xFF] = 0x83;
+    device->written = &cap1188_written;
+    device->interrupt = interrupt;
+
+    // ALERT is wired to PD2, and idles high.
+    PIND |= _BV (PIND2);
+}
+
+/********************************************************************/
+
+/**
+ *  Touch the given channels. The status bits are latched, and ALERT is
+ *  asserted if it isn't already.
+ */
+    void
+cap1188_touch (device, channels)
+    struct regfile *device;
+    uint8_t channels;
+{
+    uint8_t *registers = device->registers;
+    int was_alert = registers [CAP_MAIN_CONTROL] & 0x01;
+
+    registers [CAP_HELD] |= channels;
+    registers [CAP_INPUT_STATUS] |= channels;
+    registers [CAP_GENERAL_STATUS] |= 0x01;
+    registers [CAP_MAIN_CONTROL] |= 0x01;
+    PIND &= ~_BV (PIND2);
+
+    if (!was_alert && device->interrupt != NULL)
+        sim_raise_external (device->interrupt);
+}
+
+/********************************************************************/
+
+    void
+cap1188_release (device, channels)
+    struct regfile *device;
+    uint8_t channels;
+{
+    device->registers [CAP_HELD] &= ~channels;
+}
+
+/********************************************************************/
+
+/**
+ *  24C02 style EEPROM. Writes are buffered into 8 byte pages (the address
+ *  wraps within the page), and programmed after the STOP. While it is
+ *  programming, the EEPROM doesn't acknowledge its address.
+ */
+    void
+eeprom_init (device, address)
+    struct regfile *device;
+    uint8_t address;
+{
+    regfile_init (device, address, "24C02");
+
+    memset (device->registers, 0xFF, sizeof (device->registers));
+    device->bus.start = &eeprom_start;
+    device->bus.write = &eeprom_write;
+    device->bus.stop = &eeprom_stop;
+}
+
+/********************************************************************/
+
+    static int
+regfile_start (bus, read)
+    struct sim_device *bus;
+    int read;
+{
+    struct regfile *device = (struct regfile *) bus;
+
+    if (!read)
+        device->pointer_set = 0;
+
+    return 1;
+}
+
+/********************************************************************/
+
+    static int
+regfile_write (bus, value)
+    struct sim_device *bus;
+    uint8_t value;
+{
+    struct regfile *device = (struct regfile *) bus;
+    uint8_t reg;
+
+    if (!device->pointer_set)
+    {
+        device->pointer = value;
+        device->pointer_set = 1;
+        return 1;
+    }
+
+    reg = device->pointer ++;
+    device->registers [reg] = value;
+    device->register_writes ++;
+
+    if (device->written != NULL)
+        device->written (device, reg);
+
+    return 1;
+}
+
+/********************************************************************/
+
+    static uint8_t
+regfile_read (bus)
+    struct sim_device *bus;
+{
+    struct regfile *device = (struct regfile *) bus;
+    uint8_t reg = device->pointer ++;
+    uint8_t value = device->registers [reg];
+
+    if (device->read != NULL)
+        device->read (device, reg);
+
+    return value;
+}
+
+/********************************************************************/
+
+/**
+ *  Writes to GPIO go to the output latch, as on the real part.
+ */
+    static void
+mcp23008_written (device, reg)
+    struct regfile *device;
+    uint8_t reg;
+{
+    uint8_t *registers = device->registers;
+
+    if (reg == MCP_GPIO || reg == MCP_OLAT)
+    {
+        registers [MCP_OLAT] = registers [reg];
+        registers [MCP_GPIO] = (registers [MCP_GPIO] & registers [MCP_IODIR]) |
+            (registers [MCP_OLAT] & ~registers [MCP_IODIR]);
+        device->output_changed = sim_now ();
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Reading INTCAP or GPIO clears the interrupt.
+ */
+    static void
+mcp23008_read (device, reg)
+    struct regfile *device;
+    uint8_t reg;
+{
+    if (reg == MCP_INTCAP || reg == MCP_GPIO)
+        device->registers [MCP_INTF] = 0;
+}
+
+/********************************************************************/
+
+/**
+ *  Clearing the INT bit in main control releases ALERT, and clears the
+ *  status of channels that are no longer touched.
+ */
+    static void
+cap1188_written (device, reg)
+    struct regfile *device;
+    uint8_t reg;
+{
+    uint8_t *registers = device->registers;
+
+    if (reg == CAP_MAIN_CONTROL && (registers [reg] & 0x01) == 0)
+    {
+        PIND |= _BV (PIND2);
+        registers [CAP_INPUT_STATUS] = registers [CAP_HELD];
+
+        if (registers [CAP_HELD] == 0)
+            registers [CAP_GENERAL_STATUS] &= ~0x01;
+    }
+}
+
+/********************************************************************/
+
+    static int
+eeprom_start (bus, read)
+    struct sim_device *bus;
+    int read;
+{
+    struct regfile *device = (struct regfile *) bus;
+
+    if (sim_now () < device->busy_until)
+        return 0;
+
+    device->page_written = 0;
+    return regfile_start (bus, read);
+}
+
+/********************************************************************/
+
+    static int
+eeprom_write (bus, value)
+    struct sim_device *bus;
+    uint8_t value;
+{
+    struct regfile *device = (struct regfile *) bus;
+    uint8_t page;
+
+    if (!device->pointer_set)
+        return regfile_write (bus, value);
+
+    // the address wraps around within the page.
+    page = device->pointer & ~(EEPROM_PAGE_LENGTH - 1);
+    device->registers [device->pointer] = value;
+    device->pointer = page | ((device->pointer + 1) & (EEPROM_PAGE_LENGTH - 1));
+    device->register_writes ++;
+    device->page_written = 1;
+
+    return 1;
+}
+
+/********************************************************************/
+
+    static void
+eeprom_stop (bus)
+    struct sim_device *bus;
+{
+    struct regfile *device = (struct regfile *) bus;
+
+    if (device->page_written)
+    {
+        device->busy_until = sim_now () + EEPROM_WRITE_US;
+        device->page_written = 0;
+    }
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
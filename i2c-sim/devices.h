@@ -0,0 +1,59 @@
+/**
+ *  devices.h
+ *
+ *  Models of I2C devices for the simulated bus.
+ */
+
+#ifndef _DEVICES_H
+#define _DEVICES_H
+
+#include <stdint.h>
+
+#include "sim.h"
+
+// A device with 256 byte registers. The first byte of each write sets the
+// register pointer, the following bytes are written from there on, and
+// reads carry on from the pointer; the pointer increments after each byte.
+// The hooks let a device model give registers side effects.
+struct regfile
+{
+    struct sim_device bus;
+    uint8_t registers [256];
+    uint8_t pointer;
+    int pointer_set;
+    unsigned long register_writes;
+
+    // called after a register has been written or read by the master.
+    void (*written) (struct regfile *device, uint8_t reg);
+    void (*read) (struct regfile *device, uint8_t reg);
+
+    // the MCU interrupt handler wired to the device's INT pin, if any.
+    void (*interrupt) (void);
+
+    // time of the most recent write to the output latch (MCP23008).
+    double output_changed;
+
+    // EEPROM write cycle: busy until this time.
+    double busy_until;
+    int page_written;
+};
+
+void regfile_init (struct regfile *device, uint8_t address, const char *name);
+
+void mcp23008_init (struct regfile *device, uint8_t address, void (*interrupt) (void));
+void mcp23008_set_inputs (struct regfile *device, uint8_t levels);
+
+#define CAP1188_ADDRESS     0x29
+
+void cap1188_init (struct regfile *device, void (*interrupt) (void));
+void cap1188_touch (struct regfile *device, uint8_t channels);
+void cap1188_release (struct regfile *device, uint8_t channels);
+
+#define EEPROM_PAGE_LENGTH  8
+#define EEPROM_WRITE_US     5000.0
+
+void eeprom_init (struct regfile *device, uint8_t address);
+
+#endif // _DEVICES_H
+
+/** vim: set ts=4 sw=4 et : */
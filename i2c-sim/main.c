@@ -0,0 +1,783 @@
+/**
+ *  I2C SIMULATOR
+ *
+ *  Runs the I2C library against a simulated TWI peripheral and simulated
+ *  devices on the host, so that the driver can be tested and measured
+ *  without hardware. Each scenario drives the real library code (and the
+ *  port expander and touch drivers on top of it) through a workload, and
+ *  reports bus utilisation, transaction rate and latency, and anything that
+ *  went wrong.
+ *
+ *  Timing comes from the bit rate register and a fixed cost per ISR call;
+ *  see sim.c. Numbers are for comparing changes to the driver, not a
+ *  prediction of the exact figures on the chip.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "i2c.h"
+#include "mcp230xx.h"
+#include "regcache.h"
+#include "touch.h"
+#include "sim.h"
+#include "devices.h"
+
+/********************************************************************/
+
+#define EXPANDER_ADDRESS        0x20
+#define SCRATCH_ADDRESS         0x21
+#define CACHED_ADDRESS          0x22
+#define LATE_ADDRESS            0x23
+#define EEPROM_ADDRESS          0x50
+#define MISSING_ADDRESS         0x33
+#define SLAVE_ADDRESS           0x42
+
+#define LED_PIN                 0
+#define BUTTON_PIN              1
+#define SPARE_PIN               2
+
+/********************************************************************/
+
+static struct regfile scratch;
+static struct regfile cached;
+static struct regfile late;
+static struct regfile expander_model;
+static struct regfile touch_model;
+static struct regfile eeprom;
+
+static struct mcp230xx expander;
+static int expander_ready;
+static int button_calls;
+
+static struct regcache_block cache_block;
+static uint8_t cache_values [8];
+static int cache_ready;
+
+static struct regcache_block late_block;
+static uint8_t late_values [4];
+static int late_ready;
+
+static int problems;
+
+// latency measurements, in microseconds.
+static double event_time;
+static double latency_total;
+static double latency_max;
+static unsigned long latency_count;
+
+/********************************************************************/
+
+static void scenario_begin (const char *title);
+static void report (void);
+static void check (int condition, const char *message);
+static void record_latency (double end);
+
+static void bulk_writes (void);
+static void blocking_reads (void);
+static void priority_mix (void);
+static void cache_queue_full (void);
+static void button_to_led (void);
+static void expander_nack (void);
+static void touch_events (void);
+static void touch_missing (void);
+static void eeprom_busy (void);
+static void clock_stretch (void);
+static void slave_register_map (void);
+static void missing_device (void);
+static void hung_device (void);
+
+static void button_changed (uint8_t pin, uint8_t level);
+static void expander_interrupt (void);
+static void touched (uint8_t channel);
+
+void INT0_vect (void);
+
+/********************************************************************/
+
+    int
+main (void)
+{
+    static void (*const scenarios []) (void) =
+    {
+        &bulk_writes,
+        &blocking_reads,
+        &priority_mix,
+        &cache_queue_full,
+        &button_to_led,
+        &expander_nack,
+        &touch_events,
+        &touch_missing,
+        &eeprom_busy,
+        &clock_stretch,
+        &slave_register_map,
+        &missing_device,
+        &hung_device,
+    };
+
+    for (unsigned int i = 0; i < sizeof (scenarios) / sizeof (scenarios [0]); i ++)
+    {
+        if (sim_run_scenario (scenarios [i]) != 0)
+        {
+            printf ("  abandoned: %s\n", sim_failure ());
+
+            // the hung device scenario is expected to end this way.
+            if (scenarios [i] != &hung_device)
+                problems ++;
+        }
+        else
+        {
+            report ();
+        }
+    }
+
+    printf ("\n%d problem(s)\n", problems);
+
+    return (problems == 0)? 0 : 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Reset the bus and the driver for the next scenario.
+ */
+    static void
+scenario_begin (title)
+    const char *title;
+{
+    printf ("\n%s\n", title);
+
+    sim_reset ();
+    i2c_init ();
+    sei ();
+
+    latency_total = 0;
+    latency_max = 0;
+    latency_count = 0;
+}
+
+/********************************************************************/
+
+/**
+ *  Print the figures for the scenario that just ran.
+ */
+    static void
+report (void)
+{
+    struct sim_stats bus;
+    struct i2c_stats classes [I2C_PRIORITY_CLASSES];
+    static const char *const names [] = {"urgent", "bulk"};
+
+    sim_get_stats (&bus);
+
+    printf ("  %.1f ms simulated, bus busy %.1f%%, %lu transactions (%.0f/s), %lu bytes\n",
+        bus.elapsed_us / 1000.0,
+        (bus.elapsed_us > 0)? 100.0 * bus.busy_us / bus.elapsed_us : 0.0,
+        bus.transactions,
+        (bus.elapsed_us > 0)? bus.transactions * 1e6 / bus.elapsed_us : 0.0,
+        bus.bytes);
+
+    if (bus.transactions > 0)
+    {
+        printf ("  transaction time mean %.0f us, max %.0f us; %lu ISR calls, %lu address NACKs\n",
+            bus.total_transaction_us / bus.transactions, bus.max_transaction_us,
+            bus.isr_calls, bus.address_nacks);
+    }
+
+    for (uint8_t i = 0; i < I2C_PRIORITY_CLASSES; i ++)
+    {
+        i2c_get_stats (i, &(classes [i]));
+
+        if (classes [i].transactions == 0)
+            continue;
+
+        printf ("  %-6s queue wait mean %.1f, max %u interrupts; %u failed\n",
+            names [i], (double) classes [i].total_latency / classes [i].transactions,
+            classes [i].max_latency, classes [i].failures);
+    }
+
+    if (latency_count > 0)
+    {
+        printf ("  event latency mean %.0f us, max %.0f us over %lu events\n",
+            latency_total / latency_count, latency_max, latency_count);
+    }
+}
+
+/********************************************************************/
+
+    static void
+check (condition, message)
+    int condition;
+    const char *message;
+{
+    if (!condition)
+    {
+        printf ("  FAILED: %s\n", message);
+        problems ++;
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Record the time from the last event (event_time) until end.
+ */
+    static void
+record_latency (end)
+    double end;
+{
+    double latency = end - event_time;
+
+    latency_total += latency;
+    latency_count ++;
+
+    if (latency > latency_max)
+        latency_max = latency;
+}
+
+/********************************************************************/
+
+/**
+ *  Stream register writes from the main loop faster than the bus can take
+ *  them. The queue fills up, and writes that don't fit are dropped.
+ */
+    static void
+bulk_writes (void)
+{
+    unsigned long sent = 500;
+    char message [80];
+
+    scenario_begin ("bulk register writes, one every 100 us");
+
+    regfile_init (&scratch, SCRATCH_ADDRESS, "scratch");
+    sim_attach (&scratch.bus);
+
+    for (unsigned long i = 0; i < sent; i ++)
+    {
+        i2c_write_register (SCRATCH_ADDRESS, i & 0x0F, i);
+        sim_advance (100);
+    }
+
+    sim_run_until_idle ();
+
+    snprintf (message, sizeof (message), "%lu of %lu writes dropped",
+        sent - scratch.register_writes, sent);
+    printf ("  %s (queue full)\n", message);
+    check (scratch.register_writes > 0, "no writes arrived");
+    check (scratch.registers [(sent - 1) & 0x0F] == ((sent - 1) & 0xFF),
+        "last write didn't arrive");
+}
+
+/********************************************************************/
+
+/**
+ *  Back to back blocking register reads.
+ */
+    static void
+blocking_reads (void)
+{
+    int correct = 1;
+
+    scenario_begin ("blocking register reads");
+
+    regfile_init (&scratch, SCRATCH_ADDRESS, "scratch");
+    sim_attach (&scratch.bus);
+
+    for (int i = 0; i < 256; i ++)
+        scratch.registers [i] = i ^ 0x5A;
+
+    for (int i = 0; i < 200; i ++)
+    {
+        event_time = sim_now ();
+
+        if (i2c_read_register (SCRATCH_ADDRESS, i) != (i ^ 0x5A))
+            correct = 0;
+
+        record_latency (sim_now ());
+    }
+
+    sim_run_until_idle ();
+    check (correct, "read returned the wrong value");
+}
+
+/********************************************************************/
+
+/**
+ *  Long bulk writes keep the queue busy, while a small urgent write goes out
+ *  every millisecond. The urgent class should wait for at most the transfer
+ *  already on the bus.
+ */
+    static void
+priority_mix (void)
+{
+    static uint8_t block [16];
+
+    scenario_begin ("urgent writes behind a busy bulk queue");
+
+    regfile_init (&scratch, SCRATCH_ADDRESS, "scratch");
+    regfile_init (&expander_model, EXPANDER_ADDRESS, "urgent");
+    sim_attach (&scratch.bus);
+    sim_attach (&expander_model.bus);
+
+    for (int ms = 0; ms < 100; ms ++)
+    {
+        // top the bulk queue up to about 10 transfers.
+        for (int i = 0; i < 3; i ++)
+            i2c_write_registers (SCRATCH_ADDRESS, 0x40, block, sizeof (block));
+
+        i2c_send_priority (EXPANDER_ADDRESS, (const uint8_t *) "\x0A\x01", 2,
+            I2C_PRIORITY_URGENT);
+
+        sim_advance (1000);
+    }
+
+    sim_run_until_idle ();
+    check (expander_model.register_writes == 100, "urgent writes were lost");
+}
+
+/********************************************************************/
+
+/**
+ *  Cached register writes while the bulk queue is full. A write that can't
+ *  be queued must stay dirty and go out with a later flush, so that the
+ *  cache and the device still agree afterwards.
+ */
+    static void
+cache_queue_full (void)
+{
+    int queued = 0;
+
+    scenario_begin ("register cache writes with a full queue");
+
+    regfile_init (&scratch, SCRATCH_ADDRESS, "scratch");
+    regfile_init (&cached, CACHED_ADDRESS, "cached");
+    sim_attach (&scratch.bus);
+    sim_attach (&cached.bus);
+
+    // the cache block goes on a global list, so it can only be added once.
+    if (!cache_ready)
+    {
+        regcache_add_block (&cache_block, CACHED_ADDRESS, 0x00, sizeof (cache_values),
+            cache_values, 0, REGCACHE_DEFAULTS);
+        cache_ready = 1;
+    }
+
+    // fill the bulk part of the queue; the bus doesn't move until we sleep.
+    while (i2c_write_register (SCRATCH_ADDRESS, 0x00, 0x00))
+        queued ++;
+
+    check (!regcache_write (CACHED_ADDRESS, 0x01, 0x5A) || !regcache_flush (CACHED_ADDRESS),
+        "flush into a full queue reported success");
+    check (queued > 0 && !i2c_write_register (SCRATCH_ADDRESS, 0x00, 0x00),
+        "queue didn't fill up");
+
+    sim_run_until_idle ();
+    check (regcache_flush (CACHED_ADDRESS), "flush failed with an empty queue");
+    sim_run_until_idle ();
+    check (cached.registers [0x01] == 0x5A, "dropped write was never sent");
+
+    // the same value again is a no-op, which is only right if it was sent.
+    regcache_write (CACHED_ADDRESS, 0x01, 0x5A);
+    regcache_flush (CACHED_ADDRESS);
+    sim_run_until_idle ();
+    check (cached.register_writes == 1, "expected exactly one write to the device");
+}
+
+/********************************************************************/
+
+/**
+ *  Button presses on an MCP23008 turn an LED on and off, through the INT
+ *  pin, a burst read of the captured pins, and a write to the output latch,
+ *  with bulk traffic on the bus at the same time. Latency is from the pin
+ *  change to the LED changing.
+ */
+    static void
+button_to_led (void)
+{
+    int led_followed = 1;
+
+    scenario_begin ("MCP23008 button to LED, with bulk traffic");
+
+    mcp23008_init (&expander_model, EXPANDER_ADDRESS, &expander_interrupt);
+    regfile_init (&scratch, SCRATCH_ADDRESS, "scratch");
+    sim_attach (&expander_model.bus);
+    sim_attach (&scratch.bus);
+
+    // the driver keeps a cache block on a global list, so it can only be
+    // set up once.
+    if (!expander_ready)
+    {
+        mcp230xx_init (&expander, EXPANDER_ADDRESS, MCP23008);
+        expander_ready = 1;
+    }
+
+    mcp230xx_pin_mode (&expander, LED_PIN, MCP230XX_OUTPUT);
+    mcp230xx_pin_mode (&expander, BUTTON_PIN, MCP230XX_INPUT_PULLUP);
+    mcp230xx_attach_interrupt (&expander, BUTTON_PIN, &button_changed);
+    mcp230xx_apply (&expander);
+    sim_run_until_idle ();
+
+    mcp23008_set_inputs (&expander_model, _BV (BUTTON_PIN));
+    sim_run_until_idle ();
+
+    for (int press = 0; press < 50; press ++)
+    {
+        for (int i = 0; i < 4; i ++)
+            i2c_write_register (SCRATCH_ADDRESS, i, press);
+
+        sim_advance (150 + (press * 37) % 400);
+
+        // press (low), then release.
+        event_time = sim_now ();
+        mcp23008_set_inputs (&expander_model, (press & 1)? _BV (BUTTON_PIN) : 0);
+        sim_run_until_idle ();
+
+        if (expander_model.output_changed >= event_time)
+            record_latency (expander_model.output_changed);
+
+        if ((expander_model.registers [0x0A] & _BV (LED_PIN)) != ((press & 1)? 0 : _BV (LED_PIN)))
+            led_followed = 0;
+    }
+
+    check (latency_count == 50, "LED didn't change after every button change");
+    check (led_followed, "LED doesn't match the button");
+
+    // an output write mustn't carry a configuration change that hasn't
+    // been applied yet.
+    mcp230xx_pin_mode (&expander, SPARE_PIN, MCP230XX_OUTPUT);
+    mcp230xx_digital_write (&expander, LED_PIN, 1, I2C_PRIORITY_URGENT);
+    sim_run_until_idle ();
+    check (expander_model.registers [0x00] & _BV (SPARE_PIN), "output write applied a pin mode change");
+
+    mcp230xx_pin_mode (&expander, SPARE_PIN, MCP230XX_INPUT);
+}
+
+/********************************************************************/
+
+/**
+ *  The MCP23008 stops answering just as the button is pressed, so the read
+ *  of INTF and INTCAP fails, and INT stays asserted. The handler mustn't be
+ *  called with the last read's values, and once the expander answers again,
+ *  mcp230xx_update must read the press and clear INT.
+ */
+    static void
+expander_nack (void)
+{
+    scenario_begin ("MCP23008 not answering an interrupt");
+
+    // the driver was set up by the last scenario; give the new model the
+    // same configuration (IODIR to GPPU, and the output latch), with the
+    // button released.
+    mcp23008_init (&expander_model, EXPANDER_ADDRESS, &expander_interrupt);
+    memcpy (expander_model.registers, expander.registers, MCP230XX_INTF);
+    expander_model.registers [MCP230XX_OLAT] = expander.registers [MCP230XX_OLAT];
+    expander_model.registers [MCP230XX_GPIO] = _BV (BUTTON_PIN);
+    sim_attach (&expander_model.bus);
+
+    button_calls = 0;
+    expander_model.bus.nack_address = 1;
+    mcp23008_set_inputs (&expander_model, 0);
+    sim_run_until_idle ();
+
+    check (button_calls == 0, "handler called after a failed read");
+    check (expander_model.registers [MCP230XX_INTF] != 0, "INT was cleared without a read");
+
+    mcp230xx_update (&expander);
+    sim_run_until_idle ();
+    check (button_calls == 0, "handler called after a failed retry");
+
+    expander_model.bus.nack_address = 0;
+    mcp230xx_update (&expander);
+    sim_run_until_idle ();
+
+    check (button_calls == 1, "press wasn't seen once the expander answered");
+    check (expander_model.registers [MCP230XX_OLAT] & _BV (LED_PIN), "LED didn't follow the press");
+    check (expander_model.registers [MCP230XX_INTF] == 0, "INT is still asserted");
+}
+
+/********************************************************************/
+
+/**
+ *  Touches on a CAP1188, through the touch driver: ALERT interrupt, status
+ *  read and INT clear chained together as urgent transfers. Latency is from
+ *  the touch to the handler being called.
+ */
+    static void
+touch_events (void)
+{
+    scenario_begin ("CAP1188 touch events");
+
+    cap1188_init (&touch_model, &INT0_vect);
+    regfile_init (&scratch, SCRATCH_ADDRESS, "scratch");
+    sim_attach (&touch_model.bus);
+    sim_attach (&scratch.bus);
+
+    // gain of 2, which clearing the INT bit must leave alone.
+    touch_model.registers [0x00] = 0x40;
+    check (touch_init (), "touch_init didn't find the CAP1188");
+
+    for (uint8_t channel = 0; channel < TOUCH_CHANNELS; channel ++)
+        install_handler (&touched, channel);
+
+    for (int i = 0; i < 100; i ++)
+    {
+        uint8_t channel = i % TOUCH_CHANNELS;
+
+        i2c_write_register (SCRATCH_ADDRESS, 0, i);
+        sim_advance (200);
+
+        event_time = sim_now ();
+        cap1188_touch (&touch_model, _BV (channel));
+        sim_run_until_idle ();
+
+        cap1188_release (&touch_model, _BV (channel));
+        sim_advance (500);
+    }
+
+    sim_run_until_idle ();
+    check (latency_count == 100, "not every touch reached its handler");
+    check ((touch_model.registers [0x00] & 0x01) == 0, "ALERT left asserted");
+    check (touch_model.registers [0x00] == 0x40, "clearing INT changed the gain");
+
+    // an ALERT while the queue is full can't be handled by the ISR; the
+    // main loop picks it up.
+    while (i2c_send_priority (SCRATCH_ADDRESS, (const uint8_t *) "\x00\x00", 2,
+            I2C_PRIORITY_URGENT))
+        ;
+
+    event_time = sim_now ();
+    cap1188_touch (&touch_model, 0x01);
+    sim_run_until_idle ();
+    touch_update ();
+    sim_run_until_idle ();
+
+    check (latency_count == 101, "touch lost while the queue was full");
+    check ((touch_model.registers [0x00] & 0x01) == 0, "ALERT left asserted after a full queue");
+}
+
+/********************************************************************/
+
+/**
+ *  touch_init with no CAP1188 on the bus gives up instead of hanging.
+ */
+    static void
+touch_missing (void)
+{
+    scenario_begin ("CAP1188 missing");
+
+    regfile_init (&scratch, SCRATCH_ADDRESS, "scratch");
+    sim_attach (&scratch.bus);
+
+    check (!touch_init (), "touch_init found a CAP1188 that isn't there");
+}
+
+/********************************************************************/
+
+/**
+ *  An EEPROM doesn't answer while it is programming a page. A read queued
+ *  straight after a page write fails; after the write cycle it succeeds.
+ */
+    static void
+eeprom_busy (void)
+{
+    static const uint8_t page [EEPROM_PAGE_LENGTH] = "EEPROM!";
+    struct i2c_stats bulk;
+    uint8_t buffer [EEPROM_PAGE_LENGTH];
+
+    scenario_begin ("EEPROM page write, then read during the write cycle");
+
+    eeprom_init (&eeprom, EEPROM_ADDRESS);
+    sim_attach (&eeprom.bus);
+
+    i2c_write_registers (EEPROM_ADDRESS, 0x08, page, sizeof (page));
+    i2c_read_registers (EEPROM_ADDRESS, 0x08, buffer, sizeof (buffer),
+        I2C_PRIORITY_BULK);
+
+    i2c_get_stats (I2C_PRIORITY_BULK, &bulk);
+    check (bulk.failures > 0, "read during the write cycle wasn't reported as failed");
+
+    sim_advance (EEPROM_WRITE_US);
+
+    i2c_read_registers (EEPROM_ADDRESS, 0x08, buffer, sizeof (buffer),
+        I2C_PRIORITY_BULK);
+    check (memcmp (buffer, page, sizeof (page)) == 0, "EEPROM read back wrong data");
+}
+
+/********************************************************************/
+
+/**
+ *  The blocking read workload again, with a device that stretches the
+ *  clock for 50 us on every byte.
+ */
+    static void
+clock_stretch (void)
+{
+    scenario_begin ("blocking register reads, 50 us clock stretch per byte");
+
+    regfile_init (&scratch, SCRATCH_ADDRESS, "scratch");
+    scratch.bus.stretch_us = 50;
+    sim_attach (&scratch.bus);
+
+    for (int i = 0; i < 200; i ++)
+    {
+        event_time = sim_now ();
+        i2c_read_register (SCRATCH_ADDRESS, i);
+        record_latency (sim_now ());
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Another master reads and writes our slave register map, while we queue
+ *  master transfers of our own.
+ */
+    static void
+slave_register_map (void)
+{
+    static uint8_t live [4] = {0x11, 0x22, 0x33, 0x44};
+    static uint8_t setting;
+    static const struct i2c_region regions [] =
+    {
+        {0x10, sizeof (live), 0, live},
+        {0x20, 1, I2C_REGION_WRITABLE, &setting},
+    };
+    static const uint8_t write_setting [] = {0x20, 0x7E};
+    static const uint8_t point_at_live [] = {0x10};
+    uint8_t buffer [4];
+    int read;
+
+    scenario_begin ("slave register map with master traffic");
+
+    regfile_init (&scratch, SCRATCH_ADDRESS, "scratch");
+    sim_attach (&scratch.bus);
+    i2c_slave_init (SLAVE_ADDRESS, regions, sizeof (regions) / sizeof (regions [0]));
+
+    for (int i = 0; i < 20; i ++)
+    {
+        i2c_write_register (SCRATCH_ADDRESS, 0, i);
+
+        sim_external_write (SLAVE_ADDRESS, point_at_live, sizeof (point_at_live));
+        read = sim_external_read (SLAVE_ADDRESS, buffer, sizeof (buffer));
+        check (read == 4 && memcmp (buffer, live, sizeof (live)) == 0,
+            "host read the wrong values");
+    }
+
+    sim_external_write (SLAVE_ADDRESS, write_setting, sizeof (write_setting));
+    check (setting == 0x7E, "host write didn't reach the register");
+    check (scratch.register_writes == 20, "master writes were lost");
+}
+
+/********************************************************************/
+
+/**
+ *  Reads and writes to an address with nothing on it fail, and the bus
+ *  carries on. A failed read of a cached register mustn't be cached, or
+ *  used as the base of a read-modify-write.
+ */
+    static void
+missing_device (void)
+{
+    struct i2c_stats bulk;
+
+    scenario_begin ("transfers to a missing device");
+
+    regfile_init (&scratch, SCRATCH_ADDRESS, "scratch");
+    sim_attach (&scratch.bus);
+
+    i2c_write_register (MISSING_ADDRESS, 0x00, 0x01);
+    i2c_read_register (MISSING_ADDRESS, 0x00);
+    i2c_write_register (SCRATCH_ADDRESS, 0x00, 0x01);
+    sim_run_until_idle ();
+
+    i2c_get_stats (I2C_PRIORITY_BULK, &bulk);
+    check (bulk.failures == 3, "expected 3 failed transfers");
+    check (scratch.register_writes == 1, "the bus didn't recover");
+
+    if (!late_ready)
+    {
+        regcache_add_block (&late_block, LATE_ADDRESS, 0x00, sizeof (late_values),
+            late_values, 0, 0);
+        late_ready = 1;
+    }
+
+    regcache_invalidate (LATE_ADDRESS);
+    regcache_read (LATE_ADDRESS, 0x01);
+    check ((late_block.valid_mask & 0x02) == 0, "failed read was cached");
+    check (!regcache_update_bits (LATE_ADDRESS, 0x01, 0x0F, 0x05),
+        "update of a register that couldn't be read succeeded");
+    check (late_block.dirty_mask == 0, "update wrote a value that was never read");
+
+    // now the device answers, and the update keeps its other bits.
+    regfile_init (&late, LATE_ADDRESS, "late");
+    late.registers [0x01] = 0xA0;
+    sim_attach (&late.bus);
+
+    check (regcache_update_bits (LATE_ADDRESS, 0x01, 0x0F, 0x05),
+        "update failed once the device answered");
+    regcache_flush (LATE_ADDRESS);
+    sim_run_until_idle ();
+    check (late.registers [0x01] == 0xA5, "read-modify-write lost the other bits");
+}
+
+/********************************************************************/
+
+/**
+ *  A device holds SCL low forever. A blocking read never returns; on the
+ *  chip this hangs the MCU, which the simulator reports.
+ */
+    static void
+hung_device (void)
+{
+    scenario_begin ("device holding SCL low");
+
+    regfile_init (&scratch, SCRATCH_ADDRESS, "scratch");
+    scratch.bus.hang = 1;
+    sim_attach (&scratch.bus);
+
+    i2c_read_register (SCRATCH_ADDRESS, 0x00);
+
+    printf ("  blocking read returned from a hung bus\n");
+    problems ++;
+}
+
+/********************************************************************/
+
+/**
+ *  Button handler, from the port expander driver: LED on while the button
+ *  is held down.
+ */
+    static void
+button_changed (pin, level)
+    uint8_t pin;
+    uint8_t level;
+{
+    button_calls ++;
+    mcp230xx_digital_write (&expander, LED_PIN, level? 0 : 1, I2C_PRIORITY_URGENT);
+}
+
+/********************************************************************/
+
+/**
+ *  Wired to the MCP23008 INT pin.
+ */
+    static void
+expander_interrupt (void)
+{
+    mcp230xx_handle_interrupt (&expander);
+}
+
+/********************************************************************/
+
+    static void
+touched (channel)
+    uint8_t channel;
+{
+    record_latency (sim_now ());
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
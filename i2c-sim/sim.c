@@ -0,0 +1,701 @@
+/**
+ *  sim.c
+ *
+ *  Simulation of the TWI (I2C) hardware of the ATmega328P.
+ *
+ *  The library code writes TWCR as it would on the real chip. Writing a one
+ *  to TWINT asks the hardware to carry out the next step (START, STOP,
+ *  send the byte in TWDR, or receive a byte). The simulator picks the
+ *  request up (and clears TWINT, as the hardware would) as soon as the ISR
+ *  returns, or the next time it runs for requests made outside the ISR, and
+ *  carries it out when the code sleeps or a scenario lets time pass. Each
+ *  step advances simulated time by the number of bit times it takes on the
+ *  bus, sets TWSR to the status code the hardware would produce, and calls
+ *  ISR (TWI_vect) if interrupts are enabled.
+ *
+ *  As on the chip, TWINT reads as one while an interrupt is waiting to be
+ *  served, so code outside the ISR sees the bus as busy. It reads as zero
+ *  inside the ISR, so that a one after the ISR returns is known to be a
+ *  request. If the ISR returns without writing a one to TWINT, the real
+ *  hardware would keep SCL low and re-enter the ISR forever; the simulator
+ *  reports this as a stall.
+ */
+
+#include <avr/io.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+/********************************************************************/
+
+volatile uint8_t TWCR, TWSR, TWDR, TWBR, TWAR;
+volatile uint8_t SREG;
+volatile uint8_t PORTC, DDRD, PORTD, PIND;
+volatile uint8_t EICRA, EIFR, EIMSK;
+volatile uint8_t PCICR, PCMSK2;
+
+void TWI_vect (void);
+
+/********************************************************************/
+
+#define MAX_DEVICES             8
+#define MAX_EXTERNAL            8
+
+// what the simulated TWI hardware is doing.
+enum bus_state
+{
+    BUS_IDLE,           // no START sent
+    BUS_ADDRESS,        // START sent, waiting for SLA+R/W in TWDR
+    BUS_TRANSMIT,       // master transmitter, addressed a device
+    BUS_RECEIVE,        // master receiver, addressed a device
+    BUS_HUNG            // a device is holding SCL low
+};
+
+static struct sim_device *devices [MAX_DEVICES];
+static int device_count;
+
+static enum bus_state state;
+static struct sim_device *selected;
+
+static int irq_pending;
+static uint8_t irq_status;
+
+// TWCR as it was written with TWINT set, waiting to be carried out.
+static int requested;
+static uint8_t request_control;
+
+static void (*external [MAX_EXTERNAL]) (void);
+static int external_count;
+
+static double now_us;
+static double isr_cost_us;
+static double transaction_start;
+static int in_transaction;
+
+static struct sim_stats stats;
+
+static int trace;
+
+static jmp_buf scenario_exit;
+static int scenario_running;
+static char failure [128];
+
+/********************************************************************/
+
+static double bit_time (void);
+static void bus_time (double microseconds);
+static void raise_irq (uint8_t status);
+static void latch_request (void);
+static int hardware_step (void);
+static void deliver (uint8_t status);
+static int service (void);
+static void end_transaction (void);
+static void fail (const char *message);
+
+/********************************************************************/
+
+/**
+ *  Put the simulated hardware back in its reset state, and detach all
+ *  devices.
+ */
+    void
+sim_reset (void)
+{
+    TWCR = TWSR = TWDR = TWBR = TWAR = 0;
+    SREG = 0;
+    EIMSK = EIFR = EICRA = 0;
+
+    device_count = 0;
+    external_count = 0;
+    state = BUS_IDLE;
+    selected = NULL;
+    irq_pending = 0;
+    requested = 0;
+    now_us = 0;
+    isr_cost_us = 3.0;
+    in_transaction = 0;
+    failure [0] = '\0';
+    trace = getenv ("SIM_TRACE") != NULL;
+
+    memset (&stats, 0, sizeof (stats));
+}
+
+/********************************************************************/
+
+/**
+ *  Add a device to the bus.
+ */
+    void
+sim_attach (device)
+    struct sim_device *device;
+{
+    if (device_count < MAX_DEVICES)
+        devices [device_count ++] = device;
+}
+
+/********************************************************************/
+
+/**
+ *  Set the CPU time charged for each call to the TWI ISR. The TWI hardware
+ *  holds SCL low while TWINT is set, so this time is bus time too.
+ */
+    void
+sim_set_isr_cost (microseconds)
+    double microseconds;
+{
+    isr_cost_us = microseconds;
+}
+
+/********************************************************************/
+
+    double
+sim_now (void)
+{
+    return now_us;
+}
+
+/********************************************************************/
+
+/**
+ *  Let time pass while the main loop does other work with interrupts
+ *  enabled. The bus carries on in the background; a bus step that starts
+ *  before the time is up is allowed to finish, so this may run a little
+ *  over.
+ */
+    void
+sim_advance (microseconds)
+    double microseconds;
+{
+    double until = now_us + microseconds;
+    uint8_t sreg = SREG;
+
+    SREG |= 0x80;
+
+    while (now_us < until && service ())
+        ;
+
+    if (now_us < until)
+        now_us = until;
+
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns 1 if the bus is idle with nothing waiting to happen.
+ */
+    int
+sim_bus_idle (void)
+{
+    latch_request ();
+
+    return state == BUS_IDLE && !irq_pending && !requested;
+}
+
+/********************************************************************/
+
+/**
+ *  Run the bus until the driver has nothing more to do, as if the main loop
+ *  were asleep with interrupts enabled.
+ */
+    void
+sim_run_until_idle (void)
+{
+    uint8_t sreg = SREG;
+
+    SREG |= 0x80;
+
+    while (service ())
+        ;
+
+    if (state == BUS_HUNG)
+        fail ("bus hung: a device is holding SCL low");
+
+    if (state != BUS_IDLE)
+        fail ("driver stopped with the bus still owned (no STOP sent)");
+
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  sleep_mode () for the simulated MCU: run until at least one interrupt
+ *  has been delivered. If nothing can ever wake the MCU, the scenario is
+ *  abandoned.
+ */
+    void
+sim_sleep (void)
+{
+    unsigned long before = stats.isr_calls;
+
+    while (stats.isr_calls == before)
+    {
+        if (!service ())
+        {
+            if (state == BUS_HUNG)
+                fail ("MCU asleep forever: a device is holding SCL low");
+            else
+                fail ("MCU asleep forever: no interrupt will ever arrive");
+        }
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Request a call to an interrupt handler for an external event (eg a
+ *  device pulling its INT pin low). It is delivered the next time the
+ *  simulator runs with interrupts enabled.
+ */
+    void
+sim_raise_external (isr)
+    void (*isr) (void);
+{
+    if (external_count < MAX_EXTERNAL)
+        external [external_count ++] = isr;
+}
+
+/********************************************************************/
+
+/**
+ *  Another master on the bus writes to the given address, which is expected
+ *  to be the MCU's own slave address. Runs the slave receiver side of the
+ *  driver through the whole transfer.
+ */
+    void
+sim_external_write (address, data, length)
+    uint8_t address;
+    const uint8_t *data;
+    int length;
+{
+    sim_run_until_idle ();
+
+    if ((TWAR >> 1) != address || (TWCR & _BV (TWEA)) == 0)
+        return;
+
+    bus_time (bit_time () * 10);
+    deliver (0x60);
+
+    for (int i = 0; i < length; i ++)
+    {
+        // the ACK for this byte was decided by TWEA when the ISR returned.
+        int ack = TWCR & _BV (TWEA);
+
+        requested = 0;
+        TWDR = data [i];
+        bus_time (bit_time () * 9);
+        deliver (ack? 0x80 : 0x88);
+
+        if (!ack)
+            break;
+    }
+
+    requested = 0;
+    bus_time (bit_time ());
+    deliver (0xA0);
+
+    sim_run_until_idle ();
+}
+
+/********************************************************************/
+
+/**
+ *  Another master on the bus reads length bytes from the given address.
+ *  Returns the number of bytes read.
+ */
+    int
+sim_external_read (address, buffer, length)
+    uint8_t address;
+    uint8_t *buffer;
+    int length;
+{
+    int count = 0;
+
+    sim_run_until_idle ();
+
+    if ((TWAR >> 1) != address || (TWCR & _BV (TWEA)) == 0)
+        return 0;
+
+    bus_time (bit_time () * 10);
+    deliver (0xA8);
+
+    while (count < length)
+    {
+        int last_from_slave = (TWCR & _BV (TWEA)) == 0;
+
+        requested = 0;
+        buffer [count ++] = TWDR;
+        bus_time (bit_time () * 9);
+
+        // the external master ACKs every byte but the last.
+        if (count == length)
+        {
+            deliver (0xC0);
+            break;
+        }
+
+        if (last_from_slave)
+        {
+            deliver (0xC8);
+            break;
+        }
+
+        deliver (0xB8);
+    }
+
+    bus_time (bit_time ());
+    sim_run_until_idle ();
+
+    return count;
+}
+
+/********************************************************************/
+
+    void
+sim_get_stats (result)
+    struct sim_stats *result;
+{
+    *result = stats;
+    result->elapsed_us = now_us;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the reason the last scenario was abandoned, or an empty string.
+ */
+    const char *
+sim_failure (void)
+{
+    return failure;
+}
+
+/********************************************************************/
+
+    int
+sim_run_scenario (scenario)
+    void (*scenario) (void);
+{
+    scenario_running = 1;
+
+    if (setjmp (scenario_exit) != 0)
+    {
+        scenario_running = 0;
+        return -1;
+    }
+
+    scenario ();
+    scenario_running = 0;
+
+    return 0;
+}
+
+/********************************************************************/
+
+/**
+ *  Length of one SCL period in microseconds, from the bit rate register as
+ *  per the datasheet: SCL = F_CPU / (16 + 2 * TWBR * prescaler).
+ */
+    static double
+bit_time (void)
+{
+    static const int prescaler [] = {1, 4, 16, 64};
+    double divider = 16.0 + 2.0 * TWBR * prescaler [TWSR & 0x03];
+
+    return divider * 1e6 / F_CPU;
+}
+
+/********************************************************************/
+
+/**
+ *  Advance time with the bus busy.
+ */
+    static void
+bus_time (microseconds)
+    double microseconds;
+{
+    now_us += microseconds;
+    stats.busy_us += microseconds;
+}
+
+/********************************************************************/
+
+    static void
+raise_irq (status)
+    uint8_t status;
+{
+    irq_pending = 1;
+    irq_status = status;
+    TWCR |= _BV (TWINT);
+}
+
+/********************************************************************/
+
+/**
+ *  Pick up a one written to TWINT. While an interrupt is waiting to be
+ *  served, TWINT was set by the hardware and isn't a request.
+ */
+    static void
+latch_request (void)
+{
+    if (!irq_pending && (TWCR & _BV (TWINT)))
+    {
+        requested = 1;
+        request_control = TWCR;
+        TWCR &= ~_BV (TWINT);
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Carry out the action requested by a one written to TWINT, if there is
+ *  one. Returns 1 if something happened.
+ */
+    static int
+hardware_step (void)
+{
+    uint8_t control;
+    uint8_t value;
+    int ack;
+
+    latch_request ();
+
+    if (!requested || (request_control & _BV (TWEN)) == 0 || state == BUS_HUNG)
+        return 0;
+
+    control = request_control;
+    requested = 0;
+
+    if (control & _BV (TWSTO))
+    {
+        TWCR &= ~_BV (TWSTO);
+
+        if (state != BUS_IDLE)
+        {
+            bus_time (bit_time ());
+            end_transaction ();
+            state = BUS_IDLE;
+        }
+
+        if ((control & _BV (TWSTA)) == 0)
+            return 1;
+    }
+
+    if (control & _BV (TWSTA))
+    {
+        int repeated = (state != BUS_IDLE);
+
+        if (repeated)
+            end_transaction ();
+
+        bus_time (bit_time ());
+        state = BUS_ADDRESS;
+        in_transaction = 1;
+        transaction_start = now_us;
+        raise_irq (repeated? 0x10 : 0x08);
+        return 1;
+    }
+
+    switch (state)
+    {
+    case BUS_ADDRESS:
+        selected = NULL;
+
+        for (int i = 0; i < device_count; i ++)
+        {
+            if (devices [i]->address == (TWDR >> 1))
+                selected = devices [i];
+        }
+
+        bus_time (bit_time () * 9);
+
+        if (selected != NULL && selected->hang)
+        {
+            state = BUS_HUNG;
+            return 1;
+        }
+
+        if (selected != NULL)
+        {
+            bus_time (selected->stretch_us);
+            selected->bytes_written = 0;
+        }
+
+        ack = selected != NULL && !selected->nack_address &&
+            selected->start (selected, TWDR & 0x01);
+
+        if (!ack)
+        {
+            stats.address_nacks ++;
+            selected = NULL;
+        }
+
+        state = (TWDR & 0x01)? BUS_RECEIVE : BUS_TRANSMIT;
+
+        if (state == BUS_RECEIVE)
+            raise_irq (ack? 0x40 : 0x48);
+        else
+            raise_irq (ack? 0x18 : 0x20);
+
+        break;
+
+    case BUS_TRANSMIT:
+        bus_time (bit_time () * 9);
+        stats.bytes ++;
+        ack = 0;
+
+        if (selected != NULL)
+        {
+            bus_time (selected->stretch_us);
+            selected->bytes_written ++;
+
+            if (selected->nack_after == 0 || selected->bytes_written <= selected->nack_after)
+                ack = selected->write (selected, TWDR);
+        }
+
+        raise_irq (ack? 0x28 : 0x30);
+        break;
+
+    case BUS_RECEIVE:
+        bus_time (bit_time () * 9);
+        stats.bytes ++;
+        value = 0xFF;
+
+        if (selected != NULL)
+        {
+            bus_time (selected->stretch_us);
+            value = selected->read (selected);
+        }
+
+        TWDR = value;
+        raise_irq ((control & _BV (TWEA))? 0x50 : 0x58);
+        break;
+
+    default:
+        // TWINT written with nothing to do, eg while idle.
+        break;
+    }
+
+    return 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Call the TWI ISR with the given status, as the hardware would when TWINT
+ *  is set. Interrupts are disabled inside the ISR, as on the real chip.
+ */
+    static void
+deliver (status)
+    uint8_t status;
+{
+    uint8_t sreg = SREG;
+
+    TWSR = (TWSR & 0x03) | status;
+    TWCR &= ~_BV (TWINT);
+
+    if (trace)
+        fprintf (stderr, "%10.1f us  TWSR %02X", now_us, status);
+
+    SREG &= ~0x80;
+    stats.isr_calls ++;
+    TWI_vect ();
+    SREG = sreg;
+
+    bus_time (isr_cost_us);
+
+    if (trace)
+        fprintf (stderr, "  -> TWCR %02X TWDR %02X\n", TWCR, TWDR);
+
+    latch_request ();
+
+    if (!requested)
+        fail ("TWI ISR returned without clearing TWINT; the bus would stall");
+}
+
+/********************************************************************/
+
+/**
+ *  Do one thing: deliver a pending interrupt, or carry out a requested
+ *  hardware action. Returns 0 if there was nothing to do.
+ */
+    static int
+service (void)
+{
+    void (*isr) (void);
+
+    if ((SREG & 0x80) && external_count > 0)
+    {
+        isr = external [0];
+        memmove (external, external + 1, -- external_count * sizeof (external [0]));
+
+        SREG &= ~0x80;
+        stats.isr_calls ++;
+        isr ();
+        SREG |= 0x80;
+        return 1;
+    }
+
+    if (irq_pending && (SREG & 0x80) && (TWCR & _BV (TWIE)))
+    {
+        irq_pending = 0;
+        deliver (irq_status);
+        return 1;
+    }
+
+    return hardware_step ();
+}
+
+/********************************************************************/
+
+/**
+ *  Record a finished transfer (ended by STOP or REPEAT START).
+ */
+    static void
+end_transaction (void)
+{
+    double length;
+
+    if (!in_transaction)
+        return;
+
+    if (selected != NULL && selected->stop != NULL)
+        selected->stop (selected);
+
+    length = now_us - transaction_start;
+    stats.transactions ++;
+    stats.total_transaction_us += length;
+
+    if (length > stats.max_transaction_us)
+        stats.max_transaction_us = length;
+
+    in_transaction = 0;
+    selected = NULL;
+}
+
+/********************************************************************/
+
+/**
+ *  Abandon the current scenario.
+ */
+    static void
+fail (message)
+    const char *message;
+{
+    snprintf (failure, sizeof (failure), "%s", message);
+
+    if (scenario_running)
+        longjmp (scenario_exit, 1);
+
+    fprintf (stderr, "sim: %s\n", failure);
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
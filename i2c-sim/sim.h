@@ -0,0 +1,81 @@
+/**
+ *  sim.h
+ *
+ *  Host side simulation of the ATmega328P TWI hardware and the devices on
+ *  the I2C bus, for testing and benchmarking library/i2c.c without
+ *  hardware.
+ */
+
+#ifndef _SIM_H
+#define _SIM_H
+
+#include <stdint.h>
+
+// A device on the simulated bus. The callbacks describe how the device
+// responds to the master; the remaining fields are faults that a scenario
+// can switch on.
+struct sim_device
+{
+    uint8_t address;
+    const char *name;
+
+    // addressed after a START; return 1 to ACK.
+    int (*start) (struct sim_device *device, int read);
+
+    // the master wrote a byte; return 1 to ACK.
+    int (*write) (struct sim_device *device, uint8_t value);
+
+    // the master wants the next byte.
+    uint8_t (*read) (struct sim_device *device);
+
+    // STOP or REPEAT START ended the transfer with this device.
+    void (*stop) (struct sim_device *device);
+
+    // faults: NACK the address, NACK data bytes after this many have been
+    // written (0 for never), hold SCL low for this long on every byte, or
+    // hold SCL low forever the next time the device is addressed.
+    int nack_address;
+    int nack_after;
+    double stretch_us;
+    int hang;
+
+    int bytes_written;
+};
+
+// transfer level statistics, gathered at the bus.
+struct sim_stats
+{
+    double elapsed_us;
+    double busy_us;
+    unsigned long transactions;
+    unsigned long bytes;
+    unsigned long address_nacks;
+    unsigned long isr_calls;
+    double total_transaction_us;
+    double max_transaction_us;
+};
+
+void sim_reset (void);
+void sim_attach (struct sim_device *device);
+void sim_set_isr_cost (double microseconds);
+
+double sim_now (void);
+void sim_advance (double microseconds);
+void sim_run_until_idle (void);
+int sim_bus_idle (void);
+
+void sim_raise_external (void (*isr) (void));
+
+void sim_external_write (uint8_t address, const uint8_t *data, int length);
+int sim_external_read (uint8_t address, uint8_t *buffer, int length);
+
+void sim_get_stats (struct sim_stats *stats);
+const char *sim_failure (void);
+
+// scenario runner: runs the function, and catches a simulated MCU that
+// would hang forever. Returns 0 if the scenario finished, -1 if it hung.
+int sim_run_scenario (void (*scenario) (void));
+
+#endif // _SIM_H
+
+/** vim: set ts=4 sw=4 et : */
@@ -9,9 +9,31 @@
 
 #include <stdint.h>
 
+#include "pins.h"
 #include "vectors.h"
 #include "utils.h"
 
+//
+// pins: the data/command select (DCX), chip select and reset lines of the
+// panel. Any free pins will do; define these on the command line (eg
+// -D'LCD_CS_PIN=B,1') to move them. The SPI pins are fixed by the hardware.
+//
+#ifndef LCD_DC_PIN
+#define LCD_DC_PIN              D, 2
+#endif
+
+#ifndef LCD_CS_PIN
+#define LCD_CS_PIN              D, 3
+#endif
+
+#ifndef LCD_RESET_PIN
+#define LCD_RESET_PIN           D, 4
+#endif
+
+#define SPI_SS_PIN              B, 2
+#define SPI_MOSI_PIN            B, 3
+#define SPI_SCK_PIN             B, 5
+
 //
 // constants for 16 bit (RGB 565) colours
 //
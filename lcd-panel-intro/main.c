@@ -14,6 +14,9 @@
  *      - At every timer alarm, change the screen fill colour (cycle through a
  *        list of colours).
  *
+ *  Built with -DPROBE_ENABLE, it profiles the panel writes (see probe.h),
+ *  and after each round of demos, sends the probes over the UART if a 'p'
+ *  has been received, or clears them for an 'r'.
  */
 
 
@@ -21,9 +24,14 @@
 
 #include "lcd.h"
 #include "graphics.h"
+#include "probe.h"
 #include "vectors.h"
 #include "utils.h"
 
+#ifdef PROBE_ENABLE
+#include "uart.h"
+#endif
+
 /********************************************************************/
 
 //
@@ -50,6 +58,7 @@ static void demo_rectangles (bool filled);
 static void demo_round_rectangles (void);
 static void demo_filled_round_rectangles (void);
 
+static void poll_command (void);
 static void select_full_display (void);
 static uint16_t rgb888_to_rgb565 (uint8_t red, uint8_t green, uint8_t blue);
 
@@ -60,6 +69,11 @@ main (void)
 {
     lcd_init ();
 
+#ifdef PROBE_ENABLE
+    uart_init (9600);
+    probe_init ();
+#endif
+
     lcd_fill_colour (colours_list [0]);
 
     while (1)
@@ -73,6 +87,8 @@ main (void)
         demo_round_rectangles ();
         demo_filled_round_rectangles ();
         //demo_rectangles (true);
+
+        poll_command ();
     }
 
     return 0;
@@ -378,4 +394,31 @@ demo_lines (void)
 
 /********************************************************************/
 
+/**
+ *  Act on a command received over the UART since the last round of demos:
+ *  'p' sends the probes, and 'r' clears them. Does nothing unless the
+ *  probes are enabled.
+ */
+    static void
+poll_command (void)
+{
+#ifdef PROBE_ENABLE
+    switch (uart_poll ())
+    {
+    case 'p':
+        probe_dump ();
+        break;
+
+    case 'r':
+        probe_reset ();
+        break;
+
+    default:
+        break;
+    }
+#endif
+}
+
+/********************************************************************/
+
 /** vim: set ts=4 sw=4 et : */
@@ -8,6 +8,7 @@
 #include <util/delay.h>
 
 #include "lcd.h"
+#include "probe.h"
 #include "vectors.h"
 
 /********************************************************************/
@@ -86,16 +87,21 @@ static const uint8_t st7789_init_cmds [] = {
     void
 lcd_init (void)
 {
-    // Set the DCX pin and CS pin to output mode.
-    DDRD |= 0x04 | 0x08 | 0x10;
+    // Set the DCX, CS and reset pins to output mode.
+    PIN_OUTPUT (LCD_DC_PIN);
+    PIN_OUTPUT (LCD_CS_PIN);
+    PIN_OUTPUT (LCD_RESET_PIN);
 
     // Set the pin mode on the MCU SPI MOSI and SCK to OUTPUT. Also set the
     // SS pin to OUTPUT.
-    DDRB |= (0x04 | 0x08 | 0x20);
+    PIN_OUTPUT (SPI_SS_PIN);
+    PIN_OUTPUT (SPI_MOSI_PIN);
+    PIN_OUTPUT (SPI_SCK_PIN);
 
     // Set the SPI CS pin to HIGH. Once we begin a transfer we will pull it
-    // low.
-    PORTD |= 0x08 | 0x10;
+    // low. Keep the panel out of reset.
+    PIN_SET (LCD_CS_PIN);
+    PIN_SET (LCD_RESET_PIN);
 
     display_init (st7789_init_cmds);
 }
@@ -110,8 +116,12 @@ write_colour (colour, pixel_count)
     uint16_t colour;
     uint32_t pixel_count;
 {
+    PROBE_BEGIN (PROBE_WRITE_COLOUR);
+
     for (uint32_t i = 0; i < pixel_count; i ++)
         spi_write16 (colour);
+
+    PROBE_END (PROBE_WRITE_COLOUR);
 }
 
 /** vim: set ts=4 sw=4 et : */
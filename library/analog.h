@@ -7,9 +7,111 @@
 #ifndef _ANALOG_H
 #define _ANALOG_H
 
+// auto trigger sources for analog_start, as ADTS values for ADCSRB. The
+// Timer 1 source takes over timer 1 (CTC mode, /64 prescaler), and the
+// period is given in timer 1 ticks of 4us. The Timer 0 source samples on
+// every timer 0 overflow, at whatever rate timer 0 has been set up to run.
+#define ANALOG_TRIGGER_TIMER0       0x04
+#define ANALOG_TRIGGER_TIMER1       0x05
+
+// size of the sample ring buffer, which holds one sample less than this.
+// Must be a power of two.
+#ifndef ANALOG_BUFFER_LENGTH
+#define ANALOG_BUFFER_LENGTH        32
+#endif
+
+// voltage references, as REFS bits for ADMUX. The internal 1.1V reference
+// is needed for the temperature sensor. The reference takes some time to
+// settle after a change, depending on the capacitor on the AREF pin.
+#define ANALOG_REFERENCE_AREF       0x00
+#define ANALOG_REFERENCE_AVCC       0x40
+#define ANALOG_REFERENCE_INTERNAL   0xC0
+
+// internal channels, besides the analog pins 0 to 7.
+#define ANALOG_CHANNEL_TEMPERATURE  0x08
+#define ANALOG_CHANNEL_BANDGAP      0x0E
+#define ANALOG_CHANNEL_GROUND       0x0F
+
+// scan entry flags. ANALOG_SCAN_DISCARD converts the channel twice and
+// throws the first result away, for inputs that need longer to settle than
+// the time between conversions (eg the bandgap, or a high impedance source).
+#define ANALOG_SCAN_DISCARD         0x01
+
+// ANALOG_SCAN_FAST converts the channel to 8 bits with a 1MHz ADC clock
+// (/16 prescaler) rather than 10 bits at 125kHz. A conversion takes 13.5us
+// instead of 108us, so with the Timer 1 trigger a period of 4 (16us, 62.5k
+// samples per second) is possible. Results are 0 to 255.
+#define ANALOG_SCAN_FAST            0x02
+
+// Oversampling: an entry with oversample set to n takes 4^n conversions in
+// a row, and reports their sum shifted right by n, which is a 10 + n bit
+// result, or 8 + n bits for an ANALOG_SCAN_FAST entry. This only gains
+// resolution if there is at least 1 LSB of noise on the input to dither it.
+#define ANALOG_OVERSAMPLE_MAX       6
+
+// Events a scan entry can raise, checked in the ADC ISR as each result
+// comes in. An entry's events field selects which ones it raises.
+//
+// The window events track which zone the result is in: below low, above
+// high, or inside. The zone only changes back towards inside once the
+// result is hysteresis past the boundary, so a noisy input sitting on a
+// threshold raises one event, not one per scan. For a single threshold,
+// set high to 0xFFFF (or low to 0) and only ask for the events you want.
+// The first result after analog_scan_start always raises the event for its
+// zone, if enabled, so the handler learns the starting state.
+//
+// ANALOG_EVENT_CHANGE is raised when the result has moved more than delta
+// from the value reported with the last change event (or the first result).
+#define ANALOG_EVENT_BELOW          0x01
+#define ANALOG_EVENT_INSIDE         0x02
+#define ANALOG_EVENT_ABOVE          0x04
+#define ANALOG_EVENT_CHANGE         0x08
+
+#define ANALOG_EVENT_WINDOW         (ANALOG_EVENT_BELOW | ANALOG_EVENT_INSIDE | ANALOG_EVENT_ABOVE)
+
+// Event handler, called from the ADC ISR with the index of the entry in the
+// scan list, the event, and the result that raised it. It should only note
+// the event, or post it on, and return.
+typedef void (*analog_event_handler_t) (uint8_t index, uint8_t event, uint16_t value);
+
+// One entry in a scan list. The caller fills in channel, reference, flags,
+// oversample and the event settings; the rest belongs to the driver.
+// Results are double buffered, so that the ISR can fill in one scan while
+// the main loop reads the last.
+struct analog_scan_entry
+{
+    uint8_t channel;
+    uint8_t reference;
+    uint8_t flags;
+    uint8_t oversample;
+
+    uint8_t events;         // ANALOG_EVENT_* to raise for this entry
+    uint16_t low;           // window, in result units (after oversampling)
+    uint16_t high;
+    uint16_t hysteresis;
+    uint16_t delta;         // change needed for ANALOG_EVENT_CHANGE
+
+    uint8_t admux;
+    uint8_t zone;
+    uint16_t reported;
+    uint16_t results [2];
+};
+
 void analog_init (uint8_t channels_mask);
 unsigned int analog_read (unsigned int channel);
 
+void analog_start (uint8_t channel, uint8_t trigger, uint16_t period);
+void analog_stop (void);
+uint8_t analog_available (void);
+uint8_t analog_get (uint16_t *sample);
+uint16_t analog_overruns (void);
+
+void analog_scan_start (struct analog_scan_entry *entries, uint8_t count,
+    uint8_t trigger, uint16_t period);
+uint16_t analog_scan_read (uint16_t *values);
+uint16_t analog_scan_value (uint8_t index);
+void analog_set_event_handler (analog_event_handler_t handler);
+
 #endif // _ANALOG_H
 
 // vim: ts=4 sw=4 et
@@ -0,0 +1,53 @@
+/**
+ *  crash.h
+ *
+ *  Declares functions for the crash record. The watchdog is run in
+ *  interrupt and reset mode: if the main loop stops feeding it, the first
+ *  timeout runs an ISR that notes where the MCU was stuck, and the second
+ *  resets it. The note is kept in .noinit RAM, which survives the reset,
+ *  and crash_init copies it to EEPROM on the next boot, so the last crash
+ *  can be reported over the UART even after a power cycle.
+ *
+ *  If the MCU is stuck with interrupts disabled (in an ISR, or a cli
+ *  section), the watchdog ISR can't run, and the reset comes with no
+ *  program counter. Built with ISRMON_TRACE (see isrmon.h), the record
+ *  still shows the last ISR to start, and whether it finished.
+ *
+ *  The watchdog can't guard against hangs and wake the MCU from sleep (see
+ *  tick_init_watchdog) at the same time. Don't sleep for longer than the
+ *  timeout with the watchdog running.
+ */
+
+#ifndef _CRASH_H
+#define _CRASH_H
+
+#include <stdint.h>
+#include <avr/wdt.h>
+
+// last_isr when it isn't known (built without ISRMON_TRACE).
+#define CRASH_NO_ISR            0xFF
+
+struct crash_record
+{
+    uint16_t magic;
+    uint16_t count;                 // watchdog resets recorded in EEPROM
+    uint16_t pc;                    // byte address, or 0 if not known
+    uint16_t sp;                    // stack pointer of the stuck code
+    uint16_t min_free;              // stack_min_free when it got stuck
+    uint8_t last_isr;               // isrmon_last, or CRASH_NO_ISR
+    uint8_t reset_cause;            // MCUSR after the reset
+};
+
+uint8_t crash_init (void);
+uint8_t crash_reset_cause (void);
+uint8_t crash_last (struct crash_record *record);
+void crash_clear (void);
+void crash_report (void);
+
+void crash_watchdog_start (uint8_t timeout);
+void crash_watchdog_feed (void);
+void crash_watchdog_stop (void);
+
+#endif // _CRASH_H
+
+/** vim: set ts=4 sw=4 et : */
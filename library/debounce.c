@@ -0,0 +1,319 @@
+/**
+ *  debounce.c
+ *
+ *  Button debouncing with vertical counters (see debounce.h). Each pin has
+ *  a two bit counter, bit 0 in ct0 and bit 1 in ct1, that counts samples
+ *  that differ from its debounced state, and is reset by a sample that
+ *  agrees. When it wraps round, after four differing samples in a row,
+ *  the debounced state changes.
+ */
+
+#include <avr/io.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "debounce.h"
+#include "pcint.h"
+#include "sched.h"
+#include "timer.h"
+
+/********************************************************************/
+
+#define NO_BUTTON                   0xFF
+
+struct button_group
+{
+    uint8_t mask;                   // pins that are buttons
+    uint8_t repeat;                 // buttons that repeat when held
+    uint8_t state;                  // debounced; 1 for pressed
+    uint8_t ct0;
+    uint8_t ct1;
+};
+
+static struct button_group groups [PCINT_PORTS];
+
+static volatile uint8_t * const port_registers [PCINT_PORTS] = {&PORTB, &PORTC, &PORTD};
+static volatile uint8_t * const ddr_registers [PCINT_PORTS] = {&DDRB, &DDRC, &DDRD};
+
+static sched_handler_t event_handler;
+static uint8_t event_priority;
+static struct timer sample_timer;
+
+// the last button pressed, while it's held: ms until its next long press
+// or repeat event, and whether the long press has been sent. Counting
+// down to each event, rather than up from the press, doesn't wrap however
+// long the button is held.
+static uint8_t held = NO_BUTTON;
+static uint16_t until_event;
+static uint8_t repeating;
+
+static void pins_changed (uint8_t port, uint8_t pins);
+static void start_sampling (uint16_t arg);
+static void sample (void *arg);
+static uint8_t sample_group (uint8_t port);
+static void time_held (void);
+static void post_events (uint8_t port, uint8_t buttons, uint8_t event);
+static void set_interrupts (uint8_t enable);
+
+/********************************************************************/
+
+/**
+ *  Set the handler that events are posted to, and their priority.
+ */
+    void
+debounce_init (handler, priority)
+    sched_handler_t handler;
+    uint8_t priority;
+{
+    event_handler = handler;
+    event_priority = priority;
+    timer_setup (&sample_timer, sample, NULL);
+}
+
+/********************************************************************/
+
+/**
+ *  Add the buttons on the pins in mask of port (PCINT_PORT_B, C or D),
+ *  after debounce_init. The pins are set to inputs with their pull-ups on.
+ *  Buttons in repeat give repeat events while they are held, after the
+ *  long press.
+ *
+ *  Returns 1, or 0 if no pin change handler could be attached.
+ */
+    uint8_t
+debounce_attach (port, mask, repeat)
+    uint8_t port;
+    uint8_t mask;
+    uint8_t repeat;
+{
+    struct button_group *group;
+
+    if (port >= PCINT_PORTS)
+        return 0;
+
+    group = &(groups [port]);
+    *(ddr_registers [port]) &= ~mask;
+    *(port_registers [port]) |= mask;
+
+    group->mask |= mask;
+    group->repeat = (group->repeat & ~mask) | (repeat & mask);
+    group->ct0 |= mask;
+    group->ct1 |= mask;
+
+    if (!pcint_attach (port, mask, pins_changed))
+        return 0;
+
+    // a button already pressed counts as a press.
+    start_sampling (0);
+
+    return 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the debounced state of the buttons on a port, with a 1 for each
+ *  button pressed.
+ */
+    uint8_t
+debounce_pressed (port)
+    uint8_t port;
+{
+    return groups [port].state;
+}
+
+/********************************************************************/
+
+/**
+ *  Pin change handler (ISR context): a button has started to move. Turn
+ *  the pin change interrupts off, and have the main loop sample the
+ *  buttons until they settle.
+ */
+    static void
+pins_changed (port, pins)
+    uint8_t port;
+    uint8_t pins;
+{
+    set_interrupts (0);
+    sched_post (SCHED_PRIORITY_HIGH, start_sampling, 0);
+}
+
+/********************************************************************/
+
+/**
+ *  Event handler: start the sample timer, if it isn't already running.
+ */
+    static void
+start_sampling (arg)
+    uint16_t arg;
+{
+    if (!timer_running (&sample_timer))
+        timer_start (&sample_timer, DEBOUNCE_PERIOD, DEBOUNCE_PERIOD);
+}
+
+/********************************************************************/
+
+/**
+ *  Sample timer callback: debounce all the buttons, and post the events.
+ *  Once all the buttons are released and settled, stop sampling, and wait
+ *  for a pin change.
+ */
+    static void
+sample (arg)
+    void *arg;
+{
+    uint8_t busy = 0;
+
+    for (uint8_t port = 0; port < PCINT_PORTS; port ++)
+    {
+        if (groups [port].mask != 0)
+            busy |= sample_group (port);
+    }
+
+    time_held ();
+
+    if (busy)
+        return;
+
+    timer_cancel (&sample_timer);
+    set_interrupts (1);
+
+    // a change just before the interrupts were turned on wouldn't raise
+    // one, so look again.
+    for (uint8_t port = 0; port < PCINT_PORTS; port ++)
+    {
+        if (~pcint_read (port) & groups [port].mask)
+        {
+            set_interrupts (0);
+            start_sampling (0);
+            break;
+        }
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Debounce the buttons on one port, and post the events for the ones that
+ *  have changed.
+ *
+ *  Returns non zero if any are pressed, or haven't settled yet.
+ */
+    static uint8_t
+sample_group (port)
+    uint8_t port;
+{
+    struct button_group *group = &(groups [port]);
+    uint8_t pressed = ~pcint_read (port) & group->mask;
+    uint8_t changed = group->state ^ pressed;
+
+    // count the buttons that differ, and reset the others' counters.
+    group->ct0 = ~(group->ct0 & changed);
+    group->ct1 = group->ct0 ^ (group->ct1 & changed);
+
+    // the buttons whose counters have wrapped round change state.
+    changed &= group->ct0 & group->ct1;
+    group->state ^= changed;
+
+    if (changed)
+    {
+        post_events (port, changed & group->state, DEBOUNCE_PRESS);
+        post_events (port, changed & ~group->state, DEBOUNCE_RELEASE);
+    }
+
+    return group->state | (group->state ^ pressed);
+}
+
+/********************************************************************/
+
+/**
+ *  Time the button being held, and post its long press and repeat events.
+ */
+    static void
+time_held (void)
+{
+    uint8_t port = held >> 3;
+    uint8_t pin = _BV (held & 0x07);
+
+    if (held == NO_BUTTON)
+        return;
+
+    if (until_event > DEBOUNCE_PERIOD)
+    {
+        until_event -= DEBOUNCE_PERIOD;
+        return;
+    }
+
+    if (repeating)
+        sched_post (event_priority, event_handler, (DEBOUNCE_REPEAT_PRESS << 8) | held);
+    else
+        sched_post (event_priority, event_handler, (DEBOUNCE_LONG_PRESS << 8) | held);
+
+    if (groups [port].repeat & pin)
+    {
+        until_event = DEBOUNCE_REPEAT;
+        repeating = 1;
+    }
+    else
+        held = NO_BUTTON;
+}
+
+/********************************************************************/
+
+/**
+ *  Post an event for each of the buttons on a port, and keep track of the
+ *  button being held.
+ */
+    static void
+post_events (port, buttons, event)
+    uint8_t port;
+    uint8_t buttons;
+    uint8_t event;
+{
+    uint8_t button;
+
+    for (uint8_t pin = 0; pin < 8; pin ++)
+    {
+        if (!(buttons & _BV (pin)))
+            continue;
+
+        button = (port << 3) | pin;
+        sched_post (event_priority, event_handler, ((uint16_t) event << 8) | button);
+
+        if (event == DEBOUNCE_PRESS)
+        {
+            held = button;
+            until_event = DEBOUNCE_LONG;
+            repeating = 0;
+        }
+        else if (button == held)
+        {
+            held = NO_BUTTON;
+        }
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Turn the pin change interrupts of all the buttons on or off.
+ */
+    static void
+set_interrupts (enable)
+    uint8_t enable;
+{
+    for (uint8_t port = 0; port < PCINT_PORTS; port ++)
+    {
+        if (groups [port].mask == 0)
+            continue;
+
+        if (enable)
+            pcint_enable (port, groups [port].mask);
+        else
+            pcint_disable (port, groups [port].mask);
+    }
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
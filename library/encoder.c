@@ -0,0 +1,297 @@
+/**
+ *  encoder.c
+ *
+ *  Quadrature decoding (see encoder.h). The last state of the two channels
+ *  and the new one make a 4 bit index into a table of transitions: +1 or
+ *  -1 for a move to a neighbouring state, and 0 for no change, or for an
+ *  impossible jump to the opposite state. The transitions are added up
+ *  until the encoder gets back to a detent, and then count as one detent
+ *  if they add up to enough of the way round.
+ *
+ *  The speed and acceleration need the system tick (tick_init).
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "encoder.h"
+#include "pcint.h"
+#include "tick.h"
+
+/********************************************************************/
+
+// the state with both contacts open (pulled up): the detent of encoders
+// with a whole cycle per detent, and one of two for half a cycle.
+#define STATE_OPEN                  0x03
+#define STATE_CLOSED                0x00
+
+static const int8_t transitions [16] =
+{
+//  new: 00  01  10  11
+         0, -1,  1,  0,     // old 00
+         1,  0,  0, -1,     // old 01
+        -1,  0,  0,  1,     // old 10
+         0,  1, -1,  0,     // old 11
+};
+
+static struct encoder *encoders [ENCODER_MAX];
+static uint8_t attached;
+
+static volatile uint8_t * const port_registers [PCINT_PORTS] = {&PORTB, &PORTC, &PORTD};
+static volatile uint8_t * const ddr_registers [PCINT_PORTS] = {&DDRB, &DDRC, &DDRD};
+
+static void pins_changed (uint8_t port, uint8_t pins);
+static int8_t detent (struct encoder *encoder);
+static void count_detent (struct encoder *encoder, int8_t step);
+static uint8_t read_state (struct encoder *encoder, uint8_t pins);
+
+/********************************************************************/
+
+/**
+ *  Attach an encoder with channels on the pins a and b (masks) of port
+ *  (PCINT_PORT_B, C or D), and its common pin to ground. The pins are set
+ *  to inputs with their pull-ups on. handler, if not NULL, is called in
+ *  ISR context on each detent.
+ *
+ *  Returns 1, or 0 if ENCODER_MAX encoders or PCINT_HANDLERS pin change
+ *  handlers are already attached.
+ */
+    uint8_t
+encoder_attach (encoder, port, a, b, steps, handler)
+    struct encoder *encoder;
+    uint8_t port;
+    uint8_t a;
+    uint8_t b;
+    uint8_t steps;
+    encoder_handler_t handler;
+{
+    uint8_t sreg;
+
+    if (port >= PCINT_PORTS || attached == ENCODER_MAX)
+        return 0;
+
+    *(ddr_registers [port]) &= ~(a | b);
+    *(port_registers [port]) |= a | b;
+
+    encoder->port = port;
+    encoder->a = a;
+    encoder->b = b;
+    encoder->steps = steps;
+    encoder->state = read_state (encoder, pcint_read (port));
+    encoder->transitions = 0;
+    encoder->direction = 0;
+    encoder->count = 0;
+    encoder->accelerated = 0;
+    encoder->last_detent = 0;
+    encoder->interval = 0xFFFF;
+    encoder->handler = handler;
+
+    if (!pcint_attach (port, a | b, pins_changed))
+        return 0;
+
+    sreg = SREG;
+    cli ();
+    encoders [attached ++] = encoder;
+    SREG = sreg;
+
+    return 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the detents turned since the last call (positive with A
+ *  leading B).
+ */
+    int16_t
+encoder_read (encoder)
+    struct encoder *encoder;
+{
+    int16_t count;
+    uint8_t sreg = SREG;
+
+    cli ();
+    count = encoder->count;
+    encoder->count = 0;
+    SREG = sreg;
+
+    return count;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the detents turned since the last call, with fast turns counting
+ *  extra: up to 13 per detent, when they come in quick succession. For
+ *  scrolling through a wide range of values.
+ */
+    int16_t
+encoder_read_accelerated (encoder)
+    struct encoder *encoder;
+{
+    int16_t count;
+    uint8_t sreg = SREG;
+
+    cli ();
+    count = encoder->accelerated;
+    encoder->accelerated = 0;
+    SREG = sreg;
+
+    return count;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the speed of the encoder in detents per second, from the time
+ *  between the last two detents, or 0 if it has stopped or changed
+ *  direction.
+ */
+    uint16_t
+encoder_speed (encoder)
+    struct encoder *encoder;
+{
+    uint16_t now = tick_millis ();
+    uint16_t last, interval;
+    uint8_t sreg = SREG;
+
+    cli ();
+    last = encoder->last_detent;
+    interval = encoder->interval;
+    SREG = sreg;
+
+    if ((uint16_t) (now - last) > ENCODER_IDLE || interval == 0xFFFF)
+        return 0;
+
+    return (interval == 0)? 1000 : 1000 / interval;
+}
+
+/********************************************************************/
+
+/**
+ *  Pin change handler (ISR context): decode the encoders on the port.
+ */
+    static void
+pins_changed (port, pins)
+    uint8_t port;
+    uint8_t pins;
+{
+    struct encoder *encoder;
+    uint8_t state;
+    int8_t step;
+
+    for (uint8_t i = 0; i < attached; i ++)
+    {
+        encoder = encoders [i];
+
+        if (encoder->port != port)
+            continue;
+
+        state = read_state (encoder, pins);
+
+        if (state == encoder->state)
+            continue;
+
+        encoder->transitions += transitions [(encoder->state << 2) | state];
+        encoder->state = state;
+
+        step = detent (encoder);
+
+        if (step != 0)
+            count_detent (encoder, step);
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  If the encoder has reached a detent, returns +1 or -1 if the
+ *  transitions since the last one add up to a step either way, and starts
+ *  counting again. Otherwise returns 0.
+ *
+ *  Half way is enough, so that a transition missed while the contacts
+ *  bounced doesn't lose a detent.
+ */
+    static int8_t
+detent (encoder)
+    struct encoder *encoder;
+{
+    int8_t count = encoder->transitions;
+
+    switch (encoder->steps)
+    {
+    case ENCODER_STEPS_4:
+        if (encoder->state != STATE_OPEN)
+            return 0;
+        break;
+
+    case ENCODER_STEPS_2:
+        if (encoder->state != STATE_OPEN && encoder->state != STATE_CLOSED)
+            return 0;
+        break;
+
+    default:
+        break;
+    }
+
+    encoder->transitions = 0;
+
+    if (count >= (int8_t) (encoder->steps + 1) / 2)
+        return 1;
+
+    if (count <= -(int8_t) (encoder->steps + 1) / 2)
+        return -1;
+
+    return 0;
+}
+
+/********************************************************************/
+
+/**
+ *  Count a detent, and work out the speed and acceleration.
+ */
+    static void
+count_detent (encoder, step)
+    struct encoder *encoder;
+    int8_t step;
+{
+    uint16_t now = tick_millis ();
+    uint16_t interval = now - encoder->last_detent;
+    uint8_t factor = 1;
+
+    // speed only builds up while turning the same way.
+    if (step != encoder->direction)
+        interval = 0xFFFF;
+
+    if (interval < ENCODER_ACCEL_SLOW)
+        factor += (ENCODER_ACCEL_SLOW - interval) >> ENCODER_ACCEL_SHIFT;
+
+    encoder->count += step;
+    encoder->accelerated += step * factor;
+    encoder->interval = interval;
+    encoder->last_detent = now;
+    encoder->direction = step;
+
+    if (encoder->handler != NULL)
+        encoder->handler (encoder, step);
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the state of an encoder's channels in pins: A in bit 1, and B
+ *  in bit 0.
+ */
+    static uint8_t
+read_state (encoder, pins)
+    struct encoder *encoder;
+    uint8_t pins;
+{
+    return ((pins & encoder->a)? 0x02 : 0x00) | ((pins & encoder->b)? 0x01 : 0x00);
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
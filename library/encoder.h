@@ -0,0 +1,69 @@
+/**
+ *  encoder.h
+ *
+ *  Declares functions for quadrature rotary encoders. Both channels of
+ *  each encoder raise pin change interrupts (see pcint.h), and the ISR
+ *  decodes every transition with a lookup table, so no steps are missed
+ *  however fast the knob is turned, and the main loop never waits for
+ *  contacts to settle. A contact bouncing between two states just counts
+ *  up and down again, and a transition that skips a state (both channels
+ *  changing at once) is ignored.
+ *
+ *  Encoders on the same port share its pin change interrupt. The count
+ *  goes up when channel A leads channel B.
+ */
+
+#ifndef _ENCODER_H
+#define _ENCODER_H
+
+#include <stdint.h>
+
+// encoders that can be attached.
+#define ENCODER_MAX             4
+
+// steps per detent (click): most mechanical encoders go through a whole
+// cycle of 4 transitions per detent, resting with both contacts open, and
+// some through half a cycle. Optical encoders have no detents; each
+// transition is counted.
+#define ENCODER_STEPS_1         1
+#define ENCODER_STEPS_2         2
+#define ENCODER_STEPS_4         4
+
+// acceleration: detents less than ENCODER_ACCEL_SLOW ms apart count extra,
+// one more for every 2^ENCODER_ACCEL_SHIFT ms faster.
+#define ENCODER_ACCEL_SLOW      96
+#define ENCODER_ACCEL_SHIFT     3
+
+// encoder_speed reports 0 after this many ms without a detent.
+#define ENCODER_IDLE            250
+
+struct encoder;
+
+// called in ISR context on each detent, with step +1 or -1.
+typedef void (*encoder_handler_t) (struct encoder *encoder, int8_t step);
+
+struct encoder
+{
+    uint8_t port;                   // PCINT_PORT_
+    uint8_t a;                      // pin masks
+    uint8_t b;
+    uint8_t steps;                  // ENCODER_STEPS_
+    uint8_t state;                  // last A and B, as bits 1 and 0
+    int8_t transitions;             // since the last detent
+    int8_t direction;               // of the last detent
+    volatile int16_t count;         // detents since encoder_read
+    volatile int16_t accelerated;   // since encoder_read_accelerated
+    uint16_t last_detent;           // tick_millis, low 16 bits
+    uint16_t interval;              // ms between the last two detents
+    encoder_handler_t handler;
+};
+
+uint8_t encoder_attach (struct encoder *encoder, uint8_t port, uint8_t a, uint8_t b,
+    uint8_t steps, encoder_handler_t handler);
+int16_t encoder_read (struct encoder *encoder);
+int16_t encoder_read_accelerated (struct encoder *encoder);
+uint16_t encoder_speed (struct encoder *encoder);
+
+#endif // _ENCODER_H
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,251 @@
+/**
+ *  filter.c
+ *
+ *  Integer digital filters: moving average, exponential moving average,
+ *  median and biquad. Each filter starts out settled at the first sample
+ *  it is given, rather than ramping up from zero.
+ *
+ *  See filter-eval/ for a host program that compares the filters on
+ *  captured ADC readings.
+ */
+
+#include <stdint.h>
+
+#include "filter.h"
+
+/********************************************************************/
+
+/**
+ *  Set up a moving average over 2^shift samples. The window must have room
+ *  for that many samples. shift is limited to FILTER_AVERAGE_SHIFT_MAX, so
+ *  the window length and position fit in 8 bits.
+ */
+    void
+filter_average_init (filter, window, shift)
+    struct filter_average *filter;
+    uint16_t *window;
+    uint8_t shift;
+{
+    filter->window = window;
+    filter->shift = (shift > FILTER_AVERAGE_SHIFT_MAX)? FILTER_AVERAGE_SHIFT_MAX : shift;
+    filter->index = 0;
+    filter->primed = 0;
+    filter->sum = 0;
+}
+
+/********************************************************************/
+
+/**
+ *  Add a sample, and return the average of the last 2^shift samples. The
+ *  oldest sample drops out of the running sum, so the cost doesn't depend
+ *  on the window length.
+ */
+    uint16_t
+filter_average_update (filter, sample)
+    struct filter_average *filter;
+    uint16_t sample;
+{
+    uint8_t length = 1 << filter->shift;
+
+    if (!filter->primed)
+    {
+        for (uint8_t i = 0; i < length; i ++)
+            filter->window [i] = sample;
+
+        filter->sum = (uint32_t) sample << filter->shift;
+        filter->primed = 1;
+    }
+
+    filter->sum -= filter->window [filter->index];
+    filter->sum += sample;
+    filter->window [filter->index] = sample;
+    filter->index = (filter->index + 1) & (length - 1);
+
+    return filter->sum >> filter->shift;
+}
+
+/********************************************************************/
+
+/**
+ *  Set up an exponential moving average. Each sample moves the output
+ *  1/2^shift of the way towards it; the time constant is about 2^shift
+ *  samples.
+ */
+    void
+filter_ema_init (filter, shift)
+    struct filter_ema *filter;
+    uint8_t shift;
+{
+    filter->state = 0;
+    filter->shift = shift;
+    filter->primed = 0;
+}
+
+/********************************************************************/
+
+    uint16_t
+filter_ema_update (filter, sample)
+    struct filter_ema *filter;
+    uint16_t sample;
+{
+    if (!filter->primed)
+    {
+        filter->state = (uint32_t) sample << filter->shift;
+        filter->primed = 1;
+    }
+
+    filter->state -= filter->state >> filter->shift;
+    filter->state += sample;
+
+    return filter->state >> filter->shift;
+}
+
+/********************************************************************/
+
+/**
+ *  Set up a median filter over length samples. Length should be odd, and
+ *  is limited to FILTER_MEDIAN_MAX.
+ */
+    void
+filter_median_init (filter, window, sorted, length)
+    struct filter_median *filter;
+    uint16_t *window;
+    uint16_t *sorted;
+    uint8_t length;
+{
+    filter->window = window;
+    filter->sorted = sorted;
+    filter->length = (length > FILTER_MEDIAN_MAX)? FILTER_MEDIAN_MAX : length;
+    filter->index = 0;
+    filter->primed = 0;
+}
+
+/********************************************************************/
+
+/**
+ *  Add a sample, and return the median of the last length samples. The
+ *  sorted copy is kept up to date by taking out the oldest sample and
+ *  inserting the new one, which is at most one pass over the window.
+ *  Unlike the averaging filters, single spikes don't get through at all.
+ */
+    uint16_t
+filter_median_update (filter, sample)
+    struct filter_median *filter;
+    uint16_t sample;
+{
+    uint16_t *sorted = filter->sorted;
+    uint8_t length = filter->length;
+    uint16_t oldest;
+    uint8_t i;
+
+    if (!filter->primed)
+    {
+        for (i = 0; i < length; i ++)
+        {
+            filter->window [i] = sample;
+            sorted [i] = sample;
+        }
+
+        filter->primed = 1;
+    }
+
+    oldest = filter->window [filter->index];
+    filter->window [filter->index] = sample;
+
+    if (++ filter->index == length)
+        filter->index = 0;
+
+    // find the oldest sample in the sorted array.
+    for (i = 0; sorted [i] != oldest; i ++)
+        ;
+
+    // slide entries into the gap until the new sample fits, from whichever
+    // side it belongs.
+    while (i > 0 && sorted [i - 1] > sample)
+    {
+        sorted [i] = sorted [i - 1];
+        i --;
+    }
+
+    while (i < length - 1 && sorted [i + 1] < sample)
+    {
+        sorted [i] = sorted [i + 1];
+        i ++;
+    }
+
+    sorted [i] = sample;
+
+    return sorted [length / 2];
+}
+
+/********************************************************************/
+
+/**
+ *  Set up a biquad with the given Q14 coefficients. Use FILTER_Q14 to
+ *  convert coefficients from a filter design tool, eg
+ *
+ *      filter_biquad_init (&filter, FILTER_Q14 (0.020083), FILTER_Q14 (0.040167),
+ *          FILTER_Q14 (0.020083), FILTER_Q14 (-1.561018), FILTER_Q14 (0.641352));
+ *
+ *  is a Butterworth low pass at 1/20 of the sample rate.
+ */
+    void
+filter_biquad_init (filter, b0, b1, b2, a1, a2)
+    struct filter_biquad *filter;
+    int16_t b0, b1, b2;
+    int16_t a1, a2;
+{
+    filter->b0 = b0;
+    filter->b1 = b1;
+    filter->b2 = b2;
+    filter->a1 = a1;
+    filter->a2 = a2;
+    filter->error = 0;
+    filter->primed = 0;
+}
+
+/********************************************************************/
+
+/**
+ *  Add a sample, and return the filter output. The part of the sum that is
+ *  shifted out is carried over to the next sample (first order noise
+ *  shaping), which stops the output from getting stuck short of the input
+ *  at low cut off frequencies.
+ */
+    uint16_t
+filter_biquad_update (filter, sample)
+    struct filter_biquad *filter;
+    uint16_t sample;
+{
+    int16_t x = sample;
+    int32_t sum;
+    int16_t y;
+
+    if (!filter->primed)
+    {
+        filter->x1 = filter->x2 = x;
+        filter->y1 = filter->y2 = x;
+        filter->primed = 1;
+    }
+
+    sum = filter->error;
+    sum += (int32_t) filter->b0 * x;
+    sum += (int32_t) filter->b1 * filter->x1;
+    sum += (int32_t) filter->b2 * filter->x2;
+    sum -= (int32_t) filter->a1 * filter->y1;
+    sum -= (int32_t) filter->a2 * filter->y2;
+
+    y = sum >> 14;
+    filter->error = sum & 0x3FFF;
+
+    filter->x2 = filter->x1;
+    filter->x1 = x;
+    filter->y2 = filter->y1;
+    filter->y1 = y;
+
+    return (y < 0)? 0 : y;
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
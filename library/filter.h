@@ -0,0 +1,93 @@
+/**
+ *  filter.h
+ *
+ *  Declares integer digital filters for smoothing sampled signals, eg ADC
+ *  readings. None of them divide or use floating point at run time, and
+ *  each update takes a bounded time, so they can be run from an ISR.
+ *
+ *  The caller allocates the state for each filter (and the sample window,
+ *  for filters that need one), and feeds it one sample at a time.
+ */
+
+#ifndef _FILTER_H
+#define _FILTER_H
+
+#include <stdint.h>
+
+// Moving average over the last 2^shift samples (shift at most
+// FILTER_AVERAGE_SHIFT_MAX), kept as a running sum.
+#define FILTER_AVERAGE_SHIFT_MAX    7
+
+struct filter_average
+{
+    uint16_t *window;
+    uint8_t shift;
+    uint8_t index;
+    uint8_t primed;
+    uint32_t sum;
+};
+
+// Exponential moving average: y += (x - y) / 2^shift. The state holds y
+// scaled up by 2^shift, so no resolution is lost to rounding. Inputs must
+// fit in 32 - shift bits.
+struct filter_ema
+{
+    uint32_t state;
+    uint8_t shift;
+    uint8_t primed;
+};
+
+// Median of the last length samples (odd, at most FILTER_MEDIAN_MAX). The
+// window holds the samples in arrival order, and sorted holds the same
+// samples in order of value; both have length entries.
+#define FILTER_MEDIAN_MAX       15
+
+struct filter_median
+{
+    uint16_t *window;
+    uint16_t *sorted;
+    uint8_t length;
+    uint8_t index;
+    uint8_t primed;
+};
+
+// Second order IIR section (direct form I), with coefficients in Q14 fixed
+// point (16384 is 1.0), as designed for a normalised a0 of 1:
+//
+//      y = b0 x + b1 x[-1] + b2 x[-2] - a1 y[-1] - a2 y[-2]
+//
+// Inputs must be no more than 13 bits, so that the sums don't overflow with
+// coefficients up to 2.0 in magnitude. The filter starts out settled at the
+// first sample, which assumes a DC gain of 1 (eg a low pass filter). For an
+// exact DC gain of 1 after rounding, b0 + b1 + b2 must equal 16384 + a1 + a2;
+// at low cut off frequencies, this needs coefficients to at least 6 decimal
+// places.
+#define FILTER_Q14(value)       ((int16_t) ((value) * 16384.0 + (((value) < 0)? -0.5 : 0.5)))
+
+struct filter_biquad
+{
+    int16_t b0, b1, b2;
+    int16_t a1, a2;
+    int16_t x1, x2;
+    int16_t y1, y2;
+    int16_t error;
+    uint8_t primed;
+};
+
+void filter_average_init (struct filter_average *filter, uint16_t *window, uint8_t shift);
+uint16_t filter_average_update (struct filter_average *filter, uint16_t sample);
+
+void filter_ema_init (struct filter_ema *filter, uint8_t shift);
+uint16_t filter_ema_update (struct filter_ema *filter, uint16_t sample);
+
+void filter_median_init (struct filter_median *filter, uint16_t *window,
+    uint16_t *sorted, uint8_t length);
+uint16_t filter_median_update (struct filter_median *filter, uint16_t sample);
+
+void filter_biquad_init (struct filter_biquad *filter, int16_t b0, int16_t b1,
+    int16_t b2, int16_t a1, int16_t a2);
+uint16_t filter_biquad_update (struct filter_biquad *filter, uint16_t sample);
+
+#endif // _FILTER_H
+
+/** vim: set ts=4 sw=4 et : */
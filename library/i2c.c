@@ -10,23 +10,50 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
+#include <avr/pgmspace.h>
 #include <stddef.h>
+#include <string.h>
 
 #include "i2c.h"
+#include "isrmon.h"
+#include "probe.h"
+#include "sleepctl.h"
 
 /********************************************************************/
 
-#define BUFFER_LENGTH 32
+// Queue items carry inline data and a completion callback, so the queue is
+// kept shorter than the UART's to save RAM.
+#define BUFFER_LENGTH 16
+
+// Slots that only urgent transfers may use: enough for a chained register
+// read and a write, as queued by the touch and port expander drivers.
+#define URGENT_RESERVE 3
 
 // Each I2C transfer must contain a device address, and the data to send.
 // For most devices, the first byte in the data packet specifies the register
 // number on the device that is to be written to.
+//
+// Short writes (up to I2C_INLINE_LENGTH bytes) are copied into the payload
+// array of the queue item itself, and the data pointer is set to point at the
+// payload. Longer transfers keep using the caller's buffer.
+//
+// The flags field holds the priority class of the transfer, and the CHAINED
+// bit (see below). enqueued_at records the bus tick count at the time the
+// item was queued, for the latency statistics.
+//
+// If callback is set, it is invoked from the TWI ISR once the transfer is
+// complete, with the given context pointer.
 struct i2c_queue_item
 {
     uint8_t device_address;
     uint8_t i2c_mode;
+    uint8_t flags;
     uint8_t *data;
     uint8_t length;
+    uint8_t payload [I2C_INLINE_LENGTH];
+    uint16_t enqueued_at;
+    i2c_callback_t callback;
+    void *context;
     struct i2c_queue_item *next;
 };
 
@@ -35,11 +62,68 @@ struct i2c_queue_item
 #define MASTER_TRANSMITTER_MODE 0x02
 #define MASTER_RECEIVER_MODE 0x04
 
+// bits in the flags field. A CHAINED item must be followed directly by the
+// next item in the same priority queue, without letting a transfer from
+// another class in between. This is used for register reads, where the write
+// of the register number and the read of the contents must stay together.
+//
+// A PREFIXED item sends payload [0] (the register number) before the bytes
+// from the data pointer. The flag is cleared once the prefix has been sent.
+#define PRIORITY_MASK           0x01
+#define PREFIXED                0x40
+#define CHAINED                 0x80
+#define NOT_CHAINED             0xFF
+
+
+// One queue per priority class. At each START, the ISR takes the next
+// transfer from the highest priority queue that isn't empty.
+struct i2c_queue
+{
+    struct i2c_queue_item *head;
+    struct i2c_queue_item *tail;
+};
 
 static struct i2c_queue_item i2c_buffer [BUFFER_LENGTH];
 
-static struct i2c_queue_item *queue_head;
-static struct i2c_queue_item *queue_tail;
+static struct i2c_queue queues [I2C_PRIORITY_CLASSES];
+
+// the transfer that currently owns the bus (NULL between transfers), whether
+// a START has been issued and not yet been followed by a STOP, and the class
+// that must supply the next transfer if the last one was chained.
+static struct i2c_queue_item *current;
+static volatile uint8_t bus_busy;
+static uint8_t chained_priority;
+
+// set while the callback of a transfer that was given up on is running.
+static uint8_t current_failed;
+
+// between i2c_begin_chain and i2c_end_chain, each item queued is chained to
+// the one queued before it. chain_sreg holds the interrupt state to restore
+// at the end of the chain.
+static struct i2c_queue_item *chain_last;
+static uint8_t chain_open;
+static uint8_t chain_sreg;
+
+// count of TWI interrupts, used as the time base for latency statistics. At
+// 100kHz, one tick is roughly one byte on the bus (about 90us).
+static uint16_t bus_ticks;
+static struct i2c_stats stats [I2C_PRIORITY_CLASSES];
+
+
+// Slave mode state. The register pointer is set by the first byte the host
+// writes, and advances after each byte read or written. slave_buffer holds
+// the snapshot being read by the host, or the bytes being written by the
+// host until the end of the write.
+static const struct i2c_region *slave_regions;
+static uint8_t slave_region_count;
+static i2c_slave_write_handler_t slave_write_handler;
+static volatile uint8_t slave_active;
+static uint8_t slave_register;
+static uint8_t slave_got_pointer;
+static uint8_t slave_write_start;
+static uint8_t slave_buffer [I2C_SLAVE_BUFFER_LENGTH];
+static uint8_t slave_buffer_index;
+static uint8_t slave_buffer_count;
 
 
 #define TWI_FREQ 100000L
@@ -47,11 +131,22 @@ static struct i2c_queue_item *queue_tail;
 
 /********************************************************************/
 
-static struct i2c_queue_item *allocate_queue_slot (void);
+static struct i2c_queue_item *allocate_queue_slot (uint8_t priority);
+static void prepare_slot (struct i2c_queue_item *slot, uint8_t device_address,
+    uint8_t i2c_mode, const uint8_t *data, unsigned int length, uint8_t flags);
 static void master_transmitter_handler (uint8_t status_code);
 static void master_receiver_handler (uint8_t status_code);
 static void enqueue (struct i2c_queue_item *item);
+static struct i2c_queue_item *next_transfer (void);
 static void dequeue (void);
+static void abandon_current (void);
+static void requeue_current (void);
+static void slave_handler (uint8_t status_code);
+static const struct i2c_region *find_region (uint8_t reg);
+static uint8_t read_map_byte (uint8_t reg);
+static void commit_slave_write (void);
+static void twi_interrupt (void);
+static void note_read_failure (void *context);
 
 /********************************************************************/
 
@@ -61,14 +156,30 @@ static void dequeue (void);
     void
 i2c_init (void)
 {
-    queue_head = NULL;
-    queue_tail = NULL;
+    for (uint8_t i = 0; i < I2C_PRIORITY_CLASSES; i ++)
+    {
+        queues [i].head = NULL;
+        queues [i].tail = NULL;
+    }
+
+    current = NULL;
+    bus_busy = 0;
+    chained_priority = NOT_CHAINED;
+    chain_last = NULL;
+    chain_open = 0;
+
+    slave_regions = NULL;
+    slave_region_count = 0;
+    slave_write_handler = NULL;
+    slave_active = 0;
 
     // step through all the slots in the buffer and mark them as free by
     // setting the i2c_mode to zero.
     for (int i = 0; i < BUFFER_LENGTH; i ++)
         i2c_buffer [i].i2c_mode = 0x00;
 
+    i2c_reset_stats ();
+
     // enable internal pull-up resistors on SDA & SCL lines.
     PORTC = 0x30;
 
@@ -80,39 +191,170 @@ i2c_init (void)
 
 /********************************************************************/
 
+/**
+ *  Send data to a specified destination over the I2C bus, in the bulk
+ *  priority class. See i2c_send_priority.
+ */
+    uint8_t
+i2c_send_to (device_address, data, length)
+    uint8_t device_address;     // 8 bit I2C device address
+    const uint8_t *data;        // data to send (one or more bytes)
+    unsigned int length;        // number of bytes to send
+{
+    return i2c_send_priority (device_address, data, length, I2C_PRIORITY_BULK);
+}
+
+/********************************************************************/
+
 /**
  *  Send data to a specified destination over the I2C bus.
  *
  *  Note that sending is asynchronous; this function will place the data in
  *  a queue of pending I2C transactions which will be executed when the I2C
- *  bus has finished any other read/writes.
+ *  bus has finished any other read/writes. Transfers within one priority
+ *  class go out in the order they were queued, but an urgent transfer will
+ *  be sent ahead of any bulk transfers that haven't started yet.
+ *
+ *  If the data is no longer than I2C_INLINE_LENGTH bytes, it is copied into
+ *  the queue item, and the caller is free to reuse the buffer as soon as this
+ *  function returns. Longer transfers are not copied, so the caller must take
+ *  care not to modify the data in the buffer before sending is complete. This
+ *  includes after this function returns; since the I2C bus speed is an order
+ *  of magnitude or two slower than the CPU clock speed.
  *
- *  This function does not copy the data to another buffer, so the caller
- *  must take care not to modify the data in the buffer before sending is
- *  complete. This includes after this function returns; since the I2C bus
- *  speed is an order of magnitude or two slower than the CPU clock speed.
+ *  This function may be called from an ISR. Returns 1 if the data was
+ *  queued, or 0 if the queue was full and nothing will be sent.
  */
-    void
-i2c_send_to (device_address, data, length)
+    uint8_t
+i2c_send_priority (device_address, data, length, priority)
     uint8_t device_address;     // 8 bit I2C device address
     const uint8_t *data;        // data to send (one or more bytes)
     unsigned int length;        // number of bytes to send
+    uint8_t priority;           // I2C_PRIORITY_URGENT or I2C_PRIORITY_BULK
 {
+    return i2c_send_async (device_address, data, length, priority, NULL, NULL);
+}
+
+/********************************************************************/
+
+/**
+ *  Send data as for i2c_send_priority, and invoke the callback (if not
+ *  NULL) from the TWI ISR once the data has been sent, or the transfer has
+ *  been given up on (see i2c_transfer_failed).
+ *
+ *  This function may be called from an ISR. Returns 1 if the data was
+ *  queued, or 0 if the queue was full (the callback will not be invoked).
+ */
+    uint8_t
+i2c_send_async (device_address, data, length, priority, callback, context)
+    uint8_t device_address;
+    const uint8_t *data;
+    unsigned int length;
+    uint8_t priority;
+    i2c_callback_t callback;
+    void *context;
+{
+    struct i2c_queue_item *buffer_slot;
+    uint8_t sreg = SREG;
+
+    // the queue is shared with the TWI ISR (and possibly other ISRs that
+    // send data), so interrupts are held off while we claim a slot.
+    cli ();
+
     // get a free slot from the buffer
-    struct i2c_queue_item *buffer_slot = allocate_queue_slot ();
+    buffer_slot = allocate_queue_slot (priority);
 
     // if the buffer is full, do nothing.
-    if (buffer_slot == NULL)
-        return;
+    if (buffer_slot != NULL)
+    {
+        prepare_slot (buffer_slot, device_address, MASTER_TRANSMITTER_MODE,
+            data, length, priority);
+        buffer_slot->callback = callback;
+        buffer_slot->context = context;
+        enqueue (buffer_slot);
+    }
 
-    // store the message details.
-    buffer_slot->device_address = device_address;
-    buffer_slot->data = (uint8_t *) data;
-    buffer_slot->length = length;
-    buffer_slot->i2c_mode = MASTER_TRANSMITTER_MODE;
-    buffer_slot->next = NULL;
+    SREG = sreg;
+    return (buffer_slot != NULL);
+}
 
-    enqueue (buffer_slot);
+/********************************************************************/
+
+/**
+ *  Write a single value to a register on the specified device. This is the
+ *  common case of a two byte write {register, value}; the bytes are stored
+ *  in the queue item, so nothing needs to stay in scope after the call.
+ *
+ *  This function may be called from an ISR. Returns 1 if the write was
+ *  queued, or 0 if the queue was full.
+ */
+    uint8_t
+i2c_write_register (device_address, device_register, value)
+    uint8_t device_address;
+    uint8_t device_register;
+    uint8_t value;
+{
+    uint8_t message [2];
+
+    message [0] = device_register;
+    message [1] = value;
+
+    return i2c_send_to (device_address, message, 2);
+}
+
+/********************************************************************/
+
+/**
+ *  Write values to a run of consecutive registers on the specified device,
+ *  starting from the specified register. The device must auto-increment its
+ *  register pointer after each byte.
+ *
+ *  If the register number and values fit in I2C_INLINE_LENGTH bytes, they
+ *  are copied into the queue. Otherwise only the register number is copied,
+ *  and the values are sent from the caller's buffer, which must stay valid
+ *  until the write has been sent.
+ *
+ *  This function may be called from an ISR. Returns 1 if the write was
+ *  queued, or 0 if the queue was full.
+ */
+    uint8_t
+i2c_write_registers (device_address, first_register, values, count)
+    uint8_t device_address;
+    uint8_t first_register;
+    const uint8_t *values;
+    unsigned int count;
+{
+    struct i2c_queue_item *buffer_slot;
+    uint8_t sreg = SREG;
+
+    cli ();
+
+    buffer_slot = allocate_queue_slot (I2C_PRIORITY_BULK);
+
+    if (buffer_slot != NULL)
+    {
+        if (count < I2C_INLINE_LENGTH)
+        {
+            // everything fits in the slot, so send it as one plain message.
+            prepare_slot (buffer_slot, device_address, MASTER_TRANSMITTER_MODE,
+                NULL, count + 1, I2C_PRIORITY_BULK);
+            buffer_slot->payload [0] = first_register;
+            memcpy (buffer_slot->payload + 1, values, count);
+        }
+        else
+        {
+            // long write: the register number goes in the slot, the values
+            // are sent straight from the caller's buffer.
+            prepare_slot (buffer_slot, device_address, MASTER_TRANSMITTER_MODE,
+                values, count, I2C_PRIORITY_BULK | PREFIXED);
+            buffer_slot->payload [0] = first_register;
+        }
+
+        enqueue (buffer_slot);
+    }
+
+    SREG = sreg;
+    return (buffer_slot != NULL);
 }
 
 /********************************************************************/
@@ -132,21 +374,192 @@ i2c_read_register (device_address, device_register)
     uint8_t device_address;
     uint8_t device_register;
 {
-    uint8_t register_contents;
-
-    // Set the remote device's register pointer to the register that we need
-    // to read from. (this call doesn't block)
-    i2c_send_to (device_address, &device_register, 1);
+    uint8_t register_contents = 0;
 
-    // Reading a single register works the same as reading multiple registers,
-    // except the count is 1. This call waits until the data is received.
-    i2c_receive_from (device_address, &register_contents, 1);
+    i2c_read_registers (device_address, device_register, &register_contents,
+        1, I2C_PRIORITY_BULK);
 
     return register_contents;
 }
 
 /********************************************************************/
 
+/**
+ *  Read a run of consecutive registers, starting from the specified register.
+ *
+ *  The write of the register number and the read are chained together, so
+ *  that no other transfer can get between them, even from a higher priority
+ *  class.
+ *
+ *  This function will put the MCU in a sleep mode until all of the bytes
+ *  have been received. If the queue doesn't have room for both transfers,
+ *  nothing is sent and the buffer is left unchanged.
+ *
+ *  Returns 1 if the registers were read, or 0 if the read couldn't be queued
+ *  or the device didn't answer, and the buffer wasn't filled in.
+ */
+    uint8_t
+i2c_read_registers (device_address, first_register, buffer, length, priority)
+    uint8_t device_address;
+    uint8_t first_register;
+    uint8_t *buffer;
+    unsigned int length;
+    uint8_t priority;
+{
+    struct i2c_queue_item *write_slot, *read_slot = NULL;
+    volatile uint8_t failed = 0;
+
+    cli ();
+
+    // claim both slots before queueing anything, so that we never send the
+    // register number without the read that goes with it.
+    write_slot = allocate_queue_slot (priority);
+
+    if (write_slot != NULL)
+    {
+        prepare_slot (write_slot, device_address, MASTER_TRANSMITTER_MODE,
+            &first_register, 1, priority | CHAINED);
+        read_slot = allocate_queue_slot (priority);
+    }
+
+    if (read_slot == NULL)
+    {
+        if (write_slot != NULL)
+            write_slot->i2c_mode = 0;
+
+        sei ();
+        return 0;
+    }
+
+    prepare_slot (read_slot, device_address, MASTER_RECEIVER_MODE, buffer,
+        length, priority);
+    read_slot->callback = note_read_failure;
+    read_slot->context = (void *) &failed;
+
+    enqueue (write_slot);
+    enqueue (read_slot);
+
+    // Sleep until all bytes are received.
+    while (read_slot->i2c_mode != 0)
+    {
+        sei ();
+        sleep_mode ();
+    }
+
+    return !failed;
+}
+
+/********************************************************************/
+
+/**
+ *  Start reading a run of consecutive registers, without waiting for the
+ *  data to arrive. The callback (if not NULL) is invoked from the TWI ISR
+ *  once the buffer has been filled, and is passed the context pointer.
+ *
+ *  As with i2c_read_registers, the write of the register number and the read
+ *  are chained together. The buffer must stay valid until the callback runs.
+ *
+ *  This function may be called from an ISR. Returns 0 if the queue didn't
+ *  have room for the transfers (the callback will not be invoked), or 1 if
+ *  the read was queued.
+ */
+    uint8_t
+i2c_read_registers_async (device_address, first_register, buffer, length,
+    priority, callback, context)
+    uint8_t device_address;
+    uint8_t first_register;
+    uint8_t *buffer;
+    unsigned int length;
+    uint8_t priority;
+    i2c_callback_t callback;
+    void *context;
+{
+    struct i2c_queue_item *write_slot, *read_slot = NULL;
+    uint8_t sreg = SREG;
+
+    cli ();
+
+    write_slot = allocate_queue_slot (priority);
+
+    if (write_slot != NULL)
+    {
+        prepare_slot (write_slot, device_address, MASTER_TRANSMITTER_MODE,
+            &first_register, 1, priority | CHAINED);
+        read_slot = allocate_queue_slot (priority);
+    }
+
+    if (read_slot == NULL)
+    {
+        if (write_slot != NULL)
+            write_slot->i2c_mode = 0;
+
+        SREG = sreg;
+        return 0;
+    }
+
+    prepare_slot (read_slot, device_address, MASTER_RECEIVER_MODE, buffer,
+        length, priority);
+    read_slot->callback = callback;
+    read_slot->context = context;
+
+    enqueue (write_slot);
+    enqueue (read_slot);
+
+    SREG = sreg;
+    return 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Called from a completion callback, returns 1 if the transfer was given
+ *  up on because the device didn't answer (the buffer of a read is then
+ *  left as it was), or 0 if it completed.
+ */
+    uint8_t
+i2c_transfer_failed (void)
+{
+    return current_failed;
+}
+
+/********************************************************************/
+
+/**
+ *  Start a chain of transfers. Every transfer queued until i2c_end_chain is
+ *  called goes out back to back, with no other transfer between them, eg a
+ *  read of an interrupt status register followed by the write that clears
+ *  it. All transfers in a chain must use the same priority class.
+ *
+ *  Interrupts are disabled until the end of the chain. Chains can't be
+ *  nested, and mustn't include the blocking read functions.
+ */
+    void
+i2c_begin_chain (void)
+{
+    uint8_t sreg = SREG;
+
+    cli ();
+    chain_sreg = sreg;
+    chain_open = 1;
+    chain_last = NULL;
+}
+
+/********************************************************************/
+
+/**
+ *  Finish the chain of transfers started by i2c_begin_chain, and restore the
+ *  interrupt state from before the chain.
+ */
+    void
+i2c_end_chain (void)
+{
+    chain_open = 0;
+    chain_last = NULL;
+    SREG = chain_sreg;
+}
+
+/********************************************************************/
+
 /**
  *  Fetch the values from many registers in sequence.
  *
@@ -163,20 +576,23 @@ i2c_receive_from (device_address, buffer, length)
     uint8_t *buffer;
     unsigned int length;
 {
+    struct i2c_queue_item *buffer_slot;
+
+    cli ();
+
     // get a free slot from the buffer
-    struct i2c_queue_item *buffer_slot = allocate_queue_slot ();
+    buffer_slot = allocate_queue_slot (I2C_PRIORITY_BULK);
 
     // if the buffer is full, do nothing.
     if (buffer_slot == NULL)
+    {
+        sei ();
         return;
+    }
 
     // store the message details.
-    buffer_slot->device_address = device_address;
-    buffer_slot->data = buffer;
-    buffer_slot->length = length;
-    buffer_slot->i2c_mode = MASTER_RECEIVER_MODE;
-    buffer_slot->next = NULL;
-
+    prepare_slot (buffer_slot, device_address, MASTER_RECEIVER_MODE, buffer,
+        length, I2C_PRIORITY_BULK);
     enqueue (buffer_slot);
 
     // Sleep until all bytes are received.
@@ -190,59 +606,577 @@ i2c_receive_from (device_address, buffer, length)
 /********************************************************************/
 
 /**
- *  Append the given queue structure as the new tail of the queue. If the
- *  queue is empty, the item also becomes the queue head.
+ *  Respond to the specified address as an I2C slave, in addition to acting
+ *  as a bus master. The host sees a register map made up of the given
+ *  regions; each region covers a range of register numbers, backed either
+ *  by RAM or by flash (I2C_REGION_FLASH). Registers outside all regions read
+ *  as 0xFF and ignore writes. The regions array must stay valid while slave
+ *  mode is in use.
  *
- *  If the queue is empty, this function will also set the control register
+ *  The host writes the register number as the first byte of a write. Any
+ *  further bytes are written to consecutive registers, and a read starts
+ *  from the register after the last one written or read. Only RAM regions
+ *  with I2C_REGION_WRITABLE set accept writes.
+ *
+ *  Multi-byte values are seen atomically by both sides, up to
+ *  I2C_SLAVE_BUFFER_LENGTH bytes per transfer: a read returns a snapshot of
+ *  the registers taken when the host addressed us, and a write is held back
+ *  and applied in one go when the host ends the transfer. The application
+ *  should change RAM regions with i2c_slave_update (or with interrupts
+ *  disabled).
+ *
+ *  i2c_init must be called first.
+ */
+    void
+i2c_slave_init (own_address, regions, region_count)
+    uint8_t own_address;                // 7 bit slave address
+    const struct i2c_region *regions;
+    uint8_t region_count;
+{
+    uint8_t sreg = SREG;
+
+    cli ();
+
+    slave_regions = regions;
+    slave_region_count = region_count;
+    slave_register = 0;
+    slave_active = 0;
+
+    // general call recognition stays off.
+    TWAR = own_address << 1;
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Set the function to call (from the TWI ISR) after the host has written
+ *  to the register map. It is passed the first register written and the
+ *  number of bytes.
+ */
+    void
+i2c_slave_set_write_handler (handler)
+    i2c_slave_write_handler_t handler;
+{
+    uint8_t sreg = SREG;
+
+    cli ();
+    slave_write_handler = handler;
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Copy new values into RAM backed registers, as one atomic update as far
+ *  as the host is concerned. Registers outside the RAM regions are skipped.
+ */
+    void
+i2c_slave_update (first_register, values, length)
+    uint8_t first_register;
+    const void *values;
+    uint8_t length;
+{
+    const uint8_t *source = values;
+    const struct i2c_region *region;
+    uint8_t sreg = SREG;
+
+    cli ();
+
+    for (uint8_t i = 0; i < length; i ++)
+    {
+        region = find_region (first_register + i);
+
+        if (region != NULL && (region->flags & I2C_REGION_FLASH) == 0)
+            ((uint8_t *) region->data) [first_register + i - region->first_register] = source [i];
+    }
+
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Copy the latency statistics for the given priority class. Latency is the
+ *  time a transfer spent waiting in the queue before it got the bus, counted
+ *  in TWI interrupts (roughly one byte time each).
+ */
+    void
+i2c_get_stats (priority, result)
+    uint8_t priority;
+    struct i2c_stats *result;
+{
+    uint8_t sreg = SREG;
+
+    cli ();
+    *result = stats [priority & PRIORITY_MASK];
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Clear the latency statistics for all priority classes.
+ */
+    void
+i2c_reset_stats (void)
+{
+    uint8_t sreg = SREG;
+
+    cli ();
+    memset (stats, 0, sizeof (stats));
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Fill in the details of a transfer in a slot returned from
+ *  allocate_queue_slot, and mark the slot as in use. Short transmit data is
+ *  copied into the slot so that the caller's buffer can be reused straight
+ *  away.
+ *
+ *  Must be called with interrupts disabled.
+ */
+    static void
+prepare_slot (slot, device_address, i2c_mode, data, length, flags)
+    struct i2c_queue_item *slot;
+    uint8_t device_address;
+    uint8_t i2c_mode;
+    const uint8_t *data;
+    unsigned int length;
+    uint8_t flags;
+{
+    slot->device_address = device_address;
+    slot->i2c_mode = i2c_mode;
+    slot->flags = flags;
+    slot->length = length;
+    slot->callback = NULL;
+    slot->context = NULL;
+    slot->next = NULL;
+
+    if (i2c_mode == MASTER_TRANSMITTER_MODE && length <= I2C_INLINE_LENGTH
+        && !(flags & PREFIXED))
+    {
+        // a NULL data pointer means the caller fills in the payload itself.
+        if (data != NULL)
+            memcpy (slot->payload, data, length);
+
+        slot->data = slot->payload;
+    }
+    else
+    {
+        slot->data = (uint8_t *) data;
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Append the given queue structure as the new tail of the queue for its
+ *  priority class. If the queue is empty, the item also becomes the queue
+ *  head.
+ *
+ *  If the bus is idle, this function will also set the control register
  *  to send the START signal.
+ *
+ *  Must be called with interrupts disabled.
  */
     static void
 enqueue (item)
     struct i2c_queue_item *item;
 {
-    if (queue_tail == NULL)
+    struct i2c_queue *queue = &(queues [item->flags & PRIORITY_MASK]);
+
+    item->enqueued_at = bus_ticks;
+
+    // inside a chain, link the previous item to this one. Items that chain
+    // themselves (register reads) carry on the chain from their last item.
+    if (chain_open)
     {
-        queue_head = item;
-        queue_tail = item;
-        TWCR = _BV (TWEN) | _BV (TWIE) | _BV (TWEA) | _BV (TWINT) | _BV (TWSTA);
+        if (chain_last != NULL)
+            chain_last->flags |= CHAINED;
+
+        chain_last = item;
+    }
+
+    if (queue->tail == NULL)
+    {
+        queue->head = item;
+        queue->tail = item;
     }
     else
     {
-        queue_tail->next = item;
-        queue_tail = item;
+        queue->tail->next = item;
+        queue->tail = item;
+    }
+
+    // If the bus is idle, send a START. While we are being addressed as a
+    // slave (or a slave event is waiting to be handled) the START is left
+    // for the ISR to send once the slave transfer is over.
+    if (!bus_busy)
+    {
+        // a master transfer needs the I/O clock for the bit rate generator,
+        // until the STOP has gone out.
+        bus_busy = 1;
+        sleepctl_lock (SLEEPCTL_IDLE);
+
+        if (!slave_active && (TWCR & _BV (TWINT)) == 0)
+            TWCR = _BV (TWEN) | _BV (TWIE) | _BV (TWEA) | _BV (TWINT) | _BV (TWSTA);
     }
 }
 
 /********************************************************************/
 
 /**
- *  Remove the item at the head of the queue, and point the head to the next
- *  item if available.
+ *  Take the transfer that should go out after a START from the front of its
+ *  queue. This is the head of the queue that the previous transfer was
+ *  chained to if there is one, otherwise the head of the highest priority
+ *  queue that isn't empty.
+ *
+ *  Returns NULL if all of the queues are empty.
+ */
+    static struct i2c_queue_item *
+next_transfer (void)
+{
+    struct i2c_queue *queue = NULL;
+    struct i2c_queue_item *item;
+    struct i2c_stats *class_stats;
+    uint16_t latency;
+
+    if (chained_priority != NOT_CHAINED)
+    {
+        queue = &(queues [chained_priority]);
+        chained_priority = NOT_CHAINED;
+    }
+    else
+    {
+        // lower numbers are more urgent.
+        for (uint8_t i = 0; i < I2C_PRIORITY_CLASSES; i ++)
+        {
+            if (queues [i].head != NULL)
+            {
+                queue = &(queues [i]);
+                break;
+            }
+        }
+    }
+
+    if (queue == NULL || queue->head == NULL)
+        return NULL;
+
+    item = queue->head;
+    queue->head = item->next;
+
+    if (queue->head == NULL)
+        queue->tail = NULL;
+
+    // record how long the item waited for the bus.
+    latency = bus_ticks - item->enqueued_at;
+    class_stats = &(stats [item->flags & PRIORITY_MASK]);
+    class_stats->transactions ++;
+    class_stats->total_latency += latency;
+
+    if (latency > class_stats->max_latency)
+        class_stats->max_latency = latency;
+
+    return item;
+}
+
+/********************************************************************/
+
+/**
+ *  Finish with the transfer that currently owns the bus, and release its
+ *  slot.
+ *
+ *  If the transfer has a completion callback, it is invoked here (in ISR
+ *  context).
  *
- *  If the head is the last item in the queue, both the head and tail will
- *  be set to NULL, and this function will also set the control register to
- *  send a STOP signal.
+ *  If there are more transfers waiting in any of the queues, this function
+ *  sends a REPEAT START, and the next transfer is picked when the START has
+ *  gone out. If all queues are empty, this function will set the control
+ *  register to send a STOP signal.
  */
     static void
 dequeue (void)
 {
-    // de-allocate the item at the head of the queue, by setting the i2c_mode
+    i2c_callback_t callback = current->callback;
+    void *context = current->context;
+
+    // remember which queue must supply the next transfer, if this one was
+    // chained to it.
+    if (current->flags & CHAINED)
+        chained_priority = current->flags & PRIORITY_MASK;
+
+    // de-allocate the item that owns the bus, by setting the i2c_mode
     // field to 0.
-    queue_head->i2c_mode = 0;
-    queue_head = queue_head->next;
+    current->i2c_mode = 0;
+    current = NULL;
+
+    // let the caller know the transfer is done. This happens before we
+    // decide between REPEAT START and STOP, so that anything the callback
+    // queues is sent without releasing the bus.
+    if (callback != NULL)
+        callback (context);
 
     // if there's another item to transmit, send REPEAT START. If
     // there's no other item, send STOP.
-    if (queue_head == NULL)
+    for (uint8_t i = 0; i < I2C_PRIORITY_CLASSES; i ++)
     {
-        // queue is empty, so mark tail as null too and send the STOP signal
-        queue_tail = NULL;
-        TWCR = _BV (TWEN) | _BV (TWIE) | _BV (TWEA) | _BV (TWINT) | _BV (TWSTO);
+        if (queues [i].head != NULL)
+        {
+            // send REPEAT START signal.
+            TWCR = _BV (TWEN) | _BV (TWIE) | _BV (TWEA) | _BV (TWINT) | _BV (TWSTA) | _BV (TWSTO);
+            return;
+        }
+    }
+
+    // all queues are empty, so release the bus with the STOP signal
+    bus_busy = 0;
+    sleepctl_unlock (SLEEPCTL_IDLE);
+    chained_priority = NOT_CHAINED;
+    TWCR = _BV (TWEN) | _BV (TWIE) | _BV (TWEA) | _BV (TWINT) | _BV (TWSTO);
+}
+
+/********************************************************************/
+
+/**
+ *  Finish with the transfer that owns the bus without sending the rest of
+ *  it, because the device didn't answer, and count the failure against its
+ *  priority class. Completion callbacks are still invoked, and can tell
+ *  with i2c_transfer_failed.
+ */
+    static void
+abandon_current (void)
+{
+    stats [current->flags & PRIORITY_MASK].failures ++;
+    current_failed = 1;
+    dequeue ();
+    current_failed = 0;
+}
+
+/********************************************************************/
+
+/**
+ *  Completion callback of a blocking read: tell the reader, through the
+ *  flag in context, if the device didn't answer.
+ */
+    static void
+note_read_failure (context)
+    void *context;
+{
+    if (current_failed)
+        *(volatile uint8_t *) context = 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Put the transfer that owned the bus back at the front of its queue, after
+ *  we lost arbitration to another master. It will be retried from the next
+ *  START. Arbitration is normally lost during the address byte; if it is
+ *  lost part way through the data, the retry carries on from that point.
+ */
+    static void
+requeue_current (void)
+{
+    struct i2c_queue *queue;
+
+    if (current == NULL)
+        return;
+
+    queue = &(queues [current->flags & PRIORITY_MASK]);
+    current->next = queue->head;
+    queue->head = current;
+
+    if (queue->tail == NULL)
+        queue->tail = current;
+
+    current = NULL;
+}
+
+/********************************************************************/
+
+/**
+ *  Find the slave register map region containing the given register, or
+ *  NULL if it isn't mapped.
+ */
+    static const struct i2c_region *
+find_region (reg)
+    uint8_t reg;
+{
+    for (uint8_t i = 0; i < slave_region_count; i ++)
+    {
+        if (reg >= slave_regions [i].first_register &&
+                reg - slave_regions [i].first_register < slave_regions [i].length)
+            return &(slave_regions [i]);
+    }
+
+    return NULL;
+}
+
+/********************************************************************/
+
+/**
+ *  Read one register from the slave register map, from RAM or flash.
+ */
+    static uint8_t
+read_map_byte (reg)
+    uint8_t reg;
+{
+    const struct i2c_region *region = find_region (reg);
+    const uint8_t *address;
+
+    if (region == NULL)
+        return 0xFF;
+
+    address = (const uint8_t *) region->data + (reg - region->first_register);
+
+    if (region->flags & I2C_REGION_FLASH)
+        return pgm_read_byte (address);
+
+    return *address;
+}
+
+/********************************************************************/
+
+/**
+ *  Apply the bytes written by the host to the register map, now that the
+ *  write has finished, and let the application know.
+ */
+    static void
+commit_slave_write (void)
+{
+    const struct i2c_region *region;
+    uint8_t reg;
+
+    if (slave_buffer_count == 0)
+        return;
+
+    for (uint8_t i = 0; i < slave_buffer_count; i ++)
+    {
+        reg = slave_write_start + i;
+        region = find_region (reg);
+
+        if (region != NULL && (region->flags & I2C_REGION_WRITABLE) &&
+                (region->flags & I2C_REGION_FLASH) == 0)
+            ((uint8_t *) region->data) [reg - region->first_register] = slave_buffer [i];
+    }
+
+    if (slave_write_handler != NULL)
+        slave_write_handler (slave_write_start, slave_buffer_count);
+
+    slave_buffer_count = 0;
+}
+
+/********************************************************************/
+
+/**
+ *  Handle TWI events in slave receiver and slave transmitter modes (status
+ *  codes 0x60 and up).
+ */
+    static void
+slave_handler (status_code)
+    uint8_t status_code;
+{
+    uint8_t ack = _BV (TWEA);
+    uint8_t finished = 0;
+
+    switch (status_code)
+    {
+    case 0x68:
+        // we lost arbitration as master, and were addressed for writing by
+        // the master that won. Retry our transfer once the bus is free.
+        requeue_current ();
+
+        // fall through
+
+    case 0x60:
+        // own address + write received and ACK returned. The first data byte
+        // will be the register pointer.
+        slave_active = 1;
+        slave_got_pointer = 0;
+        slave_buffer_count = 0;
+        break;
+
+    case 0x80:
+        // data byte received and ACK returned.
+        if (!slave_got_pointer)
+        {
+            slave_register = TWDR;
+            slave_write_start = slave_register;
+            slave_got_pointer = 1;
+        }
+        else
+        {
+            slave_buffer [slave_buffer_count ++] = TWDR;
+            slave_register ++;
+        }
+
+        // NACK the next byte if there is no room left for it.
+        if (slave_buffer_count >= I2C_SLAVE_BUFFER_LENGTH)
+            ack = 0x00;
+
+        break;
+
+    case 0x88:
+        // data byte received and NACK returned, because the buffer is full.
+        // The byte is dropped, and the write is finished.
+    case 0xA0:
+        // STOP or REPEAT START received while addressed as a slave.
+        commit_slave_write ();
+        finished = 1;
+        break;
+
+    case 0xB0:
+        // we lost arbitration as master, and were addressed for reading.
+        requeue_current ();
+
+        // fall through
+
+    case 0xA8:
+        // own address + read received and ACK returned. Take a snapshot of
+        // the registers from the register pointer on, so that multi-byte
+        // values can't change part way through the read.
+        slave_active = 1;
+
+        for (uint8_t i = 0; i < I2C_SLAVE_BUFFER_LENGTH; i ++)
+            slave_buffer [i] = read_map_byte (slave_register + i);
+
+        slave_buffer_index = 0;
+
+        // fall through
+
+    case 0xB8:
+        // data byte transmitted and ACK received; load the next one. Past
+        // the end of the snapshot, registers are read live.
+        TWDR = (slave_buffer_index < I2C_SLAVE_BUFFER_LENGTH)?
+            slave_buffer [slave_buffer_index ++] : read_map_byte (slave_register);
+        slave_register ++;
+        break;
+
+    case 0xC0:
+    case 0xC8:
+        // data byte transmitted, and NACK received (the host has read all it
+        // wants), or the last byte was sent. The transfer is over.
+    default:
+        // general call status codes; general call recognition is disabled,
+        // so these shouldn't happen.
+        finished = 1;
+        break;
+    }
+
+    if (finished)
+    {
+        // Switch back to not addressed slave mode. If master transfers were
+        // queued while we were busy, ask for a START when the bus is free.
+        slave_active = 0;
+        TWCR = _BV (TWEN) | _BV (TWIE) | _BV (TWEA) | _BV (TWINT) |
+            ((bus_busy && current == NULL)? _BV (TWSTA) : 0x00);
     }
     else
     {
-        // send REPEAT START signal.
-        TWCR = _BV (TWEN) | _BV (TWIE) | _BV (TWEA) | _BV (TWINT) | _BV (TWSTA) | _BV (TWSTO);
+        TWCR = _BV (TWEN) | _BV (TWIE) | _BV (TWINT) | ack;
     }
 }
 
@@ -254,23 +1188,36 @@ dequeue (void)
  *  Used slots are identified based on the i2c_mode field being set to either
  *  master transmitter or master receiver. If the mode is set to zero, the
  *  slot is available. If the buffer is full, this function will return NULL
+ *
+ *  The last URGENT_RESERVE free slots are kept for the urgent class, so that
+ *  a backlog of bulk transfers can't stop an interrupt handler from queueing
+ *  its transfers.
+ *
+ *  Must be called with interrupts disabled.
  */
     struct i2c_queue_item *
-allocate_queue_slot (void)
+allocate_queue_slot (priority)
+    uint8_t priority;
 {
     struct i2c_queue_item *found_slot = NULL;
+    uint8_t free_slots = 0;
 
     // iterate through the array and find a slot with the i2c_mode set to
-    // zero.
+    // zero, counting the free slots as we go.
     for (int i = 0; i < BUFFER_LENGTH; i ++)
     {
         if (i2c_buffer [i].i2c_mode == 0x00)
         {
-            found_slot = &(i2c_buffer [i]);
-            break;
+            if (found_slot == NULL)
+                found_slot = &(i2c_buffer [i]);
+
+            free_slots ++;
         }
     }
 
+    if ((priority & PRIORITY_MASK) != I2C_PRIORITY_URGENT && free_slots <= URGENT_RESERVE)
+        return NULL;
+
     return found_slot;
 }
 
@@ -293,12 +1240,20 @@ master_transmitter_handler (status_code)
     case 0x30:
         // data has been transmitted and either ACK (0x28) or NOT ACK (0x30)
         // has been received. Move on to the next byte to be transmitted (if
-        // available).
-        queue_head->data ++;
-        queue_head->length --;
+        // available). If the byte just sent was the register number prefix,
+        // the data pointer hasn't been used yet.
+        if (current->flags & PREFIXED)
+        {
+            current->flags &= ~PREFIXED;
+        }
+        else
+        {
+            current->data ++;
+            current->length --;
+        }
 
         // if the data length is zero, move the queue head along the list.
-        if (queue_head->length == 0)
+        if (current->length == 0)
         {
             dequeue ();
             break;
@@ -308,15 +1263,19 @@ master_transmitter_handler (status_code)
         // through to send the next byte.
 
     case 0x18:
-    case 0x20:
         // slave address + write has been transmitted and ACK received. load
         // data byte into TWDR.
-        // TODO: 0x20 indicates that NOT ACK was received, should this be
-        // considered an error?
-        TWDR = *(queue_head->data);
+        TWDR = (current->flags & PREFIXED)? current->payload [0] : *(current->data);
         TWCR = _BV (TWEN) | _BV (TWIE) | _BV (TWINT) | _BV (TWEA);
         break;
 
+    case 0x20:
+        // slave address + write has been transmitted and NOT ACK received.
+        // Nothing answered at that address (missing device, or an EEPROM
+        // busy with a write cycle), so give up on the transfer.
+        abandon_current ();
+        break;
+
     case 0x38:
         // Arbitration lost. This can only happen if there is another device
         // trying to become master on the I2C bus, and is not applicable to
@@ -347,12 +1306,12 @@ master_receiver_handler (status_code)
     case 0x50:
         // data byte has been received, ACK has been returned. We need to
         // fetch the data from TWDR.
-        *(queue_head->data) = TWDR;
+        *(current->data) = TWDR;
 
         // move the pointer to the next data slot, and reduce the length to
         // read.
-        queue_head->data ++;
-        queue_head->length --;
+        current->data ++;
+        current->length --;
 
         //
         // fall through to decide whether to send an ACK or NACK, depending
@@ -363,7 +1322,7 @@ master_receiver_handler (status_code)
         // slave address + read has been transmitted, and ACK received. Next
         // action is to set the TWEA bit to send either ACK or NACK after we
         // receive the data byte; ACK if we want to keep receiving more data.
-        ack = (queue_head->length > 1)? _BV (TWEA) : 0x00;
+        ack = (current->length > 1)? _BV (TWEA) : 0x00;
         TWCR = _BV (TWINT) | _BV (TWEN) | _BV (TWIE) | ack;
         break;
 
@@ -371,18 +1330,21 @@ master_receiver_handler (status_code)
         // data byte has been received, NACK returned. This is the last data
         // byte we want to receive (hopefully). Fetch the data from TWDR and
         // advance the queue to the next item.
-        *(queue_head->data) = TWDR;
+        *(current->data) = TWDR;
         dequeue ();
         break;
 
-    case 0x38:
-        // Arbitration lost. This shouldn't happen since the MCU should be
-        // the only master on the I2C bus.
-
     case 0x48:
         // NACK received after slave address + read transmitted. This most
         // likely indicates connectivity problems (broken wire etc) or
-        // something else that means the slave isn't available.
+        // something else that means the slave isn't available. Give up on
+        // the transfer; the buffer is left as it was.
+        abandon_current ();
+        break;
+
+    case 0x38:
+        // Arbitration lost. This shouldn't happen since the MCU should be
+        // the only master on the I2C bus.
 
     default:
         // This should never be reached, as the above cases cover all of the
@@ -398,31 +1360,87 @@ master_receiver_handler (status_code)
  *  events, as set out in the datasheet (eg sent start signal, sent data).
  */
 ISR (TWI_vect)
+{
+    ISRMON_ENTER (ISRMON_TWI);
+    PROBE_BEGIN (PROBE_TWI);
+    twi_interrupt ();
+    PROBE_END (PROBE_TWI);
+    ISRMON_EXIT (ISRMON_TWI);
+}
+
+/********************************************************************/
+
+/**
+ *  Handle a TWI status change (ISR context).
+ */
+    static void
+twi_interrupt (void)
 {
     uint8_t status_code = TWSR & 0xF8;
 
-    // check that the queue head is available (if not, ignore the interrupt)
-    if (queue_head == NULL)
+    bus_ticks ++;
+
+    // status codes from 0x60 up are for slave modes.
+    if (status_code >= 0x60)
     {
-        TWCR |= _BV (TWINT);
+        slave_handler (status_code);
+        return;
+    }
+
+    // Arbitration lost to another master: put our transfer back in the
+    // queue, and send START again as soon as the bus is free.
+    if (status_code == 0x38)
+    {
+        requeue_current ();
+        TWCR = _BV (TWEN) | _BV (TWIE) | _BV (TWEA) | _BV (TWINT) | _BV (TWSTA);
+        return;
+    }
+
+    // Bus error (illegal START or STOP). Release the bus, and start again if
+    // there is anything to send.
+    if (status_code == 0x00)
+    {
+        requeue_current ();
+        slave_active = 0;
+        TWCR = _BV (TWEN) | _BV (TWIE) | _BV (TWEA) | _BV (TWINT) | _BV (TWSTO) |
+            (bus_busy? _BV (TWSTA) : 0x00);
         return;
     }
 
     // check the status code. If it's 0x08 or 0x10, indicating START or
-    // REPEAT START completed, next step is to send the slave address plus
-    // read/write bit depending on the operation. Handled here to avoid
-    // duplicating the code.
+    // REPEAT START completed, this is where we pick the next transfer to go
+    // out. Next step is to send the slave address plus read/write bit
+    // depending on the operation. Handled here to avoid duplicating the code.
     if (status_code == 0x08 || status_code == 0x10)
     {
-        TWDR = (queue_head->device_address << 1) |
-            ((queue_head->i2c_mode == MASTER_RECEIVER_MODE)? 0x01 : 0x00);
+        current = next_transfer ();
+
+        if (current == NULL)
+        {
+            // nothing left to send (should not happen, since a START is only
+            // sent when something is queued). Release the bus.
+            bus_busy = 0;
+            sleepctl_unlock (SLEEPCTL_IDLE);
+            TWCR = _BV (TWEN) | _BV (TWIE) | _BV (TWEA) | _BV (TWINT) | _BV (TWSTO);
+            return;
+        }
+
+        TWDR = (current->device_address << 1) |
+            ((current->i2c_mode == MASTER_RECEIVER_MODE)? 0x01 : 0x00);
         TWCR = _BV (TWEN) | _BV (TWIE) | _BV (TWINT) | _BV (TWEA);
         return;
     }
 
+    // check that a transfer owns the bus (if not, ignore the interrupt)
+    if (current == NULL)
+    {
+        TWCR |= _BV (TWINT);
+        return;
+    }
+
     // check the I2C mode of the queue head, and dispatch to the corresponding
     // function
-    switch (queue_head->i2c_mode)
+    switch (current->i2c_mode)
     {
     case MASTER_TRANSMITTER_MODE:
         master_transmitter_handler (status_code);
@@ -8,6 +8,7 @@
 #include <util/delay.h>
 
 #include "lcd.h"
+#include "probe.h"
 #include "vectors.h"
 
 /********************************************************************/
@@ -66,19 +67,23 @@ static const uint8_t ili9488_init_cmds [] = {
     void
 lcd_init (void)
 {
-    // Set the DCX pin and CS pin to output mode.
-    DDRD |= 0x04 | 0x08 | 0x10;
+    // Set the DCX, CS and reset pins to output mode.
+    PIN_OUTPUT (LCD_DC_PIN);
+    PIN_OUTPUT (LCD_CS_PIN);
+    PIN_OUTPUT (LCD_RESET_PIN);
 
     // Set the pin mode on the MCU SPI MOSI and SCK to OUTPUT. Also set the
     // SS pin to OUTPUT.
-    DDRB |= (0x04 | 0x08 | 0x20);
+    PIN_OUTPUT (SPI_SS_PIN);
+    PIN_OUTPUT (SPI_MOSI_PIN);
+    PIN_OUTPUT (SPI_SCK_PIN);
 
     // Set the SPI CS pin to HIGH. Once we begin a transfer we will pull it
-    // low.
-    PORTD |= 0x08;
-    PORTD &= ~0x10;
+    // low. Then pulse the reset line.
+    PIN_SET (LCD_CS_PIN);
+    PIN_CLEAR (LCD_RESET_PIN);
     _delay_ms (200);
-    PORTD |= 0x10;
+    PIN_SET (LCD_RESET_PIN);
     _delay_ms (200);
 
     display_init (ili9488_init_cmds);
@@ -96,6 +101,8 @@ write_colour (colour, pixel_count)
 {
     uint8_t red, green, blue;
 
+    PROBE_BEGIN (PROBE_WRITE_COLOUR);
+
     // get the red channel from the 16 bit colour and convert it to a 3 byte
     // 18 bit colour.
     red = colour >> 11;
@@ -115,6 +122,8 @@ write_colour (colour, pixel_count)
         spi_transfer_byte (green);
         spi_transfer_byte (blue);
     }
+
+    PROBE_END (PROBE_WRITE_COLOUR);
 }
 
 /** vim: set ts=4 sw=4 et : */
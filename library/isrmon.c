@@ -0,0 +1,340 @@
+/**
+ *  isrmon.c
+ *
+ *  Interrupt monitor statistics (see isrmon.h). Nothing here is compiled
+ *  unless ISRMON_ENABLE or ISRMON_TRACE is defined.
+ */
+
+#include "isrmon.h"
+
+#ifdef ISRMON_HAVE_LAST
+
+// not cleared at reset, so that it can be read after a watchdog reset.
+volatile uint8_t isrmon_last __attribute__ ((section (".noinit")));
+
+#endif // ISRMON_HAVE_LAST
+
+#ifdef ISRMON_ENABLE
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#include "uart.h"
+
+/********************************************************************/
+
+#define NO_VECTOR                   0xFF
+
+// UART queue slots needed to print one line of the dump.
+#define LINE_SLOTS                  16
+
+struct vector_stats
+{
+    uint16_t count;                 // stops counting at 0xFFFF
+    uint32_t total;                 // cycles, not counting nested ISRs
+    uint16_t worst;
+    uint16_t worst_latency;         // since the interrupt was raised
+    uint8_t timed;                  // 1 once a latency has been measured
+    uint16_t worst_blocked;         // since the blocking ISR started
+    uint8_t worst_blocker;          // vector that caused worst_blocked
+    uint8_t max_depth;              // 1 if never nested
+    uint8_t nested_in;              // last vector this one interrupted
+};
+
+// an ISR that is running: when it started, and how long ISRs nested
+// inside it have taken.
+struct frame
+{
+    uint8_t id;
+    uint16_t start;
+    uint16_t nested;
+};
+
+// where to find each vector's interrupt flag and enable bit, to see if it
+// is pending.
+struct vector_source
+{
+    volatile uint8_t *flag_register;
+    uint8_t flag;
+    volatile uint8_t *enable_register;
+    uint8_t enable;
+};
+
+static const struct vector_source sources [ISRMON_VECTORS] =
+{
+    {&ADCSRA, _BV (ADIF), &ADCSRA, _BV (ADIE)},
+    {&TWCR, _BV (TWINT), &TWCR, _BV (TWIE)},
+    {&UCSR0A, _BV (RXC0), &UCSR0B, _BV (RXCIE0)},
+    {&UCSR0A, _BV (UDRE0), &UCSR0B, _BV (UDRIE0)},
+    {&TIFR2, _BV (OCF2A), &TIMSK2, _BV (OCIE2A)},
+    {&TIFR2, _BV (TOV2), &TIMSK2, _BV (TOIE2)},
+    {&PCIFR, _BV (PCIF0), &PCICR, _BV (PCIE0)},
+    {&PCIFR, _BV (PCIF1), &PCICR, _BV (PCIE1)},
+    {&PCIFR, _BV (PCIF2), &PCICR, _BV (PCIE2)},
+};
+
+// cycles per count of timer 2, as a shift, for each clock select value.
+static const uint8_t timer2_prescaler_shift [8] = {0, 0, 3, 5, 6, 7, 8, 10};
+
+static const char *vector_names [ISRMON_VECTORS] =
+{
+    "ADC", "TWI", "USART_RX", "USART_UDRE", "TIMER2_COMPA", "TIMER2_OVF",
+    "PCINT0", "PCINT1", "PCINT2",
+};
+
+static struct vector_stats vectors [ISRMON_VECTORS];
+static struct frame frames [ISRMON_MAX_DEPTH];
+static uint8_t depth;
+
+// vectors seen pending at the end of another ISR: since when, and which.
+static uint16_t pending_mask;
+static uint16_t pending_since [ISRMON_VECTORS];
+static uint8_t blocker [ISRMON_VECTORS];
+
+static uint16_t timer2_latency (void);
+
+/********************************************************************/
+
+/**
+ *  Start timer 1 running freely at the CPU clock, and clear the
+ *  statistics.
+ */
+    void
+isrmon_init (void)
+{
+    TCCR1B = 0x00;
+    TCCR1A = 0x00;
+    TCNT1 = 0;
+    TCCR1B = 0x01;
+
+    isrmon_reset ();
+}
+
+/********************************************************************/
+
+/**
+ *  Record the start of an ISR. Called by ISRMON_ENTER, first thing in the
+ *  ISR, while interrupts are still disabled.
+ */
+    void
+isrmon_enter (id)
+    uint8_t id;
+{
+    uint16_t latency = (id == ISRMON_TIMER2_COMPA)? timer2_latency () : 0;
+    uint16_t now = TCNT1;
+    struct vector_stats *vector = &(vectors [id]);
+    uint16_t blocked;
+
+    isrmon_last = id;
+
+    // timer 2 runs from the crystal in asynchronous mode, and its counts are
+    // too long to time an ISR by.
+    if (id == ISRMON_TIMER2_COMPA && !(ASSR & _BV (AS2)))
+    {
+        vector->timed = 1;
+
+        if (latency > vector->worst_latency)
+            vector->worst_latency = latency;
+    }
+
+    if (depth < ISRMON_MAX_DEPTH)
+    {
+        frames [depth].id = id;
+        frames [depth].start = now;
+        frames [depth].nested = 0;
+    }
+
+    if (depth > 0)
+        vector->nested_in = frames [depth - 1].id;
+
+    if (++ depth > vector->max_depth)
+        vector->max_depth = depth;
+
+    // was this interrupt kept waiting by another ISR?
+    if (pending_mask & (1 << id))
+    {
+        pending_mask &= ~(1 << id);
+        blocked = now - pending_since [id];
+
+        if (blocked > vector->worst_blocked)
+        {
+            vector->worst_blocked = blocked;
+            vector->worst_blocker = blocker [id];
+        }
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Record the end of an ISR. Called by ISRMON_EXIT, last thing in the ISR.
+ */
+    void
+isrmon_exit (id)
+    uint8_t id;
+{
+    struct vector_stats *vector = &(vectors [id]);
+    const struct vector_source *source;
+    uint16_t now, elapsed, own;
+    uint8_t sreg = SREG;
+
+    // ISRs that re-enable interrupts (ISR_NOBLOCK) get here with them on.
+    cli ();
+    now = TCNT1;
+
+    if (depth == 0)
+    {
+        SREG = sreg;
+        return;
+    }
+
+    depth --;
+
+    if (depth < ISRMON_MAX_DEPTH)
+    {
+        elapsed = now - frames [depth].start;
+        own = elapsed - frames [depth].nested;
+
+        if (depth > 0 && depth - 1 < ISRMON_MAX_DEPTH)
+            frames [depth - 1].nested += elapsed;
+
+        if (vector->count != 0xFFFF)
+        {
+            vector->count ++;
+            vector->total += own;
+        }
+
+        if (own > vector->worst)
+            vector->worst = own;
+
+        // any other interrupt pending now was raised while this ISR ran,
+        // and had to wait for it.
+        for (uint8_t i = 0; i < ISRMON_VECTORS; i ++)
+        {
+            source = &(sources [i]);
+
+            if (i == id || (pending_mask & (1 << i)))
+                continue;
+
+            if ((*(source->flag_register) & source->flag) &&
+                (*(source->enable_register) & source->enable))
+            {
+                pending_mask |= 1 << i;
+                pending_since [i] = frames [depth].start;
+                blocker [i] = id;
+            }
+        }
+    }
+
+    isrmon_last = id | ISRMON_EXITED;
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Clear the statistics.
+ */
+    void
+isrmon_reset (void)
+{
+    uint8_t sreg = SREG;
+
+    cli ();
+
+    for (uint8_t i = 0; i < ISRMON_VECTORS; i ++)
+    {
+        vectors [i].count = 0;
+        vectors [i].total = 0;
+        vectors [i].worst = 0;
+        vectors [i].worst_latency = 0;
+        vectors [i].timed = 0;
+        vectors [i].worst_blocked = 0;
+        vectors [i].worst_blocker = NO_VECTOR;
+        vectors [i].max_depth = 0;
+        vectors [i].nested_in = NO_VECTOR;
+    }
+
+    pending_mask = 0;
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Send the statistics of each ISR that has run over the UART, one line
+ *  each. Numbers are in hex, and times in CPU cycles. The latency is only
+ *  there for ISRs it can be measured for; for the rest, blocked is the
+ *  upper bound described in isrmon.h, not the latency. Waits for room in
+ *  the UART queue as it goes, so must not be called from an ISR.
+ */
+    void
+isrmon_dump (void)
+{
+    struct vector_stats copy;
+    uint8_t sreg;
+
+    tx_wait_for_slots (LINE_SLOTS);
+    transmit_string ("isr: n, mean, worst, [latency,] blocked (by), depth\r\n");
+
+    for (uint8_t i = 0; i < ISRMON_VECTORS; i ++)
+    {
+        sreg = SREG;
+        cli ();
+        copy = vectors [i];
+        SREG = sreg;
+
+        if (copy.count == 0)
+            continue;
+
+        tx_wait_for_slots (LINE_SLOTS);
+        uart_printf ("%s: %x %x %x ", vector_names [i], copy.count,
+            (uint16_t) (copy.total / copy.count), copy.worst);
+
+        if (copy.timed)
+            uart_printf ("latency %x ", copy.worst_latency);
+
+        tx_wait_for_slots (LINE_SLOTS);
+        uart_printf ("blocked %x (%s) %d", copy.worst_blocked,
+            (copy.worst_blocker == NO_VECTOR)? "-" : vector_names [copy.worst_blocker],
+            copy.max_depth);
+
+        if (copy.nested_in != NO_VECTOR)
+            uart_printf (", nested in %s", vector_names [copy.nested_in]);
+
+        transmit_string ("\r\n");
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Cycles since timer 2 matched OCR2A, from how far the counter has got
+ *  past it, to within a count of the timer. Called first thing in the
+ *  timer 2 compare ISR, so this is the latency of the interrupt, including
+ *  time with interrupts disabled outside any ISR.
+ */
+    static uint16_t
+timer2_latency (void)
+{
+    uint8_t count = TCNT2;
+    uint8_t top = OCR2A;
+    uint8_t elapsed = count - top;
+    uint32_t cycles;
+
+    // in CTC mode, the counter goes back to 0 after the match, rather than
+    // on to 0xFF.
+    if (count < top && (TCCR2A & _BV (WGM21)))
+        elapsed = count + 1;
+
+    cycles = (uint32_t) elapsed << timer2_prescaler_shift [TCCR2B & 0x07];
+
+    return (cycles > 0xFFFF)? 0xFFFF : cycles;
+}
+
+/********************************************************************/
+
+#endif // ISRMON_ENABLE
+
+/** vim: set ts=4 sw=4 et : */
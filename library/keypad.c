@@ -0,0 +1,332 @@
+/**
+ *  keypad.c
+ *
+ *  Matrix keypad scanning (see keypad.h). A scan drives one row low at a
+ *  time, with the other rows left floating, so that two keys pressed in
+ *  the same column can't short a high row to a low one, and reads the
+ *  pulled up columns: a low column is a key pressed in that row.
+ *
+ *  The keys are debounced with vertical counters, as in debounce.c, one
+ *  bit per key in 16 bit words.
+ */
+
+#include <avr/io.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <util/delay.h>
+
+#include "keypad.h"
+#include "pcint.h"
+#include "sched.h"
+#include "timer.h"
+
+/********************************************************************/
+
+#define MAX_ROWS                    8
+
+static volatile uint8_t * const port_registers [PCINT_PORTS] = {&PORTB, &PORTC, &PORTD};
+static volatile uint8_t * const ddr_registers [PCINT_PORTS] = {&DDRB, &DDRC, &DDRD};
+
+static uint8_t row_port;
+static uint8_t row_mask;
+static uint8_t column_port;
+static uint8_t column_mask;
+static uint8_t columns;
+
+static sched_handler_t event_handler;
+static uint8_t event_priority;
+static struct timer scan_timer;
+
+// debounced; 1 for pressed. Key n is bit n.
+static uint16_t state;
+static uint16_t ct0;
+static uint16_t ct1;
+
+// non zero while the matrix has a ghost in it.
+static uint8_t ghosted;
+
+static void columns_changed (uint8_t port, uint8_t pins);
+static void start_scanning (uint16_t arg);
+static void scan_keys (void *arg);
+static uint16_t scan (uint16_t *ambiguous);
+static uint8_t read_row (uint8_t row);
+static void post_events (uint16_t keys, uint8_t event);
+static uint8_t count_pins (uint8_t mask);
+
+/********************************************************************/
+
+/**
+ *  Set up a keypad with its rows on the pins in row_mask of row_port, and
+ *  its columns on the pins in column_mask of column_port (PCINT_PORT_B, C
+ *  or D), and the handler that events are posted to, with their priority.
+ *  The system tick must be running (see tick.h).
+ *
+ *  Returns 1, or 0 if the keypad has more than KEYPAD_MAX_KEYS keys, its
+ *  pins overlap, or no pin change handler could be attached.
+ */
+    uint8_t
+keypad_init (rport, rmask, cport, cmask, handler, priority)
+    uint8_t rport;
+    uint8_t rmask;
+    uint8_t cport;
+    uint8_t cmask;
+    sched_handler_t handler;
+    uint8_t priority;
+{
+    if (rport >= PCINT_PORTS || cport >= PCINT_PORTS)
+        return 0;
+
+    if (rmask == 0 || cmask == 0 || (rport == cport && (rmask & cmask)))
+        return 0;
+
+    if (count_pins (rmask) * count_pins (cmask) > KEYPAD_MAX_KEYS)
+        return 0;
+
+    row_port = rport;
+    row_mask = rmask;
+    column_port = cport;
+    column_mask = cmask;
+    columns = count_pins (cmask);
+
+    event_handler = handler;
+    event_priority = priority;
+    timer_setup (&scan_timer, scan_keys, NULL);
+
+    state = 0;
+    ct0 = 0xFFFF;
+    ct1 = 0xFFFF;
+
+    // all the rows low, and the columns pulled up.
+    *(port_registers [rport]) &= ~rmask;
+    *(ddr_registers [rport]) |= rmask;
+    *(ddr_registers [cport]) &= ~cmask;
+    *(port_registers [cport]) |= cmask;
+
+    if (!pcint_attach (cport, cmask, columns_changed))
+        return 0;
+
+    // a key already pressed counts as a press.
+    pcint_disable (cport, cmask);
+    start_scanning (0);
+
+    return 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the debounced state of the keys, with bit n set if key n is
+ *  pressed.
+ */
+    uint16_t
+keypad_pressed (void)
+{
+    return state;
+}
+
+/********************************************************************/
+
+/**
+ *  Pin change handler (ISR context): a key has been pressed, and pulled
+ *  its column low. Turn the pin change interrupts off, and have the main
+ *  loop scan the keys until they settle.
+ */
+    static void
+columns_changed (port, pins)
+    uint8_t port;
+    uint8_t pins;
+{
+    pcint_disable (column_port, column_mask);
+    sched_post (SCHED_PRIORITY_HIGH, start_scanning, 0);
+}
+
+/********************************************************************/
+
+/**
+ *  Event handler: start the scan timer, if it isn't already running.
+ */
+    static void
+start_scanning (arg)
+    uint16_t arg;
+{
+    if (!timer_running (&scan_timer))
+        timer_start (&scan_timer, KEYPAD_PERIOD, KEYPAD_PERIOD);
+}
+
+/********************************************************************/
+
+/**
+ *  Scan timer callback: scan and debounce the keys, and post the events.
+ *  Keys that could be ghosts keep their state. Once all the keys are
+ *  released and settled, stop scanning, and wait for a pin change.
+ */
+    static void
+scan_keys (arg)
+    void *arg;
+{
+    uint16_t ambiguous;
+    uint16_t pressed = scan (&ambiguous);
+    uint16_t changed = (state ^ pressed) & ~ambiguous;
+
+    // count the keys that differ, and reset the others' counters.
+    ct0 = ~(ct0 & changed);
+    ct1 = ct0 ^ (ct1 & changed);
+
+    // the keys whose counters have wrapped round change state.
+    changed &= ct0 & ct1;
+    state ^= changed;
+
+    if (changed)
+    {
+        post_events (changed & ~state, KEYPAD_RELEASE);
+        post_events (changed & state, KEYPAD_PRESS);
+    }
+
+    if (ambiguous && !ghosted)
+        sched_post (event_priority, event_handler, (KEYPAD_GHOST << 8) | KEYPAD_NO_KEY);
+
+    ghosted = (ambiguous != 0);
+
+    if (state | pressed)
+        return;
+
+    timer_cancel (&scan_timer);
+    pcint_enable (column_port, column_mask);
+
+    // a key pressed just before the interrupts were turned on wouldn't
+    // raise one, so look again.
+    if (~pcint_read (column_port) & column_mask)
+    {
+        pcint_disable (column_port, column_mask);
+        start_scanning (0);
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Scan the matrix, and leave all the rows driven low again. Sets
+ *  ambiguous to the keys that are pressed in a rectangle of three or four
+ *  keys, where a fourth one pressed can't be told from a ghost.
+ *
+ *  Returns the keys pressed, with bit n set for key n.
+ */
+    static uint16_t
+scan (ambiguous)
+    uint16_t *ambiguous;
+{
+    uint8_t pressed [MAX_ROWS];
+    uint8_t ghosts [MAX_ROWS];
+    uint8_t rows = 0;
+    uint8_t common;
+    uint16_t keys = 0;
+
+    for (uint8_t row = 0; row < 8; row ++)
+    {
+        if (row_mask & _BV (row))
+        {
+            ghosts [rows] = 0;
+            pressed [rows ++] = read_row (row);
+        }
+    }
+
+    *(ddr_registers [row_port]) |= row_mask;
+
+    // two rows with two or more columns in common make a rectangle.
+    for (uint8_t i = 0; i < rows; i ++)
+    {
+        for (uint8_t j = i + 1; j < rows; j ++)
+        {
+            common = pressed [i] & pressed [j];
+
+            if (common & (common - 1))
+            {
+                ghosts [i] |= common;
+                ghosts [j] |= common;
+            }
+        }
+    }
+
+    *ambiguous = 0;
+
+    for (uint8_t i = 0; i < rows; i ++)
+    {
+        keys |= (uint16_t) pressed [i] << (i * columns);
+        *ambiguous |= (uint16_t) ghosts [i] << (i * columns);
+    }
+
+    return keys;
+}
+
+/********************************************************************/
+
+/**
+ *  Drive one row low, with the others floating, and read the columns.
+ *
+ *  Returns the columns that are low, packed into the low bits, column 0
+ *  in bit 0.
+ */
+    static uint8_t
+read_row (row)
+    uint8_t row;
+{
+    volatile uint8_t *ddr = ddr_registers [row_port];
+    uint8_t low;
+    uint8_t packed = 0;
+    uint8_t column = 0;
+
+    *ddr = (*ddr & ~row_mask) | _BV (row);
+    _delay_us (KEYPAD_SETTLE);
+    low = ~pcint_read (column_port) & column_mask;
+
+    for (uint8_t pin = 0; pin < 8; pin ++)
+    {
+        if (!(column_mask & _BV (pin)))
+            continue;
+
+        if (low & _BV (pin))
+            packed |= _BV (column);
+
+        column ++;
+    }
+
+    return packed;
+}
+
+/********************************************************************/
+
+/**
+ *  Post an event for each of the keys.
+ */
+    static void
+post_events (keys, event)
+    uint16_t keys;
+    uint8_t event;
+{
+    for (uint8_t key = 0; key < KEYPAD_MAX_KEYS; key ++)
+    {
+        if (keys & (1U << key))
+            sched_post (event_priority, event_handler, ((uint16_t) event << 8) | key);
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the number of pins in a mask.
+ */
+    static uint8_t
+count_pins (mask)
+    uint8_t mask;
+{
+    uint8_t count = 0;
+
+    for (; mask != 0; mask &= mask - 1)
+        count ++;
+
+    return count;
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
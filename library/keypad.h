@@ -0,0 +1,58 @@
+/**
+ *  keypad.h
+ *
+ *  Declares functions for a matrix keypad (eg 4x4), with the rows on one
+ *  port and the columns on another (or the same one). While no key is
+ *  pressed, all the rows are driven low and the columns are pulled up,
+ *  with their pin change interrupts on, so a key press wakes the MCU from
+ *  any sleep mode, and nothing runs until it does.
+ *
+ *  Then the matrix is scanned every KEYPAD_PERIOD ms from a software timer
+ *  on the system tick, one row at a time, and each key is debounced as in
+ *  debounce.h. Once all the keys are released and settled, the scanning
+ *  stops, and the keypad waits for the next pin change.
+ *
+ *  Any number of keys can be held at once, but without a diode per key,
+ *  three keys on the corners of a rectangle make the fourth look pressed
+ *  (a ghost). Keys in rectangles like that keep their last state until the
+ *  matrix is unambiguous again, and a KEYPAD_GHOST event is posted.
+ *
+ *  Each press and release is posted to the scheduler as an event (see
+ *  sched.h), with the event and the key, row * columns + column, packed in
+ *  the argument. Rows and columns are numbered from the lowest pin up.
+ */
+
+#ifndef _KEYPAD_H
+#define _KEYPAD_H
+
+#include <stdint.h>
+
+#include "sched.h"
+
+// ms between scans; a key is seen after 4 scans that agree.
+#define KEYPAD_PERIOD           5
+
+// rows times columns.
+#define KEYPAD_MAX_KEYS         16
+
+// us for the columns to follow a row being driven low.
+#define KEYPAD_SETTLE           2
+
+// events.
+#define KEYPAD_PRESS            1
+#define KEYPAD_RELEASE          2
+#define KEYPAD_GHOST            3   // key is KEYPAD_NO_KEY
+
+#define KEYPAD_NO_KEY           0xFF
+
+// the parts of the event argument.
+#define KEYPAD_EVENT(arg)       ((uint8_t) ((arg) >> 8))
+#define KEYPAD_KEY(arg)         ((uint8_t) (arg))
+
+uint8_t keypad_init (uint8_t row_port, uint8_t row_mask, uint8_t column_port,
+    uint8_t column_mask, sched_handler_t handler, uint8_t priority);
+uint16_t keypad_pressed (void);
+
+#endif // _KEYPAD_H
+
+/** vim: set ts=4 sw=4 et : */
@@ -7,6 +7,7 @@
 #include <util/delay.h>
 
 #include "lcd.h"
+#include "probe.h"
 
 #define CASET               0x2A
 #define RASET               0x2B
@@ -73,9 +74,9 @@ write_command (command)
 {
     // pulling the DCX line low indicates to the controller that we're sending a
     // command.
-    PORTD &= ~0x04;
+    PIN_CLEAR (LCD_DC_PIN);
     spi_transfer_byte (command);
-    PORTD |= 0x04;
+    PIN_SET (LCD_DC_PIN);
 }
 
 /********************************************************************/
@@ -88,6 +89,8 @@ write_command (command)
 set_display_window (lower_left, upper_right)
     const vector_t *lower_left, *upper_right;
 {
+    PROBE_BEGIN (PROBE_DISPLAY_WINDOW);
+
     // get the range of columns being used from the x values.
     // Starting column is from lower left, end column from upper right.
     write_command (CASET);
@@ -101,6 +104,8 @@ set_display_window (lower_left, upper_right)
     spi_write16 (upper_right->row);
 
     write_command (RAMWR);
+
+    PROBE_END (PROBE_DISPLAY_WINDOW);
 }
 
 /********************************************************************/
@@ -131,7 +136,7 @@ spi_transfer_byte (message)
     uint8_t message;
 {
     // Pull the CS line LOW
-    PORTD &= ~0x08;
+    PIN_CLEAR (LCD_CS_PIN);
 
     SPCR |= (_BV (SPE) |  _BV (MSTR));
     SPDR = message;
@@ -140,7 +145,7 @@ spi_transfer_byte (message)
     while ((SPSR & _BV (SPIF)) == 0)
         ;
 
-    PORTD |= 0x08;
+    PIN_SET (LCD_CS_PIN);
     SPCR &= ~_BV (SPE);
 }
 
@@ -0,0 +1,345 @@
+/**
+ *  mcp230xx.c
+ *
+ *  Driver for the MCP23008 and MCP23017 I2C port expanders.
+ *
+ *  All of the device registers are shadowed in the register cache, so
+ *  configuration changes cost no bus traffic until mcp230xx_apply is called,
+ *  and the whole configuration (IODIR through GPPU) then goes out in a single
+ *  sequential write. Writes to output pins only reach the bus if the output
+ *  latch actually changes.
+ *
+ *  The INT pin of the port expander should be connected to a pin on the MCU
+ *  with an external or pin change interrupt, and the ISR for that pin must
+ *  call mcp230xx_handle_interrupt. The driver then reads INTF and INTCAP in
+ *  one burst, and calls the handlers for each pin that caused the interrupt.
+ *  Reading INTCAP also clears the interrupt on the port expander.
+ *
+ *  If that read fails, INT stays asserted, so the MCU pin won't see another
+ *  edge. The main loop should call mcp230xx_update, which tries the read
+ *  again.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "i2c.h"
+#include "mcp230xx.h"
+
+/********************************************************************/
+
+// IOCON bits. MIRROR joins the INTA and INTB pins of the MCP23017, so that
+// one MCU pin covers both ports.
+#define IOCON_MIRROR            0x40
+
+/********************************************************************/
+
+static uint8_t register_address (struct mcp230xx *device, uint8_t reg, uint8_t port);
+static void interrupt_read_complete (void *context);
+
+/********************************************************************/
+
+/**
+ *  Set up the state for a port expander at the specified I2C address. No bus
+ *  transfers happen here; the registers are assumed to hold their power on
+ *  values (all pins input, no pull-ups, no interrupts).
+ *
+ *  ports is MCP23008 or MCP23017.
+ */
+    void
+mcp230xx_init (device, address, ports)
+    struct mcp230xx *device;
+    uint8_t address;
+    uint8_t ports;
+{
+    uint32_t volatile_mask = 0;
+    uint8_t count = MCP230XX_REGISTERS * ports;
+
+    device->address = address;
+    device->ports = ports;
+    device->read_pending = 0;
+    device->read_failed = 0;
+
+    for (uint8_t pin = 0; pin < 16; pin ++)
+        device->handlers [pin] = NULL;
+
+    // power on values: IODIR is all ones, everything else is zero. INTF,
+    // INTCAP and GPIO are changed by the device itself, so they are never
+    // cached.
+    memset (device->registers, 0, sizeof (device->registers));
+
+    for (uint8_t port = 0; port < ports; port ++)
+    {
+        device->registers [register_address (device, MCP230XX_IODIR, port)] = 0xFF;
+
+        volatile_mask |= (uint32_t) 1 << register_address (device, MCP230XX_INTF, port);
+        volatile_mask |= (uint32_t) 1 << register_address (device, MCP230XX_INTCAP, port);
+        volatile_mask |= (uint32_t) 1 << register_address (device, MCP230XX_GPIO, port);
+    }
+
+    regcache_add_block (&(device->cache), address, 0x00, count,
+        device->registers, volatile_mask, REGCACHE_DEFAULTS);
+
+    // both halves of the MCP23017 should signal on the same INT pin.
+    if (ports == MCP23017)
+    {
+        regcache_write (address, register_address (device, MCP230XX_IOCON, 0), IOCON_MIRROR);
+        regcache_write (address, register_address (device, MCP230XX_IOCON, 1), IOCON_MIRROR);
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Configure a pin as an output, input, or input with the internal pull-up
+ *  enabled. The change takes effect at the next mcp230xx_apply.
+ */
+    void
+mcp230xx_pin_mode (device, pin, mode)
+    struct mcp230xx *device;
+    uint8_t pin;
+    uint8_t mode;
+{
+    uint8_t port = pin >> 3;
+    uint8_t bit = _BV (pin & 0x07);
+
+    regcache_update_bits (device->address,
+        register_address (device, MCP230XX_IODIR, port), bit,
+        (mode == MCP230XX_OUTPUT)? 0x00 : bit);
+
+    regcache_update_bits (device->address,
+        register_address (device, MCP230XX_GPPU, port), bit,
+        (mode == MCP230XX_INPUT_PULLUP)? bit : 0x00);
+}
+
+/********************************************************************/
+
+/**
+ *  Enable the interrupt on change for a pin, and set the function to call
+ *  when the pin changes. The change takes effect at the next mcp230xx_apply.
+ */
+    void
+mcp230xx_attach_interrupt (device, pin, handler)
+    struct mcp230xx *device;
+    uint8_t pin;
+    mcp230xx_handler_t handler;
+{
+    uint8_t port = pin >> 3;
+    uint8_t bit = _BV (pin & 0x07);
+
+    device->handlers [pin] = handler;
+
+    // INTCON bit clear compares against the previous value (ie any change).
+    regcache_update_bits (device->address,
+        register_address (device, MCP230XX_INTCON, port), bit, 0x00);
+    regcache_update_bits (device->address,
+        register_address (device, MCP230XX_GPINTEN, port), bit, bit);
+}
+
+/********************************************************************/
+
+/**
+ *  Disable the interrupt on change for a pin. The change takes effect at the
+ *  next mcp230xx_apply.
+ */
+    void
+mcp230xx_detach_interrupt (device, pin)
+    struct mcp230xx *device;
+    uint8_t pin;
+{
+    regcache_update_bits (device->address,
+        register_address (device, MCP230XX_GPINTEN, pin >> 3),
+        _BV (pin & 0x07), 0x00);
+
+    device->handlers [pin] = NULL;
+}
+
+/********************************************************************/
+
+/**
+ *  Send any configuration changes to the device. All of the changed
+ *  configuration registers go out in one sequential write.
+ */
+    void
+mcp230xx_apply (device)
+    struct mcp230xx *device;
+{
+    regcache_flush (device->address);
+}
+
+/********************************************************************/
+
+/**
+ *  Set the level of an output pin. The write of the output latch is queued
+ *  straight away in the given I2C priority class (I2C_PRIORITY_URGENT or
+ *  I2C_PRIORITY_BULK), but only if the latch changes. Configuration changes
+ *  that haven't been applied yet are left for mcp230xx_apply.
+ *
+ *  This function may be called from an ISR, including the pin interrupt
+ *  handlers.
+ */
+    void
+mcp230xx_digital_write (device, pin, level, priority)
+    struct mcp230xx *device;
+    uint8_t pin;
+    uint8_t level;
+    uint8_t priority;
+{
+    uint8_t bit = _BV (pin & 0x07);
+    uint8_t olat = register_address (device, MCP230XX_OLAT, pin >> 3);
+
+    regcache_update_bits (device->address, olat, bit, level? bit : 0x00);
+    regcache_flush_register (device->address, olat, priority);
+}
+
+/********************************************************************/
+
+/**
+ *  Set all of the output pins on a port (0 for port A, 1 for port B), in
+ *  the given I2C priority class, as for mcp230xx_digital_write.
+ *
+ *  This function may be called from an ISR.
+ */
+    void
+mcp230xx_write_port (device, port, value, priority)
+    struct mcp230xx *device;
+    uint8_t port;
+    uint8_t value;
+    uint8_t priority;
+{
+    uint8_t olat = register_address (device, MCP230XX_OLAT, port);
+
+    regcache_write (device->address, olat, value);
+    regcache_flush_register (device->address, olat, priority);
+}
+
+/********************************************************************/
+
+/**
+ *  Read the current levels of all the pins on a port. This blocks until the
+ *  value has been read from the device, so it can't be used in an ISR.
+ */
+    uint8_t
+mcp230xx_read_port (device, port)
+    struct mcp230xx *device;
+    uint8_t port;
+{
+    return regcache_read (device->address,
+        register_address (device, MCP230XX_GPIO, port));
+}
+
+/********************************************************************/
+
+/**
+ *  Call from the ISR for the MCU pin connected to the port expander's INT
+ *  pin, when the INT pin is asserted.
+ *
+ *  This queues an urgent burst read of INTF and INTCAP; the pin handlers are
+ *  invoked when the read completes. If a read is already on its way, this
+ *  does nothing. If the read can't be queued, it is left for
+ *  mcp230xx_update.
+ */
+    void
+mcp230xx_handle_interrupt (device)
+    struct mcp230xx *device;
+{
+    if (device->read_pending)
+        return;
+
+    // INTF and INTCAP are next to each other (INTFA, INTFB, INTCAPA, INTCAPB
+    // on the MCP23017), so one read gets both.
+    if (i2c_read_registers_async (device->address,
+            register_address (device, MCP230XX_INTF, 0),
+            device->interrupt_status, 2 * device->ports, I2C_PRIORITY_URGENT,
+            &interrupt_read_complete, device))
+    {
+        device->read_pending = 1;
+        device->read_failed = 0;
+    }
+    else
+        device->read_failed = 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Call regularly from the main loop. If the last INTF/INTCAP read failed
+ *  or couldn't be queued, the port expander is still holding INT asserted,
+ *  and no new interrupt will come, so try the read again.
+ */
+    void
+mcp230xx_update (device)
+    struct mcp230xx *device;
+{
+    uint8_t sreg = SREG;
+
+    cli ();
+
+    if (device->read_failed)
+        mcp230xx_handle_interrupt (device);
+
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Work out the device register number for a register on a given port. The
+ *  MCP23017 interleaves the port A and B registers.
+ */
+    static uint8_t
+register_address (device, reg, port)
+    struct mcp230xx *device;
+    uint8_t reg;
+    uint8_t port;
+{
+    if (device->ports == MCP23017)
+        return (reg << 1) + port;
+
+    return reg;
+}
+
+/********************************************************************/
+
+/**
+ *  Completion callback for the INTF/INTCAP read, invoked from the TWI ISR.
+ *  Calls the handler of every pin flagged in INTF, with the level captured
+ *  in INTCAP. If the read failed, the buffer holds the last read's values,
+ *  so nothing is called, and the read is left for mcp230xx_update.
+ */
+    static void
+interrupt_read_complete (context)
+    void *context;
+{
+    struct mcp230xx *device = context;
+    uint8_t flags, captured;
+    mcp230xx_handler_t handler;
+
+    device->read_pending = 0;
+
+    if (i2c_transfer_failed ())
+    {
+        device->read_failed = 1;
+        return;
+    }
+
+    for (uint8_t port = 0; port < device->ports; port ++)
+    {
+        flags = device->interrupt_status [port];
+        captured = device->interrupt_status [device->ports + port];
+
+        for (uint8_t bit = 0; flags != 0; bit ++, flags >>= 1)
+        {
+            handler = device->handlers [(port << 3) + bit];
+
+            if ((flags & 0x01) && handler != NULL)
+                handler ((port << 3) + bit, (captured >> bit) & 0x01);
+        }
+    }
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
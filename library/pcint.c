@@ -0,0 +1,198 @@
+/**
+ *  pcint.c
+ *
+ *  Pin change interrupt dispatch (see pcint.h). The hardware only says
+ *  that some enabled pin on the port has changed, so the ISR keeps the
+ *  last value read from each port, to work out which.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "isrmon.h"
+#include "pcint.h"
+
+/********************************************************************/
+
+struct attachment
+{
+    uint8_t port;
+    uint8_t mask;
+    pcint_handler_t handler;
+};
+
+static struct attachment attachments [PCINT_HANDLERS];
+static uint8_t attached;
+
+static volatile uint8_t * const pin_registers [PCINT_PORTS] = {&PINB, &PINC, &PIND};
+static volatile uint8_t * const mask_registers [PCINT_PORTS] = {&PCMSK0, &PCMSK1, &PCMSK2};
+
+// the pins of each port as last read by the ISR.
+static uint8_t last_pins [PCINT_PORTS];
+
+static void dispatch (uint8_t port);
+
+/********************************************************************/
+
+/**
+ *  Attach a handler to the pins in mask on a port, and enable their pin
+ *  change interrupts. The pins should already be set up as inputs. The
+ *  handler is called in ISR context when any of them changes. Attaching
+ *  the same handler to the same port again adds the pins in mask to it.
+ *
+ *  Returns 1, or 0 if PCINT_HANDLERS are already attached.
+ */
+    uint8_t
+pcint_attach (port, mask, handler)
+    uint8_t port;
+    uint8_t mask;
+    pcint_handler_t handler;
+{
+    struct attachment *attachment = NULL;
+    uint8_t sreg = SREG;
+
+    if (port >= PCINT_PORTS)
+        return 0;
+
+    // a handler attached to the port again gets the new pins as well.
+    for (uint8_t i = 0; i < attached; i ++)
+    {
+        if (attachments [i].port == port && attachments [i].handler == handler)
+            attachment = &(attachments [i]);
+    }
+
+    if (attachment == NULL && attached == PCINT_HANDLERS)
+        return 0;
+
+    cli ();
+
+    if (attachment == NULL)
+    {
+        attachment = &(attachments [attached ++]);
+        attachment->port = port;
+        attachment->mask = 0;
+        attachment->handler = handler;
+    }
+
+    attachment->mask |= mask;
+
+    last_pins [port] = *(pin_registers [port]);
+    *(mask_registers [port]) |= mask;
+    PCICR |= _BV (port);
+
+    SREG = sreg;
+
+    return 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Enable the pin change interrupts of the pins in mask on a port again,
+ *  after pcint_disable. Changes made while they were disabled aren't
+ *  reported: their last known state is taken from the port now, so the
+ *  next edge after this is seen as a change.
+ */
+    void
+pcint_enable (port, mask)
+    uint8_t port;
+    uint8_t mask;
+{
+    uint8_t sreg = SREG;
+
+    cli ();
+
+    // otherwise a pin that changed while disabled, and changes back, would
+    // look unchanged to the ISR, and that edge would be lost.
+    last_pins [port] = (last_pins [port] & ~mask) | (*(pin_registers [port]) & mask);
+    *(mask_registers [port]) |= mask;
+    PCICR |= _BV (port);
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Disable the pin change interrupts of the pins in mask on a port, eg
+ *  while a driver is driving them itself.
+ */
+    void
+pcint_disable (port, mask)
+    uint8_t port;
+    uint8_t mask;
+{
+    uint8_t sreg = SREG;
+
+    cli ();
+    *(mask_registers [port]) &= ~mask;
+
+    if (*(mask_registers [port]) == 0)
+        PCICR &= ~_BV (port);
+
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Returns the pins of a port.
+ */
+    uint8_t
+pcint_read (port)
+    uint8_t port;
+{
+    return *(pin_registers [port]);
+}
+
+/********************************************************************/
+
+/**
+ *  Call the handlers of the pins that have changed on a port.
+ */
+    static void
+dispatch (port)
+    uint8_t port;
+{
+    uint8_t pins = *(pin_registers [port]);
+    uint8_t changed = pins ^ last_pins [port];
+
+    last_pins [port] = pins;
+
+    for (uint8_t i = 0; i < attached; i ++)
+    {
+        if (attachments [i].port == port && (changed & attachments [i].mask))
+            attachments [i].handler (port, pins);
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Pin change interrupt handlers, one for each port.
+ */
+ISR (PCINT0_vect)
+{
+    ISRMON_ENTER (ISRMON_PCINT0);
+    dispatch (PCINT_PORT_B);
+    ISRMON_EXIT (ISRMON_PCINT0);
+}
+
+ISR (PCINT1_vect)
+{
+    ISRMON_ENTER (ISRMON_PCINT1);
+    dispatch (PCINT_PORT_C);
+    ISRMON_EXIT (ISRMON_PCINT1);
+}
+
+ISR (PCINT2_vect)
+{
+    ISRMON_ENTER (ISRMON_PCINT2);
+    dispatch (PCINT_PORT_D);
+    ISRMON_EXIT (ISRMON_PCINT2);
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
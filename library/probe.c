@@ -0,0 +1,211 @@
+/**
+ *  probe.c
+ *
+ *  Statistics for the profiling probes (see probe.h). Nothing here is
+ *  compiled unless PROBE_ENABLE is defined.
+ */
+
+#include "probe.h"
+
+#ifdef PROBE_ENABLE
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#include "uart.h"
+
+/********************************************************************/
+
+// timer 1 clock select bits for each prescaler.
+#if PROBE_PRESCALER == 1
+#define TIMER1_CLOCK_SELECT         0x01
+#elif PROBE_PRESCALER == 8
+#define TIMER1_CLOCK_SELECT         0x02
+#elif PROBE_PRESCALER == 64
+#define TIMER1_CLOCK_SELECT         0x03
+#else
+#error "PROBE_PRESCALER must be 1, 8 or 64"
+#endif
+
+// UART queue slots needed to print one line of the dump.
+#define LINE_SLOTS                  16
+
+struct probe_stats
+{
+    uint16_t count;                 // stops counting at 0xFFFF
+    uint16_t min;
+    uint16_t max;
+    uint32_t total;
+    uint16_t buckets [PROBE_BUCKETS];
+};
+
+static struct probe_stats probes [PROBE_COUNT];
+
+// time taken by an empty region, subtracted from every time recorded.
+static uint16_t overhead;
+
+static const char *probe_names [PROBE_USER] =
+{
+    "write_colour",
+    "set_display_window",
+    "USART_UDRE",
+    "TWI",
+    "ADC",
+};
+
+/********************************************************************/
+
+/**
+ *  Start timer 1 running freely for the probes, measure the cost of an
+ *  empty probe, and clear the statistics.
+ */
+    void
+probe_init (void)
+{
+    TCCR1B = 0x00;
+    TCCR1A = 0x00;
+    TCNT1 = 0;
+    TCCR1B = TIMER1_CLOCK_SELECT;
+
+    overhead = 0;
+    {
+        PROBE_BEGIN (PROBE_USER);
+        overhead = TCNT1 - probe_start_PROBE_USER;
+    }
+
+    probe_reset ();
+}
+
+/********************************************************************/
+
+/**
+ *  Add a time to a probe's statistics. Called by PROBE_END, from ISRs as
+ *  well as the main loop.
+ */
+    void
+probe_record (id, time)
+    uint8_t id;
+    uint16_t time;
+{
+    struct probe_stats *probe;
+    uint8_t bucket = 0;
+    uint8_t sreg;
+
+    if (id >= PROBE_COUNT)
+        return;
+
+    time = (time > overhead)? time - overhead : 0;
+
+    // the bucket is the number of bits in the time.
+    for (uint16_t t = time; t != 0; t >>= 1)
+        bucket ++;
+
+    probe = &(probes [id]);
+    sreg = SREG;
+    cli ();
+
+    if (probe->count != 0xFFFF)
+    {
+        probe->count ++;
+        probe->total += time;
+
+        if (time < probe->min)
+            probe->min = time;
+
+        if (time > probe->max)
+            probe->max = time;
+
+        probe->buckets [bucket] ++;
+    }
+
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Clear the statistics of all probes.
+ */
+    void
+probe_reset (void)
+{
+    uint8_t sreg = SREG;
+
+    cli ();
+
+    for (uint8_t i = 0; i < PROBE_COUNT; i ++)
+    {
+        probes [i].count = 0;
+        probes [i].min = 0xFFFF;
+        probes [i].max = 0;
+        probes [i].total = 0;
+
+        for (uint8_t j = 0; j < PROBE_BUCKETS; j ++)
+            probes [i].buckets [j] = 0;
+    }
+
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Send the statistics of each probe that has recorded anything over the
+ *  UART, one line of counts and times and one of histogram buckets per
+ *  probe. Numbers are in hex, and times in timer counts. Waits for room in
+ *  the UART queue as it goes, so must not be called from an ISR.
+ *
+ *  Bucket n counts the times from 2^(n-1) to 2^n - 1 counts.
+ */
+    void
+probe_dump (void)
+{
+    struct probe_stats copy;
+    uint8_t sreg;
+
+    tx_wait_for_slots (LINE_SLOTS);
+    uart_printf ("probes: timer 1 /%d, overhead %x\r\n", PROBE_PRESCALER, overhead);
+
+    for (uint8_t i = 0; i < PROBE_COUNT; i ++)
+    {
+        // take a consistent copy, since ISRs may be adding to it.
+        sreg = SREG;
+        cli ();
+        copy = probes [i];
+        SREG = sreg;
+
+        if (copy.count == 0)
+            continue;
+
+        tx_wait_for_slots (LINE_SLOTS);
+
+        if (i < PROBE_USER)
+            uart_printf ("%s: ", probe_names [i]);
+        else
+            uart_printf ("user %d: ", i - PROBE_USER);
+
+        uart_printf ("n %x min %x mean %x max %x\r\n", copy.count, copy.min,
+            (uint16_t) (copy.total / copy.count), copy.max);
+
+        tx_wait_for_slots (LINE_SLOTS);
+        transmit_string ("   ");
+
+        for (uint8_t j = 0; j < PROBE_BUCKETS; j ++)
+        {
+            if (copy.buckets [j] == 0)
+                continue;
+
+            tx_wait_for_slots (6);
+            uart_printf (" %d:%x", j, copy.buckets [j]);
+        }
+
+        transmit_string ("\r\n");
+    }
+}
+
+/********************************************************************/
+
+#endif // PROBE_ENABLE
+
+/** vim: set ts=4 sw=4 et : */
@@ -1,6 +1,8 @@
 #include <avr/io.h>
 
+#include "pins.h"
 #include "pwm.h"
+#include "sleepctl.h"
 
 /********************************************************************/
 
@@ -9,6 +11,10 @@
 #define PRESCALER_SELECT        0x05    // /1024 prescaler, ~61 Hz PWM.
 #define PRESCALER_MASK          0x07
 
+// the output compare pins of timer 0.
+#define OC0A_PIN                D, 6
+#define OC0B_PIN                D, 5
+
 /********************************************************************/
 
 uint8_t active_channels;
@@ -35,16 +41,20 @@ pwm_init (channel)
     {
     case CHANNEL_A:
         OCR0A = 0;
-        DDRD |= 0x40;
+        PIN_OUTPUT (OC0A_PIN);
         break;
 
     case CHANNEL_B:
         OCR0B = 0;
-        DDRD |= 0x20;
+        PIN_OUTPUT (OC0B_PIN);
         break;
     }
 
-    // record which channel is activated
+    // record which channel is activated. Timer 0 runs on the I/O clock, so
+    // keep the MCU out of the deeper sleep modes while it is in use.
+    if (active_channels == 0)
+        sleepctl_lock (SLEEPCTL_IDLE);
+
     active_channels |= channel;
 }
 
@@ -80,12 +90,15 @@ pwm_update_value (channel, value)
 pwm_end (channel)
     uint8_t channel;
 {
-    TCCR0A &= ~(COMPARE_OUTPUT_MODE << (channel == CHANNEL_A)? 6 : 4);
+    TCCR0A &= ~(COMPARE_OUTPUT_MODE << (channel == CHANNEL_A? 6 : 4));
     active_channels &= ~channel;
 
     // if both channels are off, disable the timer.
     if (active_channels == 0)
+    {
         TCCR0B &= ~PRESCALER_MASK;
+        sleepctl_unlock (SLEEPCTL_IDLE);
+    }
 }
 
 /********************************************************************/
@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+#
+#   ramreport.py
+#
+#   Reports the static RAM used by each source file of a program: the
+#   initialised (.data) and zeroed (.bss and .noinit) variables, and how
+#   much RAM is left for the stack.
+#
+#   The linker map doesn't help here, since with -flto every variable is
+#   placed from the link time object files. Instead, the symbols of the ELF
+#   file are listed with avr-nm, which finds the source file of each one in
+#   the debug info (build with -g, as the makefiles do). Variables with no
+#   debug info, eg from avr-libc, are counted as "(other)".
+#
+#   usage: ramreport.py [options] program.elf
+#
+
+import argparse
+import collections
+import os
+import subprocess
+import sys
+
+# avr-gcc places RAM at this offset in the ELF address space, and EEPROM
+# at the next.
+RAM_OFFSET = 0x800000
+EEPROM_OFFSET = 0x810000
+
+# where RAM starts on the ATmega328P; below it are the registers.
+RAM_START = 0x100
+
+
+def read_symbols(args):
+    output = subprocess.run(
+        [args.nm, "--print-size", "--size-sort", "--line-numbers", args.elf],
+        check=True, capture_output=True, text=True).stdout
+
+    symbols = []
+
+    for line in output.splitlines():
+        location = ""
+
+        if "\t" in line:
+            line, location = line.split("\t", 1)
+
+        fields = line.split()
+
+        # symbols without a size (eg labels) only have three fields.
+        if len(fields) != 4:
+            continue
+
+        address, size, kind, name = fields
+        address = int(address, 16)
+
+        if not (RAM_OFFSET <= address < EEPROM_OFFSET):
+            continue
+
+        if kind.lower() not in "bdv":
+            continue
+
+        if location:
+            source = os.path.basename(location.rsplit(":", 1)[0])
+        else:
+            source = "(other)"
+
+        symbols.append((source, name, kind.lower(), int(size, 16)))
+
+    return symbols
+
+
+def end_of_statics(args):
+    output = subprocess.run([args.nm, args.elf], check=True,
+                            capture_output=True, text=True).stdout
+
+    for line in output.splitlines():
+        fields = line.split()
+
+        if len(fields) == 3 and fields[2] == "_end":
+            return int(fields[0], 16) - RAM_OFFSET
+
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Report static RAM use by source file.")
+    parser.add_argument("elf", help="the program, as an ELF file")
+    parser.add_argument("--nm", default="avr-nm",
+                        help="the nm to run (default avr-nm)")
+    parser.add_argument("--ram", type=int, default=2048,
+                        help="bytes of RAM in the MCU (default 2048)")
+    parser.add_argument("--symbols", action="store_true",
+                        help="list the variables of each file as well")
+    args = parser.parse_args()
+
+    data = collections.Counter()
+    bss = collections.Counter()
+    variables = collections.defaultdict(list)
+
+    for source, name, kind, size in read_symbols(args):
+        if kind == "d":
+            data[source] += size
+        else:
+            bss[source] += size
+
+        variables[source].append((size, name))
+
+    sources = sorted(set(data) | set(bss),
+                     key=lambda s: data[s] + bss[s], reverse=True)
+
+    print("%-24s %6s %6s %6s" % ("file", "data", "bss", "total"))
+
+    for source in sources:
+        print("%-24s %6d %6d %6d" % (source, data[source], bss[source],
+                                     data[source] + bss[source]))
+
+        if args.symbols:
+            for size, name in sorted(variables[source], reverse=True):
+                print("    %-20s %6d" % (name, size))
+
+    total = sum(data.values()) + sum(bss.values())
+    print("%-24s %6d %6d %6d" % ("total", sum(data.values()),
+                                 sum(bss.values()), total))
+
+    # _end includes any padding, and variables nm couldn't size.
+    end = end_of_statics(args)
+
+    if end is not None:
+        used = end - RAM_START
+    else:
+        used = total
+
+    print()
+    print("static RAM %d of %d bytes, %d left for the stack"
+          % (used, args.ram, args.ram - used))
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,26 @@
+/**
+ *  stack.h
+ *
+ *  Declares functions to see how much SRAM is left for the stack. The free
+ *  RAM between the static variables and the stack is painted with a known
+ *  byte before main runs; the stack overwrites it as it grows, so the
+ *  painted bytes left show the most the stack has ever used.
+ *
+ *  Assumes there is no heap (malloc is not used), so everything above the
+ *  static variables belongs to the stack.
+ */
+
+#ifndef _STACK_H
+#define _STACK_H
+
+#include <stdint.h>
+
+#define STACK_PAINT             0xC5
+
+uint16_t stack_static_size (void);
+uint16_t stack_free (void);
+uint16_t stack_min_free (void);
+
+#endif // _STACK_H
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,62 @@
+/**
+ *  thermistor.c
+ *
+ *  Converts ADC readings from an NTC thermistor to temperatures, by linear
+ *  interpolation in a table of temperatures at evenly spaced readings.
+ *  Working out the temperature directly (from the Beta or Steinhart-Hart
+ *  equation) needs a logarithm, which would pull in the floating point
+ *  library and take thousands of cycles; the table lookup takes a few tens.
+ *
+ *  The table is generated for a particular circuit and thermistor by
+ *  thermistor_table.py, which also sets the number of bits expected in the
+ *  readings (eg 12 bits for readings oversampled by 2 bits in the ADC scan
+ *  sequencer).
+ */
+
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+#include "thermistor.h"
+#include "thermistor_table.h"
+
+/********************************************************************/
+
+#define READING_MAX         ((1 << THERMISTOR_INPUT_BITS) - 1)
+#define FRACTION_MASK       ((1 << THERMISTOR_TABLE_SHIFT) - 1)
+
+/********************************************************************/
+
+/**
+ *  Convert a reading (THERMISTOR_INPUT_BITS bits) to a temperature.
+ *
+ *  Returns the temperature in hundredths of a degree Celsius, eg 2345 for
+ *  23.45C. Readings at the very ends of the range (a short or open circuit)
+ *  give temperatures off the scale, limited to the range of an int16_t.
+ */
+    int16_t
+thermistor_celsius (reading)
+    uint16_t reading;
+{
+    uint8_t index;
+    uint8_t fraction;
+    int16_t low, high;
+
+    if (reading > READING_MAX)
+        reading = READING_MAX;
+
+    index = reading >> THERMISTOR_TABLE_SHIFT;
+    fraction = reading & FRACTION_MASK;
+
+    low = pgm_read_word (&(thermistor_table [index]));
+
+    if (fraction == 0)
+        return low;
+
+    high = pgm_read_word (&(thermistor_table [index + 1]));
+
+    return low + (int16_t) (((int32_t) (high - low) * fraction) >> THERMISTOR_TABLE_SHIFT);
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+#
+#   thermistor_table.py
+#
+#   Generates thermistor_table.h, the lookup table used by thermistor.c to
+#   convert ADC readings to temperatures without floating point.
+#
+#   The circuit is a pull-up resistor from the ADC reference to the analog
+#   input, and the NTC thermistor from the input to ground. The thermistor
+#   is described by its Beta value, or by Steinhart-Hart coefficients.
+#
+#   Defaults match the circuit in AnalogReadSerial: a 10k @ 25C thermistor
+#   with Beta 3950, a 10k pull-up, and 12 bit readings (10 bit ADC, oversampled
+#   by 2 bits).
+#
+#   usage: thermistor_table.py [options] > thermistor_table.h
+#
+
+import argparse
+import math
+import sys
+
+KELVIN = 273.15
+INT16_MIN = -32768
+INT16_MAX = 32767
+
+
+def resistance_to_celsius(resistance, args):
+    if args.steinhart_hart:
+        a, b, c = args.steinhart_hart
+        ln_r = math.log(resistance)
+        return 1.0 / (a + b * ln_r + c * ln_r ** 3) - KELVIN
+
+    t0 = args.nominal_temperature + KELVIN
+    return 1.0 / (1.0 / t0 + math.log(resistance / args.nominal_resistance) / args.beta) - KELVIN
+
+
+def reading_to_celsius(reading, args):
+    # fraction of the reference voltage across the thermistor.
+    full_scale = 1 << args.bits
+    ratio = reading / full_scale
+
+    if ratio <= 0.0:
+        return INT16_MAX / 100.0
+
+    if ratio >= 1.0:
+        return INT16_MIN / 100.0
+
+    return resistance_to_celsius(args.pullup * ratio / (1.0 - ratio), args)
+
+
+def centi(celsius):
+    return max(INT16_MIN, min(INT16_MAX, int(round(celsius * 100))))
+
+
+def interpolate(table, reading, shift):
+    index = reading >> shift
+    fraction = reading & ((1 << shift) - 1)
+    return table[index] + (((table[index + 1] - table[index]) * fraction) >> shift)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--beta", type=float, default=3950.0)
+    parser.add_argument("--nominal-resistance", type=float, default=10000.0,
+                        help="thermistor resistance at the nominal temperature (ohms)")
+    parser.add_argument("--nominal-temperature", type=float, default=25.0,
+                        help="nominal temperature (C)")
+    parser.add_argument("--steinhart-hart", type=float, nargs=3, metavar=("A", "B", "C"),
+                        help="use Steinhart-Hart coefficients instead of Beta")
+    parser.add_argument("--pullup", type=float, default=10000.0,
+                        help="pull-up resistor (ohms)")
+    parser.add_argument("--bits", type=int, default=12,
+                        help="bits in the ADC reading")
+    parser.add_argument("--shift", type=int, default=5,
+                        help="log2 of the readings between table points")
+    args = parser.parse_args()
+
+    length = (1 << (args.bits - args.shift)) + 1
+    table = [centi(reading_to_celsius(i << args.shift, args)) for i in range(length)]
+
+    # worst interpolation error, over readings between -40C and 125C.
+    worst = 0
+    for reading in range(1, (1 << args.bits) - 1):
+        exact = reading_to_celsius(reading, args)
+        if -40.0 <= exact <= 125.0:
+            worst = max(worst, abs(interpolate(table, reading, args.shift) - exact * 100))
+
+    if args.steinhart_hart:
+        model = "Steinhart-Hart A = %g, B = %g, C = %g" % tuple(args.steinhart_hart)
+    else:
+        model = "Beta %g, %g ohms at %g C" % (args.beta, args.nominal_resistance,
+                                             args.nominal_temperature)
+
+    out = sys.stdout
+    out.write("/**\n")
+    out.write(" *  thermistor_table.h\n")
+    out.write(" *\n")
+    out.write(" *  Generated by thermistor_table.py, do not edit.\n")
+    out.write(" *\n")
+    out.write(" *  Thermistor: %s\n" % model)
+    out.write(" *  Pull-up: %g ohms\n" % args.pullup)
+    out.write(" *  Readings: %d bits, %d readings between table points\n" % (args.bits, 1 << args.shift))
+    out.write(" *  Worst interpolation error from -40 C to 125 C: %.2f C\n" % (worst / 100.0))
+    out.write(" */\n\n")
+    out.write("#define THERMISTOR_INPUT_BITS       %d\n" % args.bits)
+    out.write("#define THERMISTOR_TABLE_SHIFT      %d\n" % args.shift)
+    out.write("#define THERMISTOR_TABLE_LENGTH     %d\n\n" % length)
+    out.write("// temperature in 0.01 C at each table point.\n")
+    out.write("static const int16_t thermistor_table [THERMISTOR_TABLE_LENGTH] PROGMEM =\n{\n")
+
+    for i in range(0, length, 8):
+        row = ", ".join("%6d" % value for value in table[i:i + 8])
+        out.write("    %s,\n" % row)
+
+    out.write("};\n\n")
+    out.write("/** vim: set ts=4 sw=4 et : */\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,224 @@
+/**
+ *  vcc.c
+ *
+ *  Measures the supply voltage, by converting the internal 1.1V bandgap
+ *  with AVCC as the reference. The reading is 1024 * Vbg / VCC, so VCC is
+ *  1024 * Vbg / reading. Readings of other channels taken against AVCC can
+ *  then be turned into millivolts, so they don't drift as a battery runs
+ *  down.
+ *
+ *  The bandgap voltage varies from one device to the next, so it can be
+ *  calibrated once against a known supply, and the result is kept in
+ *  EEPROM. Conversions to millivolts only need a multiply and a shift; the
+ *  one division is done when VCC is measured.
+ */
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <util/delay.h>
+#include <stdint.h>
+
+#include "analog.h"
+#include "vcc.h"
+
+/********************************************************************/
+
+// calibration as stored in EEPROM. The magic number tells a calibrated
+// device from one with blank (0xFF) or foreign EEPROM contents.
+#define CALIBRATION_MAGIC           0x5663
+
+struct vcc_calibration
+{
+    uint16_t magic;
+    uint16_t bandgap;               // millivolts
+};
+
+static struct vcc_calibration EEMEM stored_calibration;
+
+// bandgap readings in the background scan are oversampled by 2 bits, which
+// also averages out some of the noise on the supply.
+#define SCAN_OVERSAMPLE             2
+#define SCAN_BITS                   (10 + SCAN_OVERSAMPLE)
+
+// REFS bits of ADMUX.
+#define REFERENCE_MASK              0xC0
+
+// time for the AREF pin capacitor to charge to AVCC after switching
+// reference, in ms.
+#define REFERENCE_SETTLE            2
+
+static uint16_t bandgap = VCC_BANDGAP_NOMINAL;
+static uint16_t vcc = 5000;
+
+// the last bandgap reading, and how many bits it has, to calibrate from.
+static uint16_t last_reading;
+static uint8_t last_bits;
+
+static uint16_t update (uint16_t reading, uint8_t bits);
+
+/********************************************************************/
+
+/**
+ *  Load the bandgap calibration from EEPROM, if the device has been
+ *  calibrated.
+ */
+    void
+vcc_init (void)
+{
+    struct vcc_calibration calibration;
+
+    eeprom_read_block (&calibration, &stored_calibration, sizeof (calibration));
+
+    if (calibration.magic == CALIBRATION_MAGIC &&
+        calibration.bandgap >= VCC_BANDGAP_MIN && calibration.bandgap <= VCC_BANDGAP_MAX)
+    {
+        bandgap = calibration.bandgap;
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Measure the supply voltage now, with single conversions. Takes a few
+ *  milliseconds, mostly waiting for the reference to settle. Must not be
+ *  used while the ADC is scanning or sampling; use vcc_scan_entry instead.
+ *
+ *  Returns VCC in millivolts, or 0 if the ADC is using the AREF pin as its
+ *  reference, which may have a voltage on it (see vcc.h).
+ */
+    uint16_t
+vcc_measure (void)
+{
+    uint8_t saved_admux = ADMUX;
+    uint16_t sum = 0;
+
+    if ((saved_admux & REFERENCE_MASK) == ANALOG_REFERENCE_AREF)
+        return 0;
+
+    ADMUX = ANALOG_REFERENCE_AVCC | ANALOG_CHANNEL_BANDGAP;
+    _delay_ms (REFERENCE_SETTLE);
+
+    // the first conversion after changing channel to the bandgap is low.
+    analog_read (ANALOG_CHANNEL_BANDGAP);
+
+    for (uint8_t i = 0; i < 4; i ++)
+        sum += analog_read (ANALOG_CHANNEL_BANDGAP);
+
+    ADMUX = saved_admux;
+
+    return update (sum, 12);
+}
+
+/********************************************************************/
+
+/**
+ *  Fill in a scan list entry to convert the bandgap against AVCC, so VCC
+ *  can be kept up to date in the background with vcc_refresh. The other
+ *  entries in the scan should use AVCC as well; switching references in a
+ *  scan leaves too little time for AREF to settle. Only for boards with
+ *  nothing but a capacitor on AREF (see vcc.h).
+ */
+    void
+vcc_scan_entry (entry)
+    struct analog_scan_entry *entry;
+{
+    entry->channel = ANALOG_CHANNEL_BANDGAP;
+    entry->reference = ANALOG_REFERENCE_AVCC;
+    entry->flags = ANALOG_SCAN_DISCARD;
+    entry->oversample = SCAN_OVERSAMPLE;
+    entry->events = 0;
+}
+
+/********************************************************************/
+
+/**
+ *  Update VCC from the latest result of a scan list entry set up with
+ *  vcc_scan_entry, at index in the list. Cheap enough to call on every
+ *  pass of the main loop; the division is skipped if the result hasn't
+ *  changed.
+ *
+ *  Returns VCC in millivolts.
+ */
+    uint16_t
+vcc_refresh (index)
+    uint8_t index;
+{
+    return update (analog_scan_value (index), SCAN_BITS);
+}
+
+/********************************************************************/
+
+/**
+ *  Convert a reading taken against AVCC to millivolts, using the last
+ *  measurement of VCC. bits is the number of bits in the reading: 10 for
+ *  analog_read, 8 for fast scan entries, or 10 + n for scan entries
+ *  oversampled by n.
+ */
+    uint16_t
+vcc_millivolts (reading, bits)
+    uint16_t reading;
+    uint8_t bits;
+{
+    return ((uint32_t) reading * vcc) >> bits;
+}
+
+/********************************************************************/
+
+/**
+ *  Calibrate the bandgap, given the actual supply voltage in millivolts
+ *  (measured with a good meter) at the time of the last vcc_measure or
+ *  vcc_refresh. The result is saved in EEPROM, and used from then on.
+ *
+ *  Returns the bandgap voltage in millivolts, or 0 if it came out outside
+ *  the range in the datasheet, in which case the calibration is not
+ *  changed.
+ */
+    uint16_t
+vcc_calibrate (actual)
+    uint16_t actual;        // VCC, mV
+{
+    struct vcc_calibration calibration;
+    uint16_t measured;
+
+    if (last_reading == 0)
+        return 0;
+
+    measured = ((uint32_t) actual * last_reading) >> last_bits;
+
+    if (measured < VCC_BANDGAP_MIN || measured > VCC_BANDGAP_MAX)
+        return 0;
+
+    calibration.magic = CALIBRATION_MAGIC;
+    calibration.bandgap = measured;
+    eeprom_update_block (&calibration, &stored_calibration, sizeof (calibration));
+
+    bandgap = measured;
+    vcc = actual;
+
+    return measured;
+}
+
+/********************************************************************/
+
+/**
+ *  Work out VCC from a bandgap reading with the given number of bits.
+ */
+    static uint16_t
+update (reading, bits)
+    uint16_t reading;
+    uint8_t bits;
+{
+    // zero means no scan has completed yet (or a fault); keep the old value.
+    if (reading == 0 || (reading == last_reading && bits == last_bits))
+        return vcc;
+
+    last_reading = reading;
+    last_bits = bits;
+    vcc = ((uint32_t) bandgap << bits) / reading;
+
+    return vcc;
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,40 @@
+/**
+ *  vcc.h
+ *
+ *  Declares functions to measure the supply voltage against the internal
+ *  bandgap reference, and to convert ADC readings taken against AVCC to
+ *  millivolts.
+ *
+ *  Measuring switches the ADC to the AVCC reference, which connects AVCC to
+ *  the AREF pin inside the chip. That is only allowed if nothing but a
+ *  capacitor is on AREF (as on an Arduino Uno); a voltage applied to AREF
+ *  would be shorted to AVCC. So vcc_measure only runs if the ADC is already
+ *  on AVCC or the internal reference, as the program chose, and not on the
+ *  AREF pin, which is where the ADC starts after reset. A scan using
+ *  vcc_scan_entry must likewise only be used with a bare AREF pin.
+ */
+
+#ifndef _VCC_H
+#define _VCC_H
+
+#include <stdint.h>
+
+#include "analog.h"
+
+// Nominal bandgap voltage, used until the device has been calibrated. The
+// datasheet only promises 1.0V to 1.2V, so uncalibrated results can be
+// out by up to 10%.
+#define VCC_BANDGAP_NOMINAL         1100
+#define VCC_BANDGAP_MIN             1000
+#define VCC_BANDGAP_MAX             1200
+
+void vcc_init (void);
+uint16_t vcc_measure (void);
+void vcc_scan_entry (struct analog_scan_entry *entry);
+uint16_t vcc_refresh (uint8_t index);
+uint16_t vcc_millivolts (uint16_t reading, uint8_t bits);
+uint16_t vcc_calibrate (uint16_t actual);
+
+#endif // _VCC_H
+
+/** vim: set ts=4 sw=4 et : */
@@ -5,7 +5,8 @@
  *  and close out of phase with each other for each step that the dial turns.
  *  We can determine the direction it's turning based on which channel changes
  *  first. Detecting the changing switches is done with the usual pin change
- *  interrupts.
+ *  interrupts, on both channels, and the encoder driver decodes every change
+ *  in the ISR, so fast turns aren't missed.
  *
  *  The encoder also has a third switch, if you press down on the dial it also
  *  has a push button.
@@ -13,21 +14,36 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
-#include <avr/sleep.h>
-#include <util/delay.h>
 #include <stddef.h>
 
+#include "encoder.h"
+#include "pcint.h"
+#include "pins.h"
+#include "sched.h"
+#include "tick.h"
 #include "uart.h"
 
 
-static volatile int pin_changed = 0;
+#define KNOB_A_PIN      D, 7
+#define KNOB_B_PIN      D, 6
+
+static struct encoder knob;
+
+// the value set with the knob. Turning it quickly changes the value faster.
+static int position = 0;
+
+/********************************************************************/
+
+static void knob_turned (struct encoder *encoder, int8_t step);
+static void report_position (uint16_t arg);
 
 /********************************************************************/
 
 /**
  *  Rotary encoder channel A is connected to PD7 and channel B is connected to
- *  PD6. We will enable the internal pull-up resistors in the M328P for those
- *  pins, and the rotary encoder will pull them to ground through its common pin.
+ *  PD6. The encoder driver enables the internal pull-up resistors in the M328P
+ *  for those pins, and the rotary encoder will pull them to ground through its
+ *  common pin.
  *
  *  PD6 => PCINT22
  *  PD7 => PCINT23
@@ -35,54 +51,14 @@ static volatile int pin_changed = 0;
     int
 main (void)
 {
-    uint8_t pin_states, new_states;
-
     uart_init (9600);
 
-    ///////////////////////////////////
-    // Set port D pins 6 and 7 to output, and enable the pull-ups
-    //
-    DDRD &= ~0xC0;
-    PORTD |= 0xC0;
-
-    ///////////////////////////////////
-    // Enable the two pin change interrupts, PCINT22 and PCINT23.
-    //
-    PCICR |= _BV (PCIE2);
-    PCMSK2 |= (_BV (PCINT23));
-
-    for (;;)
-    {
-        if (pin_changed == 0)
-        {
-            sei ();
-            sleep_mode ();
-            continue;
-        }
-
-        _delay_ms (5);
-        pin_changed = 0;
-
-        ///////////////////////////////
-        // Get the states of the rotary encoder pins, and print the details
-        // over the uart.
-        //
-        new_states = PIND;
-
-        if (new_states == pin_states)
-            continue;
-
-        pin_states = new_states;
-
-        if ((pin_states & 0x80) != (pin_states & 0x40) << 1)
-        {
-            transmit_string ("CLOCKWISE\r\n");
-        }
-        else
-        {
-            transmit_string ("COUNTER-CLOCKWISE\r\n");
-        }
-    }
+    // the tick times the detents, for the acceleration.
+    tick_init ();
+    encoder_attach (&knob, PIN_PCINT_PORT (KNOB_A_PIN), PIN_MASK (KNOB_A_PIN), PIN_MASK (KNOB_B_PIN),
+        ENCODER_STEPS_4, knob_turned);
+
+    sched_run ();
 
     return 0;
 }
@@ -90,11 +66,37 @@ main (void)
 /********************************************************************/
 
 /**
- *  Handle the interrupts generated as the rotary encoder is turned.
+ *  Encoder handler (ISR context): have the main loop report the new
+ *  position.
  */
-ISR (PCINT2_vect)
+    static void
+knob_turned (encoder, step)
+    struct encoder *encoder;
+    int8_t step;
 {
-    pin_changed = 1;
+    sched_post (SCHED_PRIORITY_NORMAL, report_position, 0);
+}
+
+/********************************************************************/
+
+/**
+ *  Event handler: update the position, and print it over the uart. Several
+ *  detents may have been counted since the event was posted, and then the
+ *  events after the first find nothing more to report.
+ */
+    static void
+report_position (arg)
+    uint16_t arg;
+{
+    int turned = encoder_read_accelerated (&knob);
+
+    if (turned == 0)
+        return;
+
+    position += turned;
+
+    uart_printf ("%s position %d, %d/s\r\n", (turned > 0)? "CLOCKWISE" : "COUNTER-CLOCKWISE",
+        position, encoder_speed (&knob));
 }
 
 /********************************************************************/
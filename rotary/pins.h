@@ -0,0 +1,75 @@
+/**
+ *  pins.h
+ *
+ *  Macros to name I/O pins at compile time. A pin is written as its port
+ *  letter and bit number, separated by a comma, and usually given a name
+ *  with #define:
+ *
+ *      #define LED_PIN         B, 5
+ *
+ *      PIN_OUTPUT (LED_PIN);
+ *      PIN_SET (LED_PIN);
+ *
+ *  Everything expands to constant register addresses and masks, so with
+ *  optimisation on, setting, clearing and testing a pin compile to single
+ *  sbi, cbi, sbis and sbic instructions, as with hand written masks, and
+ *  toggling to a write of the PIN register. Drivers can take their pins
+ *  as configuration macros (eg LCD_CS_PIN in lcd.h), with a default that
+ *  can be overridden with -D on the command line, at no cost at run time.
+ *
+ *  Each macro passes its arguments on to a second level, so that a name
+ *  like LED_PIN is expanded into port and bit before they are split.
+ */
+
+#ifndef _PINS_H
+#define _PINS_H
+
+#include <avr/io.h>
+
+// the registers of a pin's port, and its mask.
+#define PIN_PORT(...)               _PIN_PORT (__VA_ARGS__)
+#define PIN_DDR(...)                _PIN_DDR (__VA_ARGS__)
+#define PIN_IN(...)                 _PIN_IN (__VA_ARGS__)
+#define PIN_MASK(...)               _PIN_MASK (__VA_ARGS__)
+
+// the pin change interrupt port of a pin (see pcint.h).
+#define PIN_PCINT_PORT(...)         _PIN_PCINT_PORT (__VA_ARGS__)
+
+// direction.
+#define PIN_OUTPUT(...)             _PIN_OUTPUT (__VA_ARGS__)
+#define PIN_INPUT(...)              _PIN_INPUT (__VA_ARGS__)
+#define PIN_INPUT_PULLUP(...)       _PIN_INPUT_PULLUP (__VA_ARGS__)
+
+// output. Writing a 1 to the PIN register toggles the output.
+#define PIN_SET(...)                _PIN_SET (__VA_ARGS__)
+#define PIN_CLEAR(...)              _PIN_CLEAR (__VA_ARGS__)
+#define PIN_TOGGLE(...)             _PIN_TOGGLE (__VA_ARGS__)
+#define PIN_WRITE(...)              _PIN_WRITE (__VA_ARGS__)   // (pin, value)
+
+// input: non zero if the pin is high.
+#define PIN_READ(...)               _PIN_READ (__VA_ARGS__)
+
+// the second level, with the pin split into port and bit.
+#define _PIN_PORT(port, bit)        (PORT ## port)
+#define _PIN_DDR(port, bit)         (DDR ## port)
+#define _PIN_IN(port, bit)          (PIN ## port)
+#define _PIN_MASK(port, bit)        ((uint8_t) _BV (bit))
+#define _PIN_PCINT_PORT(port, bit)  (PCINT_PORT_ ## port)
+
+#define _PIN_OUTPUT(port, bit)      (DDR ## port |= _BV (bit))
+#define _PIN_INPUT(port, bit)       do { DDR ## port &= ~_BV (bit); \
+                                        PORT ## port &= ~_BV (bit); } while (0)
+#define _PIN_INPUT_PULLUP(port, bit) do { DDR ## port &= ~_BV (bit); \
+                                        PORT ## port |= _BV (bit); } while (0)
+
+#define _PIN_SET(port, bit)         (PORT ## port |= _BV (bit))
+#define _PIN_CLEAR(port, bit)       (PORT ## port &= ~_BV (bit))
+#define _PIN_TOGGLE(port, bit)      (PIN ## port = _BV (bit))
+#define _PIN_WRITE(port, bit, value) do { if (value) _PIN_SET (port, bit); \
+                                        else _PIN_CLEAR (port, bit); } while (0)
+
+#define _PIN_READ(port, bit)        (PIN ## port & _BV (bit))
+
+#endif // _PINS_H
+
+/** vim: set ts=4 sw=4 et : */
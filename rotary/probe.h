@@ -0,0 +1,73 @@
+/**
+ *  probe.h
+ *
+ *  Profiling probes: macros to time a region of code with the timer 1
+ *  counter, and keep the minimum, maximum, mean and a histogram of the
+ *  times for each probe. probe_dump sends them over the UART.
+ *
+ *  The probes are compiled out unless PROBE_ENABLE is defined (eg add
+ *  -DPROBE_ENABLE to CFLAGS), so they can stay in the code. Enabled, a
+ *  probe costs a 16 bit timer read at each end, plus a call to record the
+ *  time after the region, which isn't counted.
+ *
+ *  probe_init takes over timer 1, in normal mode. The ADC's Timer 1 trigger
+ *  (ANALOG_TRIGGER_TIMER1) reprograms it, so use the Timer 0 trigger while
+ *  profiling. Times are in timer counts: CPU cycles with the default
+ *  PROBE_PRESCALER of 1, so regions longer than 65535 cycles (4ms) wrap
+ *  around. For longer regions (eg a full screen write_colour), build with
+ *  -DPROBE_PRESCALER=8 or 64.
+ *
+ *  Times include any ISRs that ran during the region. probe_dump uses the
+ *  UART driver, so uart.c must be linked in when probes are enabled.
+ */
+
+#ifndef _PROBE_H
+#define _PROBE_H
+
+#include <stdint.h>
+
+// probes placed in the library. Programs can use PROBE_USER and up.
+#define PROBE_WRITE_COLOUR      0
+#define PROBE_DISPLAY_WINDOW    1
+#define PROBE_UART_UDRE         2
+#define PROBE_TWI               3
+#define PROBE_ADC               4
+#define PROBE_USER              5
+
+#ifndef PROBE_COUNT
+#define PROBE_COUNT             6
+#endif
+
+#ifndef PROBE_PRESCALER
+#define PROBE_PRESCALER         1
+#endif
+
+// histogram buckets: bucket n counts times from 2^(n-1) to 2^n - 1.
+#define PROBE_BUCKETS           17
+
+#ifdef PROBE_ENABLE
+
+#include <avr/io.h>
+
+#define PROBE_BEGIN(id)         uint16_t probe_start_##id = TCNT1
+#define PROBE_END(id)           probe_record ((id), TCNT1 - probe_start_##id)
+
+void probe_init (void);
+void probe_record (uint8_t id, uint16_t time);
+void probe_reset (void);
+void probe_dump (void);
+
+#else
+
+#define PROBE_BEGIN(id)
+#define PROBE_END(id)
+
+#define probe_init()
+#define probe_reset()
+#define probe_dump()
+
+#endif // PROBE_ENABLE
+
+#endif // _PROBE_H
+
+/** vim: set ts=4 sw=4 et : */
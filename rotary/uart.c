@@ -2,7 +2,11 @@
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
 #include <string.h>
+#include <stdarg.h>
 
+#include "isrmon.h"
+#include "probe.h"
+#include "sleepctl.h"
 #include "uart.h"
 
 #define BUFFER_LENGTH 32
@@ -38,10 +42,12 @@ static struct queue_item *head, *tail;
 static struct queue_item *free_list;
 
 // global int used as a mask to select the next digit to print.
-static volatile int digit_mask;
+static volatile uint16_t digit_mask;
+static volatile uint16_t shift_bits;
 
 // This string is used to map a digit to a character
 static const char *digit_map = "0123456789ABCDEF";
+static const char *hexadecimal_digits_map = "0123456789ABCDEF";
 
 // variable to hold a byte received from the UART hardware, and a flag variable
 // tp indicate that data was received.
@@ -53,6 +59,7 @@ static volatile uint8_t got_char;
 static struct queue_item *allocate_item (void);
 static int string_transmit_handler (union message_data *data);
 static int integer_transmit_handler (union message_data *data);
+static int hexadecimal_transmit_handler (union message_data *data);
 static void enqueue (struct queue_item *item);
 static struct queue_item *dequeue (void);
 
@@ -113,12 +120,78 @@ uart_init (baud_rate)
     received_data = 0;
     got_char = 0;
 
+    // the receiver is always on, and needs the I/O clock, so the MCU must
+    // not sleep any deeper than idle.
+    sleepctl_lock (SLEEPCTL_IDLE);
+
     // enable interrupts now that configuration is done.
     sei ();
 }
 
 /********************************************************************/
 
+/**
+ *  Formatted printing over UART serial.
+ */
+    int
+uart_printf (const char *format, ...)
+{
+    va_list args;
+    const char *string_arg;
+    int integer_arg;
+
+    va_start (args, format);
+
+    // Start printing the message, which will stop at the first format.
+    transmit_string (format);
+
+    /////////////////////////////////////////////////////////////////
+    // Step through the format string and find any number codes to print
+    //
+    for (const char *current = format; *current != '\0'; current ++)
+    {
+        // Skip any char that isn't a % (format specifier)
+        if (*current != '%')
+            continue;
+
+        // Check if the next character is also a %, which would indicate to
+        // print a literal % sign, which we leave to the printing function
+        if (*(++ current) == '%')
+            continue;
+
+        // handle the format code.
+        switch (*current)
+        {
+        case 'd':
+            integer_arg = va_arg (args, int);
+            transmit_int (integer_arg, DECIMAL);
+            break;
+
+        case 'x':
+            integer_arg = va_arg (args, int);
+            transmit_int (integer_arg, HEX);
+            break;
+
+        case 's':
+            string_arg = va_arg (args, const char *);
+            transmit_string (string_arg);
+            break;
+
+        default:
+            // invalid or unsupported format.
+            break;
+        }
+
+        transmit_string (++ current);
+    }
+
+    va_end (args);
+
+    return 0;
+}
+
+/********************************************************************/
+
 /**
  *  Adds a message to the next free slot in the transmit queue, for the USART
  *  hardware to send.
@@ -157,17 +230,32 @@ transmit_string (message)
  *  characters on the USART lines.
  */
     size_t
-transmit_int (value)
+transmit_int (value, base)
     int value;
+    int base;
 {
-    struct queue_item *next_item = allocate_item ();
+    struct queue_item *next_item;
+
+    if (base == HEX)
+        transmit_string ("0x");
+
+    next_item = allocate_item ();
 
     if (next_item == NULL)
         return 0;
 
     // add the transmit_int message to the end of the queue.
     next_item->data.number = value;
-    next_item->transmit_function = &(integer_transmit_handler);
+
+    if (base == HEX)
+    {
+        next_item->transmit_function = &(hexadecimal_transmit_handler);
+    }
+    else
+    {
+        next_item->transmit_function = &(integer_transmit_handler);
+    }
+
     enqueue (next_item);
 
     return sizeof (int);
@@ -255,6 +343,32 @@ uart_getchar (void)
 
 /********************************************************************/
 
+/**
+ *  Return the character received since the last call to uart_poll or
+ *  uart_getchar, or 0 if there isn't one. Doesn't wait, so a main loop or
+ *  timer callback can check for commands with it.
+ */
+    char
+uart_poll (void)
+{
+    char received = 0;
+    uint8_t sreg = SREG;
+
+    cli ();
+
+    if (got_char)
+    {
+        received = received_data;
+        got_char = 0;
+    }
+
+    SREG = sreg;
+
+    return received;
+}
+
+/********************************************************************/
+
 /**
  *  Read data from USART, line oriented.
  *
@@ -290,6 +404,49 @@ uart_getline (buffer, max_length)
 
 /********************************************************************/
 
+/**
+ *  Return the number of available slots in the transmit queue.
+ *  This ensures that if callers need to send multiple messages, we can ensure
+ *  the output doesn't get garbled if the last part of the message bundle would
+ *  be dropped due to the queue filling up.
+ */
+    uint8_t
+tx_slots_free (void)
+{
+    uint8_t count = 0;
+    uint8_t sreg = SREG;
+
+    // the UDRE ISR puts items back on the free list.
+    cli ();
+
+    for (struct queue_item *item = free_list; item != NULL; item = item->next)
+        count ++;
+
+    SREG = sreg;
+
+    return count;
+}
+
+/********************************************************************/
+
+/**
+ *  Sleep until there are at least slots free in the transmit queue, eg
+ *  before a burst of messages that mustn't be cut short. Like uart_getchar,
+ *  this cannot be called from within an ISR.
+ */
+    void
+tx_wait_for_slots (slots)
+    uint8_t slots;
+{
+    while (tx_slots_free () < slots)
+    {
+        sei ();
+        sleep_mode ();
+    }
+}
+
+/********************************************************************/
+
 /**
  *  Fetch the next available slot in the transmit buffer. If the buffer is
  *  full, this function will return null.
@@ -328,6 +485,19 @@ string_transmit_handler (data)
     if (*(data->text) == '\0')
         return 1;
 
+    // Stop if we've reached a printf format sequence.
+    if (*(data->text) == '%')
+    {
+        data->text ++;
+
+        // Check that it isn't a '%%' sequence
+        if (*(data->text) != '%' || *(data->text) == '\0')
+            return 1;
+
+        // if it was a literal % sign, we continue on to the regular logic
+        // below to transmit the char over the uart.
+    }
+
     // pass the next char to the USART hardware by writing to the UDR0
     // register and advance the string to the next char.
     UDR0 = *(data->text);
@@ -393,6 +563,37 @@ integer_transmit_handler (data)
 
 /********************************************************************/
 
+/**
+ *  This function is the same concept as the above function to transmit an
+ *  integer, but instead of printing in base 10 form, print hexadecimal digits.
+ *  It is worth having a separate function for this, because hexadecimal
+ *  allows us to make a few simplifications compared to the base 10 code.
+ */
+    static int
+hexadecimal_transmit_handler (data)
+    union message_data *data;
+{
+    uint8_t next_digit;
+
+    // we will use the same digit mask variable as the integer function, but
+    // we will use it to select a group of 4 bits (one hex digit).
+    if (digit_mask == 0)
+    {
+        digit_mask = 0xF000;
+        shift_bits = 12;
+    }
+
+    next_digit = (data->number & digit_mask) >> shift_bits;
+    digit_mask >>= 4;
+    shift_bits -= 4;
+
+    UDR0 = hexadecimal_digits_map [next_digit];
+
+    return (digit_mask == 0? 1 : 0);
+}
+
+/********************************************************************/
+
 /**
  *  USART Data Register Empty interrupt handler.
  *
@@ -405,6 +606,9 @@ ISR (USART_UDRE_vect)
 {
     struct queue_item *current_item;
 
+    ISRMON_ENTER (ISRMON_USART_UDRE);
+    PROBE_BEGIN (PROBE_UART_UDRE);
+
     // Check if there's data available in the transmit queue.
     if (head != NULL)
     {
@@ -427,6 +631,9 @@ ISR (USART_UDRE_vect)
         // nothing to transmit, so disable the UDRE interrupt.
         UCSR0B &= ~ _BV (UDRIE0);
     }
+
+    PROBE_END (PROBE_UART_UDRE);
+    ISRMON_EXIT (ISRMON_USART_UDRE);
 }
 
 /********************************************************************/
@@ -440,8 +647,10 @@ ISR (USART_UDRE_vect)
  */
 ISR (USART_RX_vect)
 {
+    ISRMON_ENTER (ISRMON_USART_RX);
     received_data = UDR0;
     got_char = 1;
+    ISRMON_EXIT (ISRMON_USART_RX);
 }
 
 /********************************************************************/
@@ -10,11 +10,18 @@
 #include <string.h>
 #include <stdint.h>
 
+#define DECIMAL     10
+#define HEX         0x10
+
 void uart_init (unsigned long baud_rate);
 size_t transmit_string (const char *message);
-size_t transmit_int (int value);
+size_t transmit_int (int value, int base);
+int uart_printf (const char *format, ...);
+uint8_t tx_slots_free (void);
+void tx_wait_for_slots (uint8_t slots);
 
 char uart_getchar (void);
+char uart_poll (void);
 size_t uart_getline (char *buffer, size_t max_length);
 
 #endif // _UART_H
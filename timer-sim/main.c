@@ -0,0 +1,276 @@
+/**
+ *  TIMER WHEEL SIMULATOR
+ *
+ *  Runs the software timers in library/timer.c on the host, against a
+ *  simulated system tick, so that the wheel can be tested without
+ *  hardware. Each scenario drives the real library code through a workload
+ *  and checks the callbacks came when they should.
+ *
+ *  tick_millis is provided here. A callback can make time pass with
+ *  work (), as if it took that long on the chip, so the tick moves on
+ *  while timer_dispatch is running.
+ *
+ *  A scenario that never returns (eg the wheel going round the whole
+ *  32 bit clock) is stopped by an alarm, and reported as a problem.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "tick.h"
+#include "timer.h"
+
+/********************************************************************/
+
+// seconds a scenario may run for before it is taken to be stuck.
+#define SCENARIO_ALARM          5
+
+/********************************************************************/
+
+static uint32_t clock_ms;
+static int problems;
+
+static struct timer timers [4];
+static unsigned int fired [4];
+static uint32_t last_fired [4];
+
+/********************************************************************/
+
+static void scenario_begin (const char *title, uint32_t start);
+static void check (int condition, const char *message);
+static void run (uint32_t milliseconds);
+static void work (uint32_t milliseconds);
+static void stuck (int signal);
+
+static void rearm_one_shot (void);
+static void periodic (void);
+static void cancel_from_callback (void);
+
+static void rearm_callback (void *arg);
+static void periodic_callback (void *arg);
+static void cancel_callback (void *arg);
+
+/********************************************************************/
+
+    int
+main (void)
+{
+    signal (SIGALRM, &stuck);
+
+    rearm_one_shot ();
+    periodic ();
+    cancel_from_callback ();
+
+    printf ("\n%d problem(s)\n", problems);
+
+    return (problems == 0)? 0 : 1;
+}
+
+/********************************************************************/
+
+/**
+ *  The system tick, as seen by the timers.
+ */
+    uint32_t
+tick_millis (void)
+{
+    return clock_ms;
+}
+
+/********************************************************************/
+
+/**
+ *  Start a scenario with the clock at the given time, and no timers
+ *  running.
+ */
+    static void
+scenario_begin (title, start)
+    const char *title;
+    uint32_t start;
+{
+    printf ("\n%s\n", title);
+
+    for (int i = 0; i < 4; i ++)
+    {
+        timer_cancel (&(timers [i]));
+        fired [i] = 0;
+        last_fired [i] = 0;
+    }
+
+    clock_ms = start;
+
+    // let the wheel catch up with the new time while nothing is running.
+    timer_dispatch ();
+    alarm (SCENARIO_ALARM);
+}
+
+/********************************************************************/
+
+    static void
+check (condition, message)
+    int condition;
+    const char *message;
+{
+    if (!condition)
+    {
+        printf ("  FAILED: %s\n", message);
+        problems ++;
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Run the main loop for a number of ticks, dispatching after each one.
+ */
+    static void
+run (milliseconds)
+    uint32_t milliseconds;
+{
+    for (uint32_t i = 0; i < milliseconds; i ++)
+    {
+        clock_ms ++;
+        timer_dispatch ();
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Let time pass inside a callback.
+ */
+    static void
+work (milliseconds)
+    uint32_t milliseconds;
+{
+    clock_ms += milliseconds;
+}
+
+/********************************************************************/
+
+    static void
+stuck (signal)
+    int signal;
+{
+    printf ("  FAILED: scenario stuck in timer_dispatch\n\n%d problem(s)\n", problems + 1);
+    exit (1);
+}
+
+/********************************************************************/
+
+/**
+ *  The only timer running is a one shot, which takes a few ms in its
+ *  callback and then starts itself again. The tick has moved past the
+ *  time dispatch is turning the wheel to by then, and the wheel mustn't
+ *  end up ahead of it. Also run across the 32 bit wrap of the clock.
+ */
+    static void
+rearm_one_shot (void)
+{
+    scenario_begin ("one shot timer re-armed from its own callback", UINT32_MAX - 100);
+
+    timer_setup (&(timers [0]), &rearm_callback, &(fired [0]));
+    timer_start (&(timers [0]), 10, 0);
+    run (1300);
+
+    // each round is 10 ticks of the main loop, and 3 ms in the callback.
+    check (fired [0] == 130, "expected 130 callbacks");
+    check (timer_running (&(timers [0])), "timer stopped");
+    alarm (0);
+}
+
+/********************************************************************/
+
+/**
+ *  Periodic timers keep to their schedule, including one longer than a
+ *  turn of the wheel.
+ */
+    static void
+periodic (void)
+{
+    scenario_begin ("periodic timers", 1000);
+
+    timer_setup (&(timers [0]), &periodic_callback, (void *) 0);
+    timer_setup (&(timers [1]), &periodic_callback, (void *) 1);
+    timer_setup (&(timers [2]), &periodic_callback, (void *) 2);
+    timer_start (&(timers [0]), 7, 7);
+    timer_start (&(timers [1]), 100, 100);
+    timer_start (&(timers [2]), TIMER_WHEEL_SLOTS + 3, TIMER_WHEEL_SLOTS + 3);
+    run (700);
+
+    check (fired [0] == 100, "7 ms timer didn't fire 100 times");
+    check (fired [1] == 7, "100 ms timer didn't fire 7 times");
+    check (fired [2] == 700 / (TIMER_WHEEL_SLOTS + 3), "timer longer than the wheel was off");
+    check (last_fired [0] == 1700, "7 ms timer drifted");
+    alarm (0);
+}
+
+/********************************************************************/
+
+/**
+ *  A callback cancels its own periodic timer, and another timer due in
+ *  the same tick.
+ */
+    static void
+cancel_from_callback (void)
+{
+    scenario_begin ("timers cancelled from a callback", 5000);
+
+    timer_setup (&(timers [0]), &cancel_callback, &(timers [1]));
+    timer_setup (&(timers [1]), &cancel_callback, &(timers [0]));
+    timer_start (&(timers [0]), 20, 5);
+    timer_start (&(timers [1]), 20, 5);
+    run (100);
+
+    check (fired [0] + fired [1] == 1, "expected exactly one callback");
+    check (!timer_running (&(timers [0])) && !timer_running (&(timers [1])),
+        "a timer is still running");
+    alarm (0);
+}
+
+/********************************************************************/
+
+    static void
+rearm_callback (arg)
+    void *arg;
+{
+    (*(unsigned int *) arg) ++;
+
+    work (3);
+    timer_start (&(timers [0]), 10, 0);
+}
+
+/********************************************************************/
+
+    static void
+periodic_callback (arg)
+    void *arg;
+{
+    int index = (int) (intptr_t) arg;
+
+    fired [index] ++;
+    last_fired [index] = clock_ms;
+}
+
+/********************************************************************/
+
+/**
+ *  Cancel both this timer and the one in arg.
+ */
+    static void
+cancel_callback (arg)
+    void *arg;
+{
+    struct timer *other = arg;
+    int index = (other == &(timers [1]))? 0 : 1;
+
+    fired [index] ++;
+    timer_cancel (other);
+    timer_cancel (&(timers [index]));
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,73 @@
+/**
+ *  CAP1188 TOUCH SENSOR DEMO
+ *
+ *  Lights the LED on port B pin 5 while any of the touch sensor channels
+ *  are touched. Touching channel 0 also toggles an LED on port B pin 4.
+ *
+ *  Key details:
+ *  - CAP1188 on the I2C bus at its default address (0x29).
+ *  - CAP1188 ALERT pin connected to PD2 (INT0).
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#include "i2c.h"
+#include "touch.h"
+
+/********************************************************************/
+
+static void channel_zero_touched (uint8_t channel);
+
+/********************************************************************/
+
+    int
+main (void)
+{
+    DDRB |= 0x30;
+
+    i2c_init ();
+    sei ();
+
+    if (touch_init () == 0)
+    {
+        // no touch sensor found; turn on the LED and stop.
+        PORTB |= 0x20;
+
+        while (1)
+            sleep_mode ();
+    }
+
+    install_handler (&channel_zero_touched, 0);
+
+    while (1)
+    {
+        // The touch state is refreshed on every ALERT, which wakes us. An
+        // ALERT that couldn't be handled straight away is retried here.
+        touch_update ();
+
+        if (touch_status () != 0)
+            PORTB |= 0x20;
+        else
+            PORTB &= ~0x20;
+
+        sei ();
+        sleep_mode ();
+    }
+
+    return 0;
+}
+
+/********************************************************************/
+
+    static void
+channel_zero_touched (channel)
+    uint8_t channel;
+{
+    PORTB ^= 0x10;
+}
+
+/********************************************************************/
+
+/** vim: set ts=4 sw=4 et : */
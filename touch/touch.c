@@ -4,8 +4,23 @@
  *  Functions for controlling and interacting with a CAP1188 touch sensor
  *  module. Allows the caller to configure a function to be invoked when a
  *  touch event is detected on a specified channel.
+ *
+ *  The CAP1188 ALERT pin must be connected to the INT0 pin (PD2) of the
+ *  MCU. The ALERT pin is active low, and stays asserted until the INT bit in
+ *  the main control register is cleared. Nothing is polled: each ALERT
+ *  queues a read of the status registers in a single burst, and once the
+ *  read has succeeded, a write that clears the INT bit.
+ *
+ *  If either transfer can't be queued, or the device doesn't answer, ALERT
+ *  stays low and no further edge comes. touch_update, called from the main
+ *  loop after each wake up, starts the read again while ALERT is low and
+ *  nothing is on its way.
  */
 
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stddef.h>
+
 #include "touch.h"
 #include "i2c.h"
 
@@ -13,16 +28,93 @@
 
 #define I2C_CHANNEL     0x29    // default channel.
 
+//
+// CAP1188 registers
+//
+#define MAIN_CONTROL            0x00
+#define GENERAL_STATUS          0x02
+#define SENSOR_INPUT_STATUS     0x03
+#define INTERRUPT_ENABLE        0x27
+#define REPEAT_RATE_ENABLE      0x28
+#define MULTIPLE_TOUCH_CONFIG   0x2A
+#define PRODUCT_ID              0xFD
+
+#define MAIN_CONTROL_INT        0x01
+#define CAP1188_PRODUCT_ID      0x50
+
+// offsets of the registers in the status burst, which is read starting
+// from the main control register.
+#define STATUS_LENGTH           4
+
+/********************************************************************/
+
+static void (*handlers [TOUCH_CHANNELS]) (uint8_t);
+
+// registers read from the CAP1188 in response to an ALERT, and the touch
+// state from the previous ALERT.
+static uint8_t status_registers [STATUS_LENGTH];
+static volatile uint8_t touched_channels;
+
+// set from the ALERT until the INT bit has been cleared, or the attempt
+// has failed.
+static volatile uint8_t alert_busy;
+
+/********************************************************************/
+
+static void start_status_read (void);
+static void status_read_complete (void *context);
+static void clear_complete (void *context);
+
 /********************************************************************/
 
 /**
- *  Prepare the CAP1188 chip for detecting touch events.
+ *  Prepare the CAP1188 chip for detecting touch events, and enable the
+ *  interrupt for the ALERT pin. The I2C hardware must already have been
+ *  initialised.
  *
  *  Callback functions must be added separately by calling install_handler
+ *
+ *  Returns 1 if a CAP1188 answered on the bus, 0 if not (in which case the
+ *  ALERT interrupt is left disabled).
  */
-    void
-init (void)
+    uint8_t
+touch_init (void)
 {
+    // interrupts on touch for all channels, and no repeated interrupts while
+    // a channel is held (release still generates an interrupt). These two
+    // registers are next to each other, so they go in one write.
+    const uint8_t interrupt_config [] = {0xFF, 0x00};
+    uint8_t main_control;
+
+    for (uint8_t channel = 0; channel < TOUCH_CHANNELS; channel ++)
+        handlers [channel] = NULL;
+
+    touched_channels = 0;
+    alert_busy = 0;
+
+    if (i2c_read_register (I2C_CHANNEL, PRODUCT_ID) != CAP1188_PRODUCT_ID)
+        return 0;
+
+    i2c_write_registers (I2C_CHANNEL, INTERRUPT_ENABLE, interrupt_config,
+        sizeof (interrupt_config));
+
+    // allow any number of channels to be touched at once.
+    i2c_write_register (I2C_CHANNEL, MULTIPLE_TOUCH_CONFIG, 0x00);
+
+    // clear any interrupt that is already pending, leaving the gain and
+    // power bits alone.
+    main_control = i2c_read_register (I2C_CHANNEL, MAIN_CONTROL);
+    i2c_write_register (I2C_CHANNEL, MAIN_CONTROL, main_control & ~MAIN_CONTROL_INT);
+
+    // INT0 on the falling edge of the ALERT pin. The pin has an open drain
+    // output, so turn on the pull-up.
+    DDRD &= ~_BV (DDD2);
+    PORTD |= _BV (PORTD2);
+    EICRA = (EICRA & ~0x03) | _BV (ISC01);
+    EIFR = _BV (INT0);
+    EIMSK |= _BV (INT0);
+
+    return 1;
 }
 
 /********************************************************************/
@@ -31,12 +123,132 @@ init (void)
  *  Configure a function to be invoked by touch events on the specified channel.
  *  When the function is invoked, the channel number where the touch event
  *  was detected will be passed as an argument.
+ *
+ *  Handlers are invoked from the TWI interrupt handler, so they should be
+ *  short.
  */
     void
 install_handler (handler, channel)
     void (*handler) (uint8_t);
     uint8_t channel;
 {
+    if (channel >= TOUCH_CHANNELS)
+        return;
+
+    cli ();
+    handlers [channel] = handler;
+    sei ();
+}
+
+/********************************************************************/
+
+/**
+ *  Returns a bitmap of the channels that were touched as of the last ALERT.
+ */
+    uint8_t
+touch_status (void)
+{
+    return touched_channels;
+}
+
+/********************************************************************/
+
+/**
+ *  Call from the main loop after waking up. If the ALERT pin is still low
+ *  with no status read on its way (an ALERT that couldn't be queued, or a
+ *  transfer the device didn't answer), read the status again.
+ */
+    void
+touch_update (void)
+{
+    uint8_t sreg = SREG;
+
+    cli ();
+
+    if ((PIND & _BV (PIND2)) == 0)
+        start_status_read ();
+
+    SREG = sreg;
+}
+
+/********************************************************************/
+
+/**
+ *  Queue the read of the status registers, unless an ALERT is already
+ *  being handled. Must be called with interrupts disabled.
+ */
+    static void
+start_status_read (void)
+{
+    if (alert_busy)
+        return;
+
+    if (i2c_read_registers_async (I2C_CHANNEL, MAIN_CONTROL, status_registers,
+            STATUS_LENGTH, I2C_PRIORITY_URGENT, &status_read_complete, NULL))
+        alert_busy = 1;
+}
+
+/********************************************************************/
+
+/**
+ *  Invoked from the TWI ISR once the status registers have been read.
+ *  Calls the handler for every channel that has been touched since the
+ *  previous ALERT, and then clears the INT bit, keeping the rest of the
+ *  main control register as read.
+ */
+    static void
+status_read_complete (context)
+    void *context;
+{
+    uint8_t clear_interrupt [2];
+    uint8_t current, new_touches;
+
+    // without the status, clearing the INT bit would lose the event.
+    if (i2c_transfer_failed ())
+    {
+        alert_busy = 0;
+        return;
+    }
+
+    clear_interrupt [0] = MAIN_CONTROL;
+    clear_interrupt [1] = status_registers [MAIN_CONTROL] & ~MAIN_CONTROL_INT;
+
+    if (!i2c_send_async (I2C_CHANNEL, clear_interrupt, sizeof (clear_interrupt),
+            I2C_PRIORITY_URGENT, &clear_complete, NULL))
+        alert_busy = 0;
+
+    current = status_registers [SENSOR_INPUT_STATUS];
+    new_touches = current & ~touched_channels;
+    touched_channels = current;
+
+    for (uint8_t channel = 0; new_touches != 0; channel ++, new_touches >>= 1)
+    {
+        if ((new_touches & 0x01) && handlers [channel] != NULL)
+            handlers [channel] (channel);
+    }
+}
+
+/********************************************************************/
+
+/**
+ *  Invoked from the TWI ISR once the INT bit has been cleared (or the
+ *  write was given up on, in which case touch_update tries again).
+ */
+    static void
+clear_complete (context)
+    void *context;
+{
+    alert_busy = 0;
+}
+
+/********************************************************************/
+
+/**
+ *  ALERT pin interrupt handler: queue the status read.
+ */
+ISR (INT0_vect)
+{
+    start_status_read ();
 }
 
 /********************************************************************/
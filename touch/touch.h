@@ -7,8 +7,16 @@
 #ifndef _TOUCH_H
 #define _TOUCH_H
 
-void touch_init (void);
+#include <stdint.h>
+
+// number of sensor channels on the CAP1188. Channels are numbered 0 to 7,
+// corresponding to the CS1 to CS8 pins.
+#define TOUCH_CHANNELS      8
+
+uint8_t touch_init (void);
 void install_handler (void (*handler) (uint8_t), uint8_t channel);
+uint8_t touch_status (void);
+void touch_update (void);
 
 #endif // _TOUCH_H
 